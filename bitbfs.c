@@ -0,0 +1,439 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      bitbfs.c
+ * @brief     Bit-parallel breadth-first search over a bitboard of the maze
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "maze_trace.h"
+#include "bitbfs.h"
+
+/// Bit x & 63 of word CELL_WORD(x, y) is the cell (x, y). Each row has an
+/// empty word on either side and there is an empty row above and below,
+/// so the neighbours of any word are inside the board.
+#define CELL_WORD(bfs, x, y) (((size_t) (y) + 1) * (bfs)->stride + 1 + ((size_t) (x) >> 6))
+#define CELL_BIT(x) ((uint64_t) 1 << ((x) & 63))
+
+/// The boards and the cells each level reached
+typedef struct bitbfs {
+  int width;
+  int height;
+  /// Words per row, including the two empty ones
+  size_t stride;
+  uint64_t* open;
+  uint64_t* seen;
+  unsigned long reached;
+  /// New cells of every level, bits[i] of word[i]; a word can appear
+  /// more than once in a level when several frontier words reach it
+  uint32_t* word;
+  uint64_t* bits;
+  size_t count;
+  size_t capacity;
+  /// Level k is entries first[k] .. first[k + 1] - 1 (count for the last)
+  size_t* first;
+  size_t levels;
+  size_t level_capacity;
+} bitbfs_t;
+
+/**
+ * @brief     Allocates empty boards for a width x height maze
+ */
+static int bitbfs_alloc(bitbfs_t* bfs, int width, int height){
+  size_t words;
+
+  memset(bfs, 0, sizeof(bitbfs_t));
+  bfs->width = width;
+  bfs->height = height;
+  bfs->stride = (((size_t) width + 63) >> 6) + 2;
+  words = bfs->stride * ((size_t) height + 2);
+  if(words > UINT32_MAX){
+    fprintf(stderr,"Maze too large for the bitboard BFS\n");
+    return -1;
+  }
+  bfs->open = calloc(words, sizeof(uint64_t));
+  bfs->seen = calloc(words, sizeof(uint64_t));
+  if(bfs->open == NULL || bfs->seen == NULL){
+    perror("Out of memory");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief     Packs the open cells of the maze into a board
+ */
+static int bitbfs_init(bitbfs_t* bfs, const maze_t* maze){
+  int x, y;
+
+  if(bitbfs_alloc(bfs, maze->width, maze->height) != 0) return -1;
+  for(y = 0; y < maze->height; y++){
+    uint64_t* row = bfs->open + CELL_WORD(bfs, 0, y);
+    for(x = 0; x < maze->width; x++){
+      if(maze_at(maze, x, y)->type != WALL)
+        row[x >> 6] |= CELL_BIT(x);
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief     Packs the open cells of maze text into a board, skipping the cells
+ */
+static int bitbfs_init_text(bitbfs_t* bfs, const char* text, int width, int height){
+  int x, y;
+
+  if(bitbfs_alloc(bfs, width, height) != 0) return -1;
+  for(y = 0; y < height; y++){
+    const char* cells = text + (size_t) y * (width + 1);
+    uint64_t* row = bfs->open + CELL_WORD(bfs, 0, y);
+    for(x = 0; x < width; x++){
+      if(cells[x] != WALL)
+        row[x >> 6] |= CELL_BIT(x);
+    }
+  }
+  return 0;
+}
+
+static void bitbfs_free(bitbfs_t* bfs){
+  free(bfs->open);
+  free(bfs->seen);
+  free(bfs->word);
+  free(bfs->bits);
+  free(bfs->first);
+}
+
+/**
+ * @brief     Starts a new level at the end of the kept words
+ */
+static int begin_level(bitbfs_t* bfs){
+  if(bfs->levels == bfs->level_capacity){
+    size_t capacity = bfs->level_capacity ? bfs->level_capacity * 2 : 1024;
+    size_t* grown = realloc(bfs->first, capacity * sizeof(size_t));
+    if(grown == NULL) return -1;
+    bfs->first = grown;
+    bfs->level_capacity = capacity;
+  }
+  bfs->first[bfs->levels++] = bfs->count;
+  return 0;
+}
+
+/**
+ * @brief     Adds the cells of candidates not yet reached to the current level
+ * Returns -1 if out of memory.
+ */
+static inline int reach(bitbfs_t* bfs, size_t word, uint64_t candidates){
+  uint64_t fresh = candidates & bfs->open[word] & ~bfs->seen[word];
+
+  if(fresh == 0) return 0;
+  bfs->seen[word] |= fresh;
+  bfs->reached += __builtin_popcountll(fresh);
+  if(bfs->count == bfs->capacity){
+    size_t capacity = bfs->capacity ? bfs->capacity * 2 : 4096;
+    uint32_t* word_grown = realloc(bfs->word, capacity * sizeof(uint32_t));
+    if(word_grown == NULL) return -1;
+    bfs->word = word_grown;
+    uint64_t* bits_grown = realloc(bfs->bits, capacity * sizeof(uint64_t));
+    if(bits_grown == NULL) return -1;
+    bfs->bits = bits_grown;
+    bfs->capacity = capacity;
+  }
+  bfs->word[bfs->count] = (uint32_t) word;
+  bfs->bits[bfs->count] = fresh;
+  bfs->count++;
+  return 0;
+}
+
+/**
+ * @brief     Moves (x, y) to a neighbour first reached on the given level
+ * Returns 0 on success, -1 if there is none (which a finished search rules out).
+ */
+static int step_back(const bitbfs_t* bfs, size_t level, int* x, int* y){
+  static const int step[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+  size_t end = level + 1 < bfs->levels ? bfs->first[level + 1] : bfs->count;
+  size_t word[4];
+  uint64_t bit[4];
+  size_t i;
+  int k;
+
+  // Neighbours past the edge land in the empty words, never in a level
+  for(k = 0; k < 4; k++){
+    int next_x = *x + step[k][0];
+    int next_y = *y + step[k][1];
+    word[k] = next_x < 0 ? CELL_WORD(bfs, 0, next_y) - 1 : CELL_WORD(bfs, next_x, next_y);
+    bit[k] = next_x < 0 ? CELL_BIT(63) : CELL_BIT(next_x);
+  }
+  for(i = bfs->first[level]; i < end; i++){
+    for(k = 0; k < 4; k++){
+      if(bfs->word[i] == word[k] && (bfs->bits[i] & bit[k])){
+        *x += step[k][0];
+        *y += step[k][1];
+        return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief     Searches from (start_x, start_y) until (goal_x, goal_y) is reached
+ * Each level expands the words kept for the level before it. A frontier
+ * word f at w reaches f << 1 | f >> 1 in w itself, its top bit in bit 0
+ * of w + 1, its bottom bit in bit 63 of w - 1, and f in the words one
+ * row above and below. Unless keep_levels is set only the last level is
+ * kept, at the front of the word list and without a table of levels, so
+ * memory does not grow with the depth of the search. The cells reached
+ * by each level are passed to count, if given, which may set stop to end
+ * the search before the next level. Returns 1 with the number of levels in
+ * steps if the goal was reached, 0 if not (or if stop was set), -1 after
+ * printing the reason on error.
+ */
+static int bitbfs_run(bitbfs_t* bfs, int start_x, int start_y, int goal_x, int goal_y,
+                      int keep_levels, const volatile int* stop, size_t* steps,
+                      void (*count)(unsigned long cells)){
+  size_t goal_word = CELL_WORD(bfs, goal_x, goal_y);
+  uint64_t goal_bit = CELL_BIT(goal_x);
+  unsigned long charged = 0;
+  size_t level = 0;
+  int failed = 0;
+
+  if(keep_levels)
+    failed |= begin_level(bfs);
+  if(!failed)
+    failed |= reach(bfs, CELL_WORD(bfs, start_x, start_y), CELL_BIT(start_x));
+
+  while(!failed && !(bfs->seen[goal_word] & goal_bit)){
+    // Without the kept levels the last level is all there is, from entry 0
+    size_t begin = keep_levels ? bfs->first[level] : 0;
+
+    if(count != NULL){
+      count(bfs->reached - charged);
+      charged = bfs->reached;
+    }
+    size_t end = bfs->count;
+    size_t i;
+
+    // Nothing new on the last level, the goal cannot be reached
+    if(begin == end || *stop) break;
+    if(keep_levels && begin_level(bfs) != 0){
+      failed = 1;
+      break;
+    }
+    for(i = begin; i < end && !failed; i++){
+      size_t w = bfs->word[i];
+      uint64_t f = bfs->bits[i];
+      failed |= reach(bfs, w, f << 1 | f >> 1);
+      failed |= reach(bfs, w + 1, f >> 63);
+      failed |= reach(bfs, w - 1, f << 63);
+      failed |= reach(bfs, w - bfs->stride, f);
+      failed |= reach(bfs, w + bfs->stride, f);
+    }
+    level++;
+    if(!keep_levels){
+      // Slide the new level down over the one just expanded
+      memmove(bfs->word, bfs->word + end, (bfs->count - end) * sizeof(uint32_t));
+      memmove(bfs->bits, bfs->bits + end, (bfs->count - end) * sizeof(uint64_t));
+      bfs->count -= end;
+    }
+  }
+  if(count != NULL && bfs->reached > charged)
+    count(bfs->reached - charged);
+
+  if(failed){
+    perror("Out of memory");
+    return -1;
+  }
+  *steps = level;
+  return (bfs->seen[goal_word] & goal_bit) != 0;
+}
+
+/**
+ * @brief     Finds a shortest path from the maze's start to its goal
+ * Returns 1 if the goal was reached, 0 if not (or if stop was set), -1
+ * after printing the reason on error.
+ */
+int bitbfs_solve(maze_t* maze, int mark, const volatile int* stop,
+                 unsigned long long* steps, void (*count)(unsigned long cells)){
+  bitbfs_t bfs;
+  size_t level = 0;
+  int found;
+
+  *steps = 0;
+  if(bitbfs_init(&bfs, maze) != 0){
+    bitbfs_free(&bfs);
+    return -1;
+  }
+  found = bitbfs_run(&bfs, maze->startX, maze->startY, maze->goalX, maze->goalY, mark,
+                     stop, &level, count);
+  if(found == 1){
+    *steps = level;
+    if(mark){
+      /// Walk back from the goal, one level at a time
+      int x = maze->goalX;
+      int y = maze->goalY;
+      while(level > 1 && step_back(&bfs, --level, &x, &y) == 0){
+        maze_cell_t* cell = maze_at(maze, x, y);
+        if(cell->type != START && cell->type != GOAL){
+          cell->type = PATH;
+          TRACE_CELL(x, y, PATH);
+        }
+      }
+    }
+  }
+
+  bitbfs_free(&bfs);
+  return found;
+}
+
+/**
+ * @brief     Finds the shortest path length between two cells of maze text
+ * The board is packed straight from the text, so the maze is never built
+ * as cells: the search takes two bits a cell plus its frontier. Returns 1
+ * with the length in steps if the goal is reachable, 0 if not, -1 after
+ * printing the reason on error.
+ */
+int bitbfs_text_distance(const char* text, int width, int height, int start_x, int start_y,
+                         int goal_x, int goal_y, unsigned long long* steps){
+  volatile int never = 0;
+  size_t level = 0;
+  bitbfs_t bfs;
+  int found;
+
+  *steps = 0;
+  if(bitbfs_init_text(&bfs, text, width, height) != 0){
+    bitbfs_free(&bfs);
+    return -1;
+  }
+  found = bitbfs_run(&bfs, start_x, start_y, goal_x, goal_y, 0, &never, &level, NULL);
+  if(found == 1)
+    *steps = level;
+  bitbfs_free(&bfs);
+  return found;
+}
+
+/// One row of every maze in a batch, lane l holds the row of maze l. GCC
+/// lowers the operations to whatever vector instructions the target has:
+/// SSE2 pairs by default, AVX2 or AVX-512 with make NATIVE=1.
+typedef uint64_t lanes_t __attribute__((vector_size(BITBFS_LANES * sizeof(uint64_t))));
+
+/**
+ * @brief     Returns a reached cell's level modulo 3, or -1 if it was not reached
+ */
+static int level_class(const lanes_t* seen, const lanes_t* low, const lanes_t* high,
+                       int lane, int x, int y){
+  uint64_t bit;
+
+  if(x < 0 || x >= BITBFS_BATCH_WIDTH) return -1;
+  bit = CELL_BIT(x);
+  if(!(seen[y + 1][lane] & bit)) return -1;
+  return (low[y + 1][lane] & bit) ? 1 : (high[y + 1][lane] & bit) ? 2 : 0;
+}
+
+/**
+ * @brief     Solves up to BITBFS_LANES mazes in lockstep
+ * Every level is one pass over the rows, each step of it done for all the
+ * lanes at once. Rather than keeping every level, each cell records its
+ * level modulo 3 in two more boards (low for 1, high for 2): neighbouring
+ * cells are at most one level apart, so the neighbour one level nearer
+ * the start is the one whose class is one less. Returns 0 on success, -1
+ * after printing the reason on error.
+ */
+int bitbfs_batch(bitbfs_lane_t* lanes, int count){
+  unsigned all = (1u << BITBFS_LANES) - 1;
+  unsigned finished = 0;
+  long level = 0;
+  int height = 0;
+  int l, y;
+
+  for(l = 0; l < count; l++){
+    if(lanes[l].height > height) height = lanes[l].height;
+  }
+  size_t rows = (size_t) height + 2;
+  size_t bytes = 6 * rows * sizeof(lanes_t);
+  lanes_t* board = aligned_alloc(sizeof(lanes_t), bytes);
+  if(board == NULL){
+    perror("Out of memory");
+    return -1;
+  }
+  memset(board, 0, bytes);
+  // Rows 0 and height + 1 stay empty, so every row has a row above and below
+  lanes_t* open = board;
+  lanes_t* seen = board + rows;
+  lanes_t* low = board + 2 * rows;
+  lanes_t* high = board + 3 * rows;
+  lanes_t* front = board + 4 * rows;
+  lanes_t* next = board + 5 * rows;
+
+  for(l = 0; l < count; l++){
+    bitbfs_lane_t* lane = &lanes[l];
+    for(y = 0; y < lane->height; y++)
+      open[y + 1][l] = lane->open[y];
+    memset(lane->path, 0, lane->height * sizeof(uint64_t));
+    front[lane->startY + 1][l] = seen[lane->startY + 1][l] = CELL_BIT(lane->startX);
+    lane->steps = -1;
+    if(lane->startX == lane->goalX && lane->startY == lane->goalY){
+      lane->steps = 0;
+      finished |= 1u << l;
+    }
+  }
+  // Unused lanes have nothing open and finish on the first level
+  while(finished != all){
+    lanes_t zero = {0};
+    lanes_t any = zero;
+    lanes_t to_low = level % 3 == 0 ? ~zero : zero;
+    lanes_t to_high = level % 3 == 1 ? ~zero : zero;
+    lanes_t* swap;
+    level++;
+
+    for(y = 1; y <= height; y++){
+      lanes_t f = front[y];
+      lanes_t fresh = (f << 1 | f >> 1 | front[y - 1] | front[y + 1]) & open[y] & ~seen[y];
+      next[y] = fresh;
+      seen[y] |= fresh;
+      low[y] |= fresh & to_low;
+      high[y] |= fresh & to_high;
+      any |= fresh;
+    }
+    swap = front;
+    front = next;
+    next = swap;
+
+    for(l = 0; l < BITBFS_LANES; l++){
+      if(finished & (1u << l)) continue;
+      if(l < count && (seen[lanes[l].goalY + 1][l] & CELL_BIT(lanes[l].goalX))){
+        lanes[l].steps = level;
+        finished |= 1u << l;
+      }else if(any[l] == 0){
+        finished |= 1u << l;
+      }
+    }
+  }
+
+  /// Walk back from each goal to the neighbour one level nearer the start
+  for(l = 0; l < count; l++){
+    static const int step[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+    int x = lanes[l].goalX;
+    int y = lanes[l].goalY;
+    long at;
+    for(at = lanes[l].steps - 1; at > 0; at--){
+      int k;
+      for(k = 0; k < 4; k++){
+        if(level_class(seen, low, high, l, x + step[k][0], y + step[k][1]) == at % 3)
+          break;
+      }
+      if(k == 4) break;
+      x += step[k][0];
+      y += step[k][1];
+      lanes[l].path[y] |= CELL_BIT(x);
+    }
+  }
+
+  free(board);
+  return 0;
+}
+/** @} */
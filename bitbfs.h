@@ -0,0 +1,88 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      bitbfs.h
+ * @brief     Bit-parallel breadth-first search over a bitboard of the maze
+ *
+ * The open cells are packed 64 to a word, one run of words per row, and
+ * the search keeps the cells it has reached in a second board of the same
+ * shape. A level is expanded a word at a time: shifting a frontier word
+ * left and right (carrying into the neighbouring words) and copying it to
+ * the rows above and below gives every neighbour of its 64 cells, and
+ * ANDing with the open board and the complement of the reached board
+ * leaves the cells first reached on the next level. Only words holding
+ * frontier cells are looked at, so a level costs about as much as the
+ * number of frontier words rather than the size of the maze.
+ *
+ * When the path is wanted the new words of every level are kept, so it is
+ * traced back from the goal by finding a neighbour on each earlier level
+ * in turn; otherwise only the frontier is kept. Terrain
+ * costs are ignored, as in the other BFS solvers.
+ */
+
+#ifndef BITBFS_H
+#define BITBFS_H
+
+#include <stdint.h>
+#include "maze_types.h"
+
+/**
+ * Finds a shortest path from the maze's start to its goal, counting steps.
+ * If mark is non-zero the path cells are set to PATH. The cells reached
+ * by each level are passed to count, if not NULL, and the search stops
+ * before the next level once stop becomes non-zero. Returns 1 if the goal
+ * was reached, 0 if not (or if stopped), -1 after printing the reason on
+ * error.
+ */
+int bitbfs_solve(maze_t* maze, int mark, const volatile int* stop,
+                 unsigned long long* steps, void (*count)(unsigned long cells));
+
+/**
+ * Finds the shortest path length between two cells of maze text whose rows
+ * are width cells wide, without building the maze's cells. Returns 1 with
+ * the length in steps if the goal is reachable, 0 if not, -1 after printing
+ * the reason on error.
+ */
+int bitbfs_text_distance(const char* text, int width, int height, int start_x, int start_y,
+                         int goal_x, int goal_y, unsigned long long* steps);
+
+/*
+ * Lockstep batch kernel for small mazes
+ *
+ * A maze at most BITBFS_BATCH_WIDTH cells wide keeps each row in a single
+ * word, so BITBFS_LANES such mazes fit side by side in one vector per row.
+ * The flood fill then runs on all of them at once, each vector operation
+ * doing the same step for every maze, until every maze has reached its
+ * goal or run out of cells.
+ */
+
+/// Mazes solved together, one per vector lane
+#define BITBFS_LANES 8
+/// Widest maze the batch kernel takes
+#define BITBFS_BATCH_WIDTH 64
+
+/// One maze of a batch
+typedef struct bitbfs_lane {
+  int height;
+  int startX;
+  int startY;
+  int goalX;
+  int goalY;
+  /// Row masks, bit x of open[y] is set for every cell that is not a wall
+  const uint64_t* open;
+  /// Filled in by bitbfs_batch: the path cells other than S and G as row
+  /// masks, and the path length in steps or -1 if the goal is unreachable
+  uint64_t* path;
+  long steps;
+} bitbfs_lane_t;
+
+/**
+ * Solves up to BITBFS_LANES mazes in lockstep. Returns 0 on success, -1
+ * after printing the reason on error.
+ */
+int bitbfs_batch(bitbfs_lane_t* lanes, int count);
+
+#endif
+/** @} */
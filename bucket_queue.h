@@ -0,0 +1,92 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      bucket_queue.h
+ * @brief     Monotone bucket queue for the weighted maze searches
+ *
+ * Keys popped never decrease, and a key pushed is at most MAX_CELL_COST + 1
+ * above the last key popped (an A* heuristic moves by at most one per
+ * step). So the keys waiting always fit in a ring of QUEUE_BUCKETS buckets
+ * indexed by key, and a push or pop costs about as much as in a BFS queue.
+ */
+
+#ifndef BUCKET_QUEUE_H
+#define BUCKET_QUEUE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "maze_types.h"
+
+#define QUEUE_BUCKETS 16
+#if QUEUE_BUCKETS < MAX_CELL_COST + 2
+#error "bucket queue ring is too small for the largest cell cost"
+#endif
+
+typedef struct bucket {
+  uint32_t* cells;
+  size_t count;
+  size_t capacity;
+} bucket_t;
+
+/// Starts zeroed (memset), freed with queue_free
+typedef struct bucket_queue {
+  bucket_t buckets[QUEUE_BUCKETS];
+  /// No key below this one is waiting
+  unsigned long long key;
+  size_t size;
+} bucket_queue_t;
+
+/**
+ * @brief     Queues a cell index under a key, returns -1 if out of memory
+ */
+static inline int queue_push(bucket_queue_t* queue, unsigned long long key, uint32_t cell){
+  bucket_t* bucket = &queue->buckets[key % QUEUE_BUCKETS];
+  if(bucket->count == bucket->capacity){
+    size_t capacity = bucket->capacity ? bucket->capacity * 2 : 1024;
+    uint32_t* grown = realloc(bucket->cells, capacity * sizeof(uint32_t));
+    if(grown == NULL) return -1;
+    bucket->cells = grown;
+    bucket->capacity = capacity;
+  }
+  bucket->cells[bucket->count++] = cell;
+  queue->size++;
+  return 0;
+}
+
+/**
+ * @brief     Removes a cell with the smallest key, the queue must not be empty
+ */
+static inline uint32_t queue_pop(bucket_queue_t* queue){
+  bucket_t* bucket = &queue->buckets[queue->key % QUEUE_BUCKETS];
+  while(bucket->count == 0){
+    queue->key++;
+    bucket = &queue->buckets[queue->key % QUEUE_BUCKETS];
+  }
+  queue->size--;
+  return bucket->cells[--bucket->count];
+}
+
+/**
+ * @brief     Empties the queue, keeping its buffers for the next search
+ */
+static inline void queue_clear(bucket_queue_t* queue, unsigned long long key){
+  int k;
+  for(k = 0; k < QUEUE_BUCKETS; k++)
+    queue->buckets[k].count = 0;
+  queue->size = 0;
+  queue->key = key;
+}
+
+/**
+ * @brief     Frees the queue's buffers
+ */
+static inline void queue_free(bucket_queue_t* queue){
+  int k;
+  for(k = 0; k < QUEUE_BUCKETS; k++)
+    free(queue->buckets[k].cells);
+}
+
+#endif
+/** @} */
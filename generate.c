@@ -1,10 +1,29 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
+#include "maze_io.h"
 
 #define DEBUG 0
 
+/// Maze generation algorithms selectable with -a
+typedef enum {
+	ALGO_BACKTRACKER,
+	ALGO_KRUSKAL,
+	ALGO_PRIM,
+	ALGO_WILSON,
+	ALGO_BINARY_TREE,
+	ALGO_SIDEWINDER,
+	ALGO_DIVISION
+} algorithm_t;
+
+static const char* algorithmNames[] = {
+	"backtracker", "kruskal", "prim", "wilson", "binary", "sidewinder", "division"
+};
+
 FILE *f;
+FILE *info; // progress messages, stderr when the maze goes to stdout
 char startChar = 'S';
 char endChar = 'G';
 char wallChar = '#';
@@ -20,7 +39,15 @@ int cellStack[100000000][2];
 int numberOfRemainingCells = 0;
 int remainingCells[100000000][2];
 char cells[20002][20002]; 
+// Largest columns or rows, cells[] also holds the newline after each row
+#define MAX_SIDE 20001
 int count = 0;
+
+// Cell grid used by the non-backtracker algorithms. Cell (r,c) lives at
+// cells[2r+1][2c+1], passages between cells sit on the even row/column.
+int cellRows = 0;
+int cellCols = 0;
+uint64_t rngState = 88172645463325252ULL;
 	
 void initMaze(){
 	int i=0;
@@ -39,19 +66,12 @@ void initMaze(){
 }
 
 void printMaze(){
-	//FILE *f = fopen("log.txt","a");
   int i=0;
-  int j=0;
   for(i =0; i<y; i++){
-    for(j=0; j<x; j++){
-      fprintf(f,"%c",cells[i][j]);
-  //    printf("%c",cells[i][j]);
-    }
-    fprintf(f,"\n");
-//		printf("\n");
+    cells[i][x] = '\n';
+    fwrite(cells[i], 1, x+1, f);
+    cells[i][x] = wallChar;
   }
-//	printf("\n\n\n");
-//	fclose(f);
 }
 
 int searchMaze(){
@@ -73,7 +93,7 @@ int searchMaze(){
 	    }
 	  }
 	if(count == (y*x)/10){
-        	printf("Number of remaining cells: %d\n",numberOfRemainingCells);
+        	fprintf(info,"Number of remaining cells: %d\n",numberOfRemainingCells);
 		count = 0;
         }
 	count++;
@@ -244,31 +264,445 @@ void genMaze(){
   cells[1][1]=startChar;
 }
 
+/**
+ * @brief     xorshift64* generator, rand() is far too slow (and locked) for
+ * the hundreds of millions of draws a 20000x20000 maze needs.
+ */
+static inline uint32_t fastRand(){
+	rngState ^= rngState >> 12;
+	rngState ^= rngState << 25;
+	rngState ^= rngState >> 27;
+	return (uint32_t)((rngState * 2685821657736338717ULL) >> 32);
+}
+
+static inline int cellRow(int cell){ return cell / cellCols; }
+static inline int cellCol(int cell){ return cell % cellCols; }
+
+/**
+ * @brief     Opens the wall between two neighbouring cells
+ */
+static void carvePassage(int a, int b){
+	int ra = cellRow(a), ca = cellCol(a);
+	int rb = cellRow(b), cb = cellCol(b);
+	cells[ra + rb + 1][ca + cb + 1] = pathChar;
+}
+
+/**
+ * @brief     Writes the neighbours of a cell into next[], returns their count
+ */
+static int cellNeighbours(int cell, int* next){
+	int r = cellRow(cell), c = cellCol(cell);
+	int n = 0;
+	if(r > 0) next[n++] = cell - cellCols;
+	if(c < cellCols-1) next[n++] = cell + 1;
+	if(r < cellRows-1) next[n++] = cell + cellCols;
+	if(c > 0) next[n++] = cell - 1;
+	return n;
+}
+
+/**
+ * @brief     Sets up the wall grid with every cell open, ready for carving
+ */
+static int initCellGrid(){
+	int i, j;
+	cellRows = (y-1)/2;
+	cellCols = (x-1)/2;
+	if(cellRows < 1 || cellCols < 1){
+		fprintf(stderr,"Maze must be at least 3x3\n");
+		return 0;
+	}
+	initMaze();
+	for(i = 0; i < cellRows; i++){
+		for(j = 0; j < cellCols; j++){
+			cells[2*i+1][2*j+1] = pathChar;
+		}
+	}
+	return 1;
+}
+
+static void* allocOrDie(size_t n, size_t size){
+	void* p = calloc(n, size);
+	if(p == NULL){
+		perror("Out of memory");
+		exit(1);
+	}
+	return p;
+}
+
+/**
+ * @brief     Kruskal - shuffle every interior wall and knock it down whenever
+ * the two cells it separates are not yet connected (union-find).
+ */
+void genKruskal(){
+	int n = cellRows * cellCols;
+	int* parent = allocOrDie(n, sizeof(int));
+	uint32_t* edges = allocOrDie((size_t)n * 2, sizeof(uint32_t));
+	size_t numEdges = 0;
+	size_t e;
+	int i;
+
+	for(i = 0; i < n; i++){
+		parent[i] = i;
+		// Edge encoding: cell*2 + 0 joins east, cell*2 + 1 joins south
+		if(cellCol(i) < cellCols-1) edges[numEdges++] = (uint32_t)i*2;
+		if(cellRow(i) < cellRows-1) edges[numEdges++] = (uint32_t)i*2 + 1;
+	}
+
+	// Fisher-Yates shuffle
+	for(e = numEdges; e > 1; e--){
+		size_t k = ((uint64_t)fastRand() << 32 | fastRand()) % e;
+		uint32_t t = edges[e-1];
+		edges[e-1] = edges[k];
+		edges[k] = t;
+	}
+
+	int joined = 0;
+	for(e = 0; e < numEdges && joined < n-1; e++){
+		int a = edges[e] >> 1;
+		int b = (edges[e] & 1) ? a + cellCols : a + 1;
+		int ra = a, rb = b;
+		// Find with path halving
+		while(parent[ra] != ra) ra = parent[ra] = parent[parent[ra]];
+		while(parent[rb] != rb) rb = parent[rb] = parent[parent[rb]];
+		if(ra == rb) continue;
+		// Random linking keeps the trees shallow in expectation
+		if(fastRand() & 1) parent[ra] = rb; else parent[rb] = ra;
+		carvePassage(a, b);
+		joined++;
+	}
+
+	free(edges);
+	free(parent);
+}
+
+/**
+ * @brief     Randomized Prim - grow the maze from the start cell by joining
+ * a random frontier cell to a random neighbour already in the maze.
+ */
+void genPrim(){
+	int n = cellRows * cellCols;
+	// 0 = outside, 1 = frontier, 2 = in the maze
+	uint8_t* state = allocOrDie(n, sizeof(uint8_t));
+	int* frontier = allocOrDie(n, sizeof(int));
+	int numFrontier = 0;
+	int next[4], inMaze[4];
+	int k, m, cell;
+
+	state[0] = 2;
+	m = cellNeighbours(0, next);
+	for(k = 0; k < m; k++){
+		state[next[k]] = 1;
+		frontier[numFrontier++] = next[k];
+	}
+
+	while(numFrontier > 0){
+		int pick = fastRand() % numFrontier;
+		cell = frontier[pick];
+		frontier[pick] = frontier[--numFrontier];
+
+		int numIn = 0;
+		m = cellNeighbours(cell, next);
+		for(k = 0; k < m; k++){
+			if(state[next[k]] == 2) inMaze[numIn++] = next[k];
+			else if(state[next[k]] == 0){
+				state[next[k]] = 1;
+				frontier[numFrontier++] = next[k];
+			}
+		}
+		carvePassage(cell, inMaze[fastRand() % numIn]);
+		state[cell] = 2;
+	}
+
+	free(frontier);
+	free(state);
+}
+
+/**
+ * @brief     Wilson - loop-erased random walks, producing a uniform spanning
+ * tree. Loop erasure is implicit: each cell only remembers the direction
+ * it was last left by, so retracing the walk skips every loop.
+ */
+void genWilson(){
+	int n = cellRows * cellCols;
+	uint8_t* inMaze = allocOrDie(n, sizeof(uint8_t));
+	int* exitTo = allocOrDie(n, sizeof(int));
+	int next[4];
+	int i, cur;
+
+	inMaze[fastRand() % n] = 1;
+
+	for(i = 0; i < n; i++){
+		if(inMaze[i]) continue;
+
+		cur = i;
+		while(!inMaze[cur]){
+			int m = cellNeighbours(cur, next);
+			exitTo[cur] = next[fastRand() % m];
+			cur = exitTo[cur];
+		}
+
+		cur = i;
+		while(!inMaze[cur]){
+			inMaze[cur] = 1;
+			carvePassage(cur, exitTo[cur]);
+			cur = exitTo[cur];
+		}
+	}
+
+	free(exitTo);
+	free(inMaze);
+}
+
+/**
+ * @brief     Binary tree - every cell opens either north or west
+ */
+void genBinaryTree(){
+	int r, c;
+	for(r = 0; r < cellRows; r++){
+		for(c = 0; c < cellCols; c++){
+			int cell = r*cellCols + c;
+			if(r > 0 && (c == 0 || (fastRand() & 1)))
+				carvePassage(cell, cell - cellCols);
+			else if(c > 0)
+				carvePassage(cell, cell - 1);
+		}
+	}
+}
+
+/**
+ * @brief     Sidewinder - carve random runs east along each row, closing
+ * every run with a single passage north from one of its cells.
+ */
+void genSidewinder(){
+	int r, c;
+	for(c = 1; c < cellCols; c++){
+		carvePassage(c-1, c);
+	}
+	for(r = 1; r < cellRows; r++){
+		int runStart = 0;
+		for(c = 0; c < cellCols; c++){
+			int cell = r*cellCols + c;
+			if(c < cellCols-1 && (fastRand() & 1)){
+				carvePassage(cell, cell + 1);
+			}else{
+				int pick = r*cellCols + runStart + fastRand() % (c - runStart + 1);
+				carvePassage(pick, pick - cellCols);
+				runStart = c + 1;
+			}
+		}
+	}
+}
+
+/**
+ * @brief     Recursive division - start from one open room and keep
+ * splitting chambers with a wall that has a single gap. Uses an explicit
+ * stack of chambers rather than recursion so huge mazes can't overflow.
+ */
+void genDivision(){
+	typedef struct { int r, c, rows, cols; } chamber_t;
+	int i, j;
+	size_t top = 0;
+	size_t cap = 1024;
+	chamber_t* stack = allocOrDie(cap, sizeof(chamber_t));
+
+	// Open the whole interior, posts included
+	for(i = 1; i < 2*cellRows; i++){
+		for(j = 1; j < 2*cellCols; j++){
+			cells[i][j] = pathChar;
+		}
+	}
+
+	stack[top++] = (chamber_t){0, 0, cellRows, cellCols};
+	while(top > 0){
+		chamber_t ch = stack[--top];
+		if(ch.rows < 2 && ch.cols < 2) continue;
+
+		int horizontal;
+		if(ch.rows < 2) horizontal = 0;
+		else if(ch.cols < 2) horizontal = 1;
+		else if(ch.rows != ch.cols) horizontal = ch.rows > ch.cols;
+		else horizontal = fastRand() & 1;
+
+		if(top + 2 > cap){
+			cap *= 2;
+			stack = realloc(stack, cap * sizeof(chamber_t));
+			if(stack == NULL){
+				perror("Out of memory");
+				exit(1);
+			}
+		}
+
+		if(horizontal){
+			// Wall below cell row k, gap at cell column p
+			int k = ch.r + fastRand() % (ch.rows - 1);
+			int p = ch.c + fastRand() % ch.cols;
+			for(j = 2*ch.c + 1; j < 2*(ch.c + ch.cols); j++){
+				cells[2*k + 2][j] = wallChar;
+			}
+			cells[2*k + 2][2*p + 1] = pathChar;
+			stack[top++] = (chamber_t){ch.r, ch.c, k - ch.r + 1, ch.cols};
+			stack[top++] = (chamber_t){k + 1, ch.c, ch.r + ch.rows - k - 1, ch.cols};
+		}else{
+			// Wall right of cell column k, gap at cell row p
+			int k = ch.c + fastRand() % (ch.cols - 1);
+			int p = ch.r + fastRand() % ch.rows;
+			for(i = 2*ch.r + 1; i < 2*(ch.r + ch.rows); i++){
+				cells[i][2*k + 2] = wallChar;
+			}
+			cells[2*p + 1][2*k + 2] = pathChar;
+			stack[top++] = (chamber_t){ch.r, ch.c, ch.rows, k - ch.c + 1};
+			stack[top++] = (chamber_t){ch.r, k + 1, ch.rows, ch.c + ch.cols - k - 1};
+		}
+	}
+
+	free(stack);
+}
+
+/**
+ * @brief     Places S in the top left cell and G in the cell furthest from it.
+ * Every algorithm here builds a perfect maze, so a BFS over the cell grid
+ * gives the same "deepest point" the backtracker tracks with its stack.
+ */
+void placeStartAndGoal(){
+	int n = cellRows * cellCols;
+	int* queue = allocOrDie(n, sizeof(int));
+	uint8_t* seen = allocOrDie(n, sizeof(uint8_t));
+	int head = 0, tail = 0;
+	int next[4];
+	int k, m, cell = 0;
+
+	queue[tail++] = 0;
+	seen[0] = 1;
+	while(head < tail){
+		cell = queue[head++];
+		int r = cellRow(cell), c = cellCol(cell);
+		m = cellNeighbours(cell, next);
+		for(k = 0; k < m; k++){
+			int nr = cellRow(next[k]), nc = cellCol(next[k]);
+			if(seen[next[k]] || cells[r + nr + 1][c + nc + 1] != pathChar) continue;
+			seen[next[k]] = 1;
+			queue[tail++] = next[k];
+		}
+	}
+
+	// Last cell dequeued is the furthest one
+	cells[2*cellRow(cell) + 1][2*cellCol(cell) + 1] = endChar;
+	cells[0][0] = wallChar;
+	cells[1][1] = startChar;
+
+	free(seen);
+	free(queue);
+}
+
+/**
+ * @brief     Turns about a third of the open cells into weighted terrain,
+ * costs 2-9, for the weighted solvers. Start and goal stay as they are.
+ */
+void addTerrain(){
+	int i, j;
+	for(i = 0; i < y; i++){
+		for(j = 0; j < x; j++){
+			if(cells[i][j] == pathChar && fastRand() % 3 == 0)
+				cells[i][j] = (char) ('2' + fastRand() % 8);
+		}
+	}
+}
+
+/**
+ * @brief     Generates the maze with the requested algorithm
+ */
+void generate(algorithm_t algorithm){
+	if(algorithm == ALGO_BACKTRACKER){
+		genMaze();
+		return;
+	}
+
+	if(!initCellGrid()) exit(1);
+
+	switch(algorithm){
+		case ALGO_KRUSKAL:     genKruskal(); break;
+		case ALGO_PRIM:        genPrim(); break;
+		case ALGO_WILSON:      genWilson(); break;
+		case ALGO_BINARY_TREE: genBinaryTree(); break;
+		case ALGO_SIDEWINDER:  genSidewinder(); break;
+		case ALGO_DIVISION:    genDivision(); break;
+		default: break;
+	}
+
+	placeStartAndGoal();
+}
+
 
 int main(int argc, char** argv){
 /*	printf("Number of Columns: ");
 	scanf("%d",&x);
 	printf("Number of Rows: ");
 	scanf("%d",&y);*/
-  if(argc > 1){
-    if(sscanf(argv[1],"%d",&x) != 1) return;
-    if(sscanf(argv[2],"%d",&y) != 1) return;
+  algorithm_t algorithm = ALGO_BACKTRACKER;
+  char* maze_file_name = NULL;
+  int terrain = 0;
+  int argi = 1;
+  int i;
+
+  if(argc > 2 && argv[1][0] != '-'){
+    if(sscanf(argv[1],"%d",&x) != 1) return 1;
+    if(sscanf(argv[2],"%d",&y) != 1) return 1;
+    argi = 3;
   }
 
+  for(; argi < argc; argi++){
+    if(strcmp(argv[argi],"-a") == 0 && argi + 1 < argc){
+      argi++;
+      for(i = 0; i <= ALGO_DIVISION; i++){
+        if(strcmp(argv[argi],algorithmNames[i]) == 0) break;
+      }
+      if(i > ALGO_DIVISION){
+        fprintf(stderr,"Unknown algorithm '%s'. Valid options:", argv[argi]);
+        for(i = 0; i <= ALGO_DIVISION; i++) fprintf(stderr," %s", algorithmNames[i]);
+        fprintf(stderr,"\n");
+        return 1;
+      }
+      algorithm = (algorithm_t) i;
+    }else if(strcmp(argv[argi],"-o") == 0 && argi + 1 < argc){
+      maze_file_name = argv[++argi];
+    }else if(strcmp(argv[argi],"--terrain") == 0){
+      terrain = 1;
+    }else{
+      fprintf(stderr,"Usage: %s [columns rows] [-a algorithm] [--terrain] [-o file|-]\n", argv[0]);
+      return 1;
+    }
+  }
+  if(x < 3 || y < 3 || x > MAX_SIDE || y > MAX_SIDE){
+    fprintf(stderr,"Columns and rows must be between 3 and %d\n", MAX_SIDE);
+    return 1;
+  }
+
+	info = maze_is_stdio(maze_file_name) ? stderr : stdout;
 	srand(time(NULL));
+	rngState ^= (uint64_t) time(NULL) * 0x9E3779B97F4A7C15ULL;
 	f = fopen("log.txt","w");
-	printf("generating maze\n");
-	genMaze();
+	fprintf(info,"generating maze (%s)\n", algorithmNames[algorithm]);
+	generate(algorithm);
+	if(terrain) addTerrain();
 	fclose(f);
   
-  char* maze_file_name = malloc(80 * sizeof(char));
-  snprintf(maze_file_name,80,"%dx%d_maze",x,y);
-  f = fopen(maze_file_name,"w+");
-  printf("Printing Maze\n");
+  char default_name[80];
+  if(maze_file_name == NULL){
+    snprintf(default_name,80,"%dx%d_maze",x,y);
+    maze_file_name = default_name;
+  }
+  f = maze_open_output(maze_file_name);
+  if(f == NULL){
+    perror("Error: maze file failed to open");
+    return 1;
+  }
+  fprintf(info,"Printing Maze\n");
   printMaze();
-  fclose(f);
-  free(maze_file_name);
-  printf("Done!\n\n");
+  if(maze_close_output(f) != 0){
+    perror("Error: failed to write maze");
+    return 1;
+  }
+  fprintf(info,"Done!\n\n");
 
-	return 1;
+	return 0;
 }
@@ -0,0 +1,899 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      hpa.c
+ * @brief     Hierarchical pathfinding (HPA*) index for large mazes
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "maze_io.h"
+#include "maze_trace.h"
+#include "bucket_queue.h"
+#include "hpa.h"
+
+/// Entrances at least this long get a node at each end, shorter ones one
+/// in the middle
+#define HPA_LONG_ENTRANCE 6
+
+#define HPA_THREADS 64
+
+static const int step[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+
+/// How a maze is cut into clusters
+typedef struct grid {
+  const maze_t* maze;
+  int cluster;
+  int columns;
+  int rows;
+} grid_t;
+
+static void grid_init(grid_t* grid, const maze_t* maze, int cluster){
+  grid->maze = maze;
+  grid->cluster = cluster;
+  grid->columns = (maze->width + cluster - 1) / cluster;
+  grid->rows = (maze->height + cluster - 1) / cluster;
+}
+
+static inline uint32_t cluster_of(const grid_t* grid, uint32_t cell){
+  int x = cell % grid->maze->width;
+  int y = cell / grid->maze->width;
+  return (uint32_t) (y / grid->cluster) * grid->columns + x / grid->cluster;
+}
+
+static inline uint32_t cell_at(const maze_t* maze, int x, int y){
+  return (uint32_t) y * maze->width + x;
+}
+
+/**
+ * @brief     Makes room for one more element in a growing array
+ */
+static int grow(void** data, size_t* capacity, size_t count, size_t size){
+  size_t wanted;
+  void* grown;
+  if(count < *capacity) return 0;
+  wanted = *capacity ? *capacity * 2 : 1024;
+  grown = realloc(*data, wanted * size);
+  if(grown == NULL) return -1;
+  *data = grown;
+  *capacity = wanted;
+  return 0;
+}
+
+/*
+ * Searches confined to one cluster
+ */
+
+/// Dijkstra over the cells of one cluster, indexed from its top left cell
+typedef struct local_search {
+  int x0, y0, w, h;
+  uint32_t* cost;
+  uint32_t* from;
+  bucket_queue_t queue;
+  unsigned long settled;
+} local_search_t;
+
+static int local_init(local_search_t* search, int cluster){
+  memset(search, 0, sizeof(local_search_t));
+  search->cost = malloc((size_t) cluster * cluster * sizeof(uint32_t));
+  search->from = malloc((size_t) cluster * cluster * sizeof(uint32_t));
+  return search->cost != NULL && search->from != NULL ? 0 : -1;
+}
+
+static void local_free(local_search_t* search){
+  free(search->cost);
+  free(search->from);
+  queue_free(&search->queue);
+}
+
+/**
+ * @brief     Cost found by the last search to a maze cell in its cluster
+ */
+static inline uint32_t local_cost(const local_search_t* search, const maze_t* maze, uint32_t cell){
+  int x = cell % maze->width - search->x0;
+  int y = cell / maze->width - search->y0;
+  return search->cost[y * search->w + x];
+}
+
+/**
+ * @brief     Cheapest paths between (x, y) and the cells of its cluster
+ * Forward costs are for paths leaving (x, y); reverse costs are for paths
+ * arriving there, so one search from a goal gives every cell's cost to it.
+ * Stops once the target cell is settled, pass target_x -1 to search the
+ * whole cluster. Returns -1 if out of memory.
+ */
+static int local_search(local_search_t* search, const grid_t* grid, int x, int y,
+                        int reverse, int target_x, int target_y){
+  const maze_t* maze = grid->maze;
+  int c = grid->cluster;
+  uint32_t start, target;
+  int k;
+
+  search->x0 = x / c * c;
+  search->y0 = y / c * c;
+  search->w = maze->width - search->x0 < c ? maze->width - search->x0 : c;
+  search->h = maze->height - search->y0 < c ? maze->height - search->y0 : c;
+  memset(search->cost, 0xff, (size_t) search->w * search->h * sizeof(uint32_t));
+
+  start = (uint32_t) (y - search->y0) * search->w + (x - search->x0);
+  target = target_x < 0 ? UINT32_MAX
+           : (uint32_t) (target_y - search->y0) * search->w + (target_x - search->x0);
+  search->cost[start] = 0;
+  search->from[start] = start;
+  queue_clear(&search->queue, 0);
+  if(queue_push(&search->queue, 0, start) != 0) return -1;
+
+  while(search->queue.size > 0){
+    uint32_t at = queue_pop(&search->queue);
+    // Stale entries are left behind when a cheaper route is found
+    if(search->cost[at] != search->queue.key) continue;
+    search->settled++;
+    if(at == target) break;
+
+    int at_x = at % search->w;
+    int at_y = at / search->w;
+    maze_component_t type = maze_at(maze, search->x0 + at_x, search->y0 + at_y)->type;
+    for(k = 0; k < 4; k++){
+      int next_x = at_x + step[k][0];
+      int next_y = at_y + step[k][1];
+      if(next_x < 0 || next_y < 0 || next_x >= search->w || next_y >= search->h)
+        continue;
+      maze_component_t next_type = maze_at(maze, search->x0 + next_x, search->y0 + next_y)->type;
+      if(next_type == WALL) continue;
+
+      uint32_t next = (uint32_t) next_y * search->w + next_x;
+      uint32_t reached = search->cost[at] + (reverse ? CELL_COST(type) : CELL_COST(next_type));
+      if(reached >= search->cost[next]) continue;
+      search->cost[next] = reached;
+      search->from[next] = at;
+      if(queue_push(&search->queue, reached, next) != 0) return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Building the index
+ */
+
+/// The two cells of an entrance, either side of a cluster border
+typedef struct cell_pair {
+  uint32_t a;
+  uint32_t b;
+} cell_pair_t;
+
+/// Edge found while building, before the edges are grouped by node
+typedef struct build_edge {
+  uint32_t from;
+  uint32_t to;
+  uint32_t cost;
+} build_edge_t;
+
+typedef struct edge_list {
+  build_edge_t* edges;
+  size_t count;
+  size_t capacity;
+  int failed;
+} edge_list_t;
+
+static void add_edge(edge_list_t* list, uint32_t from, uint32_t to, uint32_t cost){
+  if(list->failed || grow((void**) &list->edges, &list->capacity, list->count, sizeof(build_edge_t)) != 0){
+    list->failed = 1;
+    return;
+  }
+  list->edges[list->count].from = from;
+  list->edges[list->count].to = to;
+  list->edges[list->count].cost = cost;
+  list->count++;
+}
+
+typedef struct pair_list {
+  cell_pair_t* pairs;
+  size_t count;
+  size_t capacity;
+  int failed;
+} pair_list_t;
+
+static void add_pair(pair_list_t* list, const maze_t* maze, int x, int y, int ox, int oy){
+  if(list->failed || grow((void**) &list->pairs, &list->capacity, list->count, sizeof(cell_pair_t)) != 0){
+    list->failed = 1;
+    return;
+  }
+  list->pairs[list->count].a = cell_at(maze, x, y);
+  list->pairs[list->count].b = cell_at(maze, x + ox, y + oy);
+  list->count++;
+}
+
+/**
+ * @brief     Places the entrances along one border segment
+ * The segment runs "length" cells from (x, y) in direction (dx, dy), and
+ * its cells face the cells one step (ox, oy) away across the border. Every
+ * run of cells open on both sides is one entrance.
+ */
+static void scan_border(pair_list_t* list, const maze_t* maze, int x, int y,
+                        int dx, int dy, int length, int ox, int oy){
+  int run = 0;
+  int i;
+
+  for(i = 0; i <= length; i++){
+    int cx = x + i * dx;
+    int cy = y + i * dy;
+    if(i < length && maze_at(maze, cx, cy)->type != WALL
+       && maze_at(maze, cx + ox, cy + oy)->type != WALL){
+      run++;
+      continue;
+    }
+    if(run == 0) continue;
+
+    int first = i - run;
+    int last = i - 1;
+    if(run < HPA_LONG_ENTRANCE){
+      int middle = (first + last) / 2;
+      add_pair(list, maze, x + middle * dx, y + middle * dy, ox, oy);
+    }else{
+      add_pair(list, maze, x + first * dx, y + first * dy, ox, oy);
+      add_pair(list, maze, x + last * dx, y + last * dy, ox, oy);
+    }
+    run = 0;
+  }
+}
+
+static int compare_keys(const void* a, const void* b){
+  uint64_t ka = *(const uint64_t*) a;
+  uint64_t kb = *(const uint64_t*) b;
+  return ka < kb ? -1 : ka > kb;
+}
+
+/**
+ * @brief     Node number of a cell, or UINT32_MAX if it is not a node
+ */
+static uint32_t find_node(const uint32_t* cluster_first, const uint32_t* node_cell,
+                          uint32_t cluster, uint32_t cell){
+  uint32_t low = cluster_first[cluster];
+  uint32_t high = cluster_first[cluster + 1];
+  while(low < high){
+    uint32_t middle = low + (high - low) / 2;
+    if(node_cell[middle] < cell) low = middle + 1;
+    else high = middle;
+  }
+  return low < cluster_first[cluster + 1] && node_cell[low] == cell ? low : UINT32_MAX;
+}
+
+/// Work shared by the build threads, which take clusters one at a time
+typedef struct build_state {
+  const grid_t* grid;
+  const uint32_t* cluster_first;
+  const uint32_t* node_cell;
+  uint32_t clusters;
+  uint32_t next_cluster;
+} build_state_t;
+
+typedef struct build_worker {
+  build_state_t* state;
+  edge_list_t list;
+} build_worker_t;
+
+/**
+ * @brief     Build thread: joins the nodes of each cluster it takes
+ */
+static void* build_cluster_edges(void* arg){
+  build_worker_t* worker = arg;
+  build_state_t* state = worker->state;
+  const maze_t* maze = state->grid->maze;
+  local_search_t search;
+  uint32_t c, i, j;
+
+  if(local_init(&search, state->grid->cluster) != 0){
+    worker->list.failed = 1;
+    local_free(&search);
+    return NULL;
+  }
+  while(!worker->list.failed
+        && (c = __atomic_fetch_add(&state->next_cluster, 1, __ATOMIC_RELAXED)) < state->clusters){
+    uint32_t first = state->cluster_first[c];
+    uint32_t last = state->cluster_first[c + 1];
+    if(last - first < 2) continue;
+    for(i = first; i < last; i++){
+      uint32_t cell = state->node_cell[i];
+      if(local_search(&search, state->grid, cell % maze->width, cell / maze->width, 0, -1, -1) != 0){
+        worker->list.failed = 1;
+        break;
+      }
+      for(j = first; j < last; j++){
+        uint32_t cost = local_cost(&search, maze, state->node_cell[j]);
+        if(j != i && cost != UINT32_MAX)
+          add_edge(&worker->list, i, j, cost);
+      }
+    }
+  }
+  local_free(&search);
+  return NULL;
+}
+
+/**
+ * @brief     Points the index arrays into a block holding a whole index
+ * Returns -1 if the block is not a valid index.
+ */
+static int attach(hpa_index_t* index, const char* data, size_t length){
+  const hpa_header_t* header = (const hpa_header_t*) data;
+  size_t clusters, expected;
+
+  if(length < sizeof(hpa_header_t) || memcmp(header->magic, HPA_MAGIC, 4) != 0
+     || header->version != HPA_VERSION || header->cluster < HPA_MIN_CLUSTER
+     || header->cluster > HPA_MAX_CLUSTER)
+    return -1;
+  clusters = (size_t) ((header->width + header->cluster - 1) / header->cluster)
+             * ((header->height + header->cluster - 1) / header->cluster);
+  expected = sizeof(hpa_header_t) + ((size_t) header->nodes + 1) * sizeof(uint64_t)
+             + header->edges * sizeof(hpa_edge_t) + (clusters + 1) * sizeof(uint32_t)
+             + (size_t) header->nodes * sizeof(uint32_t);
+  if(length != expected) return -1;
+
+  index->header = header;
+  index->first = (const uint64_t*) (header + 1);
+  index->edge = (const hpa_edge_t*) (index->first + header->nodes + 1);
+  index->cluster_first = (const uint32_t*) (index->edge + header->edges);
+  index->node_cell = index->cluster_first + clusters + 1;
+  return 0;
+}
+
+/**
+ * @brief     Hash of the maze's walls and terrain, ignoring S, G and marks
+ */
+uint64_t hpa_layout_hash(const maze_t* maze){
+  char* row = malloc(maze->width + 1);
+  uint64_t hash = 0x6a09e667f3bcc908ULL ^ ((uint64_t) maze->width << 32 | (uint32_t) maze->height);
+  int x, y;
+
+  if(row == NULL) return 0;
+  for(y = 0; y < maze->height; y++){
+    for(x = 0; x < maze->width; x++){
+      maze_component_t type = maze_at(maze, x, y)->type;
+      row[x] = type == WALL || IS_TERRAIN(type) ? (char) type : BLANK;
+    }
+    hash = (hash ^ maze_hash(row, maze->width)) * 0x9e3779b97f4a7c15ULL;
+  }
+  free(row);
+  return hash;
+}
+
+/**
+ * @brief     Builds the index of a maze
+ * Entrances are found along every cluster border, each of their cells
+ * becomes a node, and the clusters are searched in parallel to join the
+ * nodes inside them. Returns 0 on success or -1 after printing the reason.
+ */
+int hpa_build(hpa_index_t* index, const maze_t* maze, int cluster){
+  grid_t grid;
+  pair_list_t entrances;
+  edge_list_t crossings;
+  build_state_t state;
+  build_worker_t workers[HPA_THREADS];
+  pthread_t threads[HPA_THREADS];
+  int started[HPA_THREADS];
+  uint64_t* keys = NULL;
+  uint64_t* fill = NULL;
+  size_t key_count, nodes, clusters, edges, i;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int thread_count, k, failed = 0;
+  int cx, cy;
+
+  memset(index, 0, sizeof(hpa_index_t));
+  if(cluster < HPA_MIN_CLUSTER || cluster > HPA_MAX_CLUSTER){
+    fprintf(stderr,"Cluster size must be %d to %d\n", HPA_MIN_CLUSTER, HPA_MAX_CLUSTER);
+    return -1;
+  }
+  if((size_t) maze->width * maze->height > UINT32_MAX){
+    fprintf(stderr,"Maze too large for an index\n");
+    return -1;
+  }
+  grid_init(&grid, maze, cluster);
+  clusters = (size_t) grid.columns * grid.rows;
+
+  /// Find the entrances along every border between two clusters
+  memset(&entrances, 0, sizeof(entrances));
+  for(cx = 0; cx + 1 < grid.columns; cx++){
+    for(cy = 0; cy < grid.rows; cy++){
+      int y0 = cy * cluster;
+      int length = maze->height - y0 < cluster ? maze->height - y0 : cluster;
+      scan_border(&entrances, maze, (cx + 1) * cluster - 1, y0, 0, 1, length, 1, 0);
+    }
+  }
+  for(cy = 0; cy + 1 < grid.rows; cy++){
+    for(cx = 0; cx < grid.columns; cx++){
+      int x0 = cx * cluster;
+      int length = maze->width - x0 < cluster ? maze->width - x0 : cluster;
+      scan_border(&entrances, maze, x0, (cy + 1) * cluster - 1, 1, 0, length, 0, 1);
+    }
+  }
+  if(entrances.failed) goto out_of_memory;
+
+  /// Number the nodes by cluster, then cell; a cell on two borders is one node
+  key_count = entrances.count * 2;
+  keys = malloc((key_count ? key_count : 1) * sizeof(uint64_t));
+  if(keys == NULL) goto out_of_memory;
+  for(i = 0; i < entrances.count; i++){
+    keys[2 * i] = (uint64_t) cluster_of(&grid, entrances.pairs[i].a) << 32 | entrances.pairs[i].a;
+    keys[2 * i + 1] = (uint64_t) cluster_of(&grid, entrances.pairs[i].b) << 32 | entrances.pairs[i].b;
+  }
+  qsort(keys, key_count, sizeof(uint64_t), compare_keys);
+  for(i = nodes = 0; i < key_count; i++){
+    if(nodes == 0 || keys[i] != keys[nodes - 1])
+      keys[nodes++] = keys[i];
+  }
+
+  /// Cluster and node tables, copied into the index once the edges are known
+  uint32_t* cluster_first = calloc(clusters + 1, sizeof(uint32_t));
+  uint32_t* node_cell = malloc((nodes ? nodes : 1) * sizeof(uint32_t));
+  if(cluster_first == NULL || node_cell == NULL){
+    free(cluster_first);
+    free(node_cell);
+    goto out_of_memory;
+  }
+  for(i = 0; i < nodes; i++){
+    node_cell[i] = (uint32_t) keys[i];
+    cluster_first[(keys[i] >> 32) + 1]++;
+  }
+  for(i = 0; i < clusters; i++)
+    cluster_first[i + 1] += cluster_first[i];
+  free(keys);
+  keys = NULL;
+
+  /// Edges across the borders
+  memset(&crossings, 0, sizeof(crossings));
+  for(i = 0; i < entrances.count; i++){
+    uint32_t a = entrances.pairs[i].a;
+    uint32_t b = entrances.pairs[i].b;
+    uint32_t node_a = find_node(cluster_first, node_cell, cluster_of(&grid, a), a);
+    uint32_t node_b = find_node(cluster_first, node_cell, cluster_of(&grid, b), b);
+    add_edge(&crossings, node_a, node_b, CELL_COST(maze_at(maze, b % maze->width, b / maze->width)->type));
+    add_edge(&crossings, node_b, node_a, CELL_COST(maze_at(maze, a % maze->width, a / maze->width)->type));
+  }
+  free(entrances.pairs);
+  entrances.pairs = NULL;
+
+  /// Edges inside the clusters, a search from every node, on all cores
+  thread_count = cores < 1 ? 1 : cores > HPA_THREADS ? HPA_THREADS : (int) cores;
+  state.grid = &grid;
+  state.cluster_first = cluster_first;
+  state.node_cell = node_cell;
+  state.clusters = (uint32_t) clusters;
+  state.next_cluster = 0;
+  for(k = 0; k < thread_count; k++){
+    memset(&workers[k], 0, sizeof(build_worker_t));
+    workers[k].state = &state;
+  }
+  for(k = 1; k < thread_count; k++)
+    started[k] = pthread_create(&threads[k], NULL, build_cluster_edges, &workers[k]) == 0;
+  build_cluster_edges(&workers[0]);
+  for(k = 1; k < thread_count; k++){
+    if(started[k]) pthread_join(threads[k], NULL);
+  }
+  edges = crossings.count;
+  failed = crossings.failed;
+  for(k = 0; k < thread_count; k++){
+    edges += workers[k].list.count;
+    failed |= workers[k].list.failed;
+  }
+
+  /// Lay the index out in one block, edges grouped by node
+  index->length = sizeof(hpa_header_t) + (nodes + 1) * sizeof(uint64_t)
+                  + edges * sizeof(hpa_edge_t) + (clusters + 1) * sizeof(uint32_t)
+                  + nodes * sizeof(uint32_t);
+  index->built = failed ? NULL : calloc(1, index->length);
+  fill = failed ? NULL : calloc(nodes + 1, sizeof(uint64_t));
+  if(index->built != NULL && fill != NULL){
+    hpa_header_t* header = (hpa_header_t*) index->built;
+    uint64_t* first = (uint64_t*) (header + 1);
+    hpa_edge_t* edge = (hpa_edge_t*) (first + nodes + 1);
+    memcpy(header->magic, HPA_MAGIC, 4);
+    header->version = HPA_VERSION;
+    header->width = (uint32_t) maze->width;
+    header->height = (uint32_t) maze->height;
+    header->cluster = (uint32_t) cluster;
+    header->nodes = (uint32_t) nodes;
+    header->edges = edges;
+    header->layout = hpa_layout_hash(maze);
+
+    for(k = -1; k < thread_count; k++){
+      edge_list_t* list = k < 0 ? &crossings : &workers[k].list;
+      for(i = 0; i < list->count; i++)
+        first[list->edges[i].from + 1]++;
+    }
+    for(i = 0; i < nodes; i++)
+      first[i + 1] += first[i];
+    for(k = -1; k < thread_count; k++){
+      edge_list_t* list = k < 0 ? &crossings : &workers[k].list;
+      for(i = 0; i < list->count; i++){
+        uint32_t from = list->edges[i].from;
+        hpa_edge_t* slot = &edge[first[from] + fill[from]++];
+        slot->to = list->edges[i].to;
+        slot->cost = list->edges[i].cost;
+      }
+    }
+    memcpy(edge + edges, cluster_first, (clusters + 1) * sizeof(uint32_t));
+    memcpy((uint32_t*) (edge + edges) + clusters + 1, node_cell, nodes * sizeof(uint32_t));
+    attach(index, index->built, index->length);
+  }else{
+    failed = 1;
+  }
+
+  free(fill);
+  free(crossings.edges);
+  for(k = 0; k < thread_count; k++)
+    free(workers[k].list.edges);
+  free(cluster_first);
+  free(node_cell);
+  if(failed){
+    free(index->built);
+    index->built = NULL;
+    goto out_of_memory;
+  }
+  return 0;
+
+out_of_memory:
+  free(entrances.pairs);
+  free(keys);
+  perror("Out of memory");
+  return -1;
+}
+
+/**
+ * @brief     Writes an index to a file ("-" for stdout)
+ * Returns 0 on success or -1 after printing the reason.
+ */
+int hpa_save(const hpa_index_t* index, const char* path){
+  const char* data = index->built != NULL ? index->built : index->file.data;
+  FILE* out = maze_open_output(path);
+  int status = 0;
+
+  if(out == NULL){
+    perror("Error: index file failed to open");
+    return -1;
+  }
+  if(fwrite(data, 1, index->length, out) != index->length)
+    status = -1;
+  if(maze_close_output(out) != 0)
+    status = -1;
+  if(status != 0)
+    perror("Error: failed to write index");
+  return status;
+}
+
+/**
+ * @brief     Maps an index file into memory
+ * Only the pages a query touches are read. Returns 0 on success or -1
+ * after printing the reason.
+ */
+int hpa_load(hpa_index_t* index, const char* path){
+  memset(index, 0, sizeof(hpa_index_t));
+  if(maze_text_open(&index->file, path) != 0){
+    perror("Error: index file failed to open");
+    return -1;
+  }
+  index->length = index->file.length;
+  if(attach(index, index->file.data, index->file.length) != 0){
+    fprintf(stderr,"Invalid index file '%s'\n", path);
+    maze_text_close(&index->file);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief     Non-zero if the index was built for this maze's layout
+ */
+int hpa_matches(const hpa_index_t* index, const maze_t* maze){
+  return index->header->width == (uint32_t) maze->width
+         && index->header->height == (uint32_t) maze->height
+         && index->header->layout == hpa_layout_hash(maze);
+}
+
+/**
+ * @brief     Releases an index
+ */
+void hpa_free(hpa_index_t* index){
+  if(index->built != NULL)
+    free(index->built);
+  else if(index->header != NULL)
+    maze_text_close(&index->file);
+  memset(index, 0, sizeof(hpa_index_t));
+}
+
+/*
+ * Queries
+ */
+
+/// Entry of the abstract search's open list, a binary heap on f
+typedef struct open_entry {
+  unsigned long long f;
+  uint32_t node;
+} open_entry_t;
+
+typedef struct open_list {
+  open_entry_t* entries;
+  size_t count;
+  size_t capacity;
+} open_list_t;
+
+static int open_push(open_list_t* open, unsigned long long f, uint32_t node){
+  size_t at;
+  if(grow((void**) &open->entries, &open->capacity, open->count, sizeof(open_entry_t)) != 0)
+    return -1;
+  at = open->count++;
+  while(at > 0 && open->entries[(at - 1) / 2].f > f){
+    open->entries[at] = open->entries[(at - 1) / 2];
+    at = (at - 1) / 2;
+  }
+  open->entries[at].f = f;
+  open->entries[at].node = node;
+  return 0;
+}
+
+static uint32_t open_pop(open_list_t* open){
+  uint32_t node = open->entries[0].node;
+  open_entry_t last = open->entries[--open->count];
+  size_t at = 0;
+  for(;;){
+    size_t child = 2 * at + 1;
+    if(child >= open->count) break;
+    if(child + 1 < open->count && open->entries[child + 1].f < open->entries[child].f)
+      child++;
+    if(open->entries[child].f >= last.f) break;
+    open->entries[at] = open->entries[child];
+    at = child;
+  }
+  if(open->count > 0)
+    open->entries[at] = last;
+  return node;
+}
+
+/**
+ * @brief     Marks a cell of the path, leaving the start and goal alone
+ */
+static void mark_path(maze_t* maze, uint32_t cell){
+  int x = cell % maze->width;
+  int y = cell / maze->width;
+  if(maze_at(maze, x, y)->type != START && maze_at(maze, x, y)->type != GOAL){
+    maze_at(maze, x, y)->type = PATH;
+    TRACE_CELL(x, y, PATH);
+  }
+}
+
+/// Whether cell is on the route being refined
+#define ON_ROUTE(seen, cell) ((seen)[(cell) >> 3] & (1 << ((cell) & 7)))
+
+/**
+ * @brief     Whether cell touches a route cell other than last, the end it
+ * is about to join
+ */
+static int route_touches(const maze_t* maze, const uint8_t* seen, uint32_t cell, uint32_t last){
+  int x = cell % maze->width;
+  int y = cell / maze->width;
+  int dir;
+
+  for(dir = 0; dir < 4; dir++){
+    int nx = x + step[dir][0];
+    int ny = y + step[dir][1];
+    if(nx < 0 || ny < 0 || nx >= maze->width || ny >= maze->height) continue;
+    uint32_t next = cell_at(maze, nx, ny);
+    if(next != last && ON_ROUTE(seen, next)) return 1;
+  }
+  return 0;
+}
+
+/**
+ * @brief     Finds a path from the maze's start to its goal and marks it
+ * The start and goal join the abstract graph through searches of their
+ * clusters, A* runs over the abstract graph, and each hop of the route
+ * that stays in a cluster is refined into cells by a search of that
+ * cluster alone, loops between hops cut out. The cost of the cells marked
+ * is left in cost. The nodes and cells searched are passed to count, if
+ * not NULL, as they are searched; setting stop ends the search. Returns 1
+ * if the goal was reached, 0 if not (or if stop was set), -1 after
+ * printing the reason on error.
+ */
+int hpa_solve(maze_t* maze, const hpa_index_t* index, const volatile int* stop,
+              unsigned long long* cost, void (*count)(unsigned long cells)){
+  const hpa_header_t* header = index->header;
+  uint32_t nodes = header->nodes;
+  uint32_t start_node = nodes, goal_node = nodes + 1;
+  uint32_t start_cell = cell_at(maze, maze->startX, maze->startY);
+  uint32_t goal_cell = cell_at(maze, maze->goalX, maze->goalY);
+  uint32_t start_cluster, goal_cluster;
+  local_search_t from_start, to_goal, refine;
+  unsigned long long* best = NULL;
+  uint32_t* parent = NULL;
+  uint32_t* route = NULL;
+  uint8_t* closed = NULL;
+  uint8_t* seen = NULL;
+  uint32_t* cells = NULL;
+  size_t cell_count = 0, cells_capacity = 0;
+  open_list_t open;
+  grid_t grid;
+  int found = 0, failed = 0;
+  uint32_t i;
+
+  grid_init(&grid, maze, (int) header->cluster);
+  start_cluster = cluster_of(&grid, start_cell);
+  goal_cluster = cluster_of(&grid, goal_cell);
+  memset(&open, 0, sizeof(open));
+  *cost = 0;
+
+  /// Join the start and goal to their clusters' nodes
+  failed |= local_init(&from_start, grid.cluster);
+  failed |= local_init(&to_goal, grid.cluster);
+  failed |= local_init(&refine, grid.cluster);
+  if(!failed)
+    failed |= local_search(&from_start, &grid, maze->startX, maze->startY, 0, -1, -1);
+  if(!failed)
+    failed |= local_search(&to_goal, &grid, maze->goalX, maze->goalY, 1, -1, -1);
+  if(count != NULL) count(from_start.settled + to_goal.settled);
+
+  // Nodes far from the route are never written, so their pages are never touched
+  best = calloc((size_t) nodes + 2, sizeof(unsigned long long));
+  parent = calloc((size_t) nodes + 2, sizeof(uint32_t));
+  closed = calloc((size_t) nodes + 2, sizeof(uint8_t));
+  if(failed || best == NULL || parent == NULL || closed == NULL) goto out_of_memory;
+
+#define NODE_CELL(node) ((node) == start_node ? start_cell \
+                         : (node) == goal_node ? goal_cell : index->node_cell[node])
+#define GOAL_DISTANCE(node) ((unsigned long long) \
+                             abs((int) (NODE_CELL(node) % maze->width) - maze->goalX) \
+                             + abs((int) (NODE_CELL(node) / maze->width) - maze->goalY))
+#define RELAX(node, step) do { \
+    uint32_t next_ = (node); \
+    unsigned long long reached_ = reached + (step); \
+    if(!closed[next_] && (best[next_] == 0 || reached_ + 1 < best[next_])){ \
+      best[next_] = reached_ + 1; \
+      parent[next_] = at; \
+      if(open_push(&open, reached_ + GOAL_DISTANCE(next_), next_) != 0) goto out_of_memory; \
+    } \
+  } while(0)
+
+  /// A* over the abstract graph, best holds the cost plus one (0 is unseen)
+  best[start_node] = 1;
+  if(open_push(&open, GOAL_DISTANCE(start_node), start_node) != 0) goto out_of_memory;
+  while(open.count > 0 && !*stop){
+    uint32_t at = open_pop(&open);
+    if(closed[at]) continue;
+    closed[at] = 1;
+    if(count != NULL) count(1);
+    if(at == goal_node){
+      found = 1;
+      break;
+    }
+
+    unsigned long long reached = best[at] - 1;
+    if(at == start_node){
+      for(i = index->cluster_first[start_cluster]; i < index->cluster_first[start_cluster + 1]; i++){
+        uint32_t step_cost = local_cost(&from_start, maze, index->node_cell[i]);
+        if(step_cost != UINT32_MAX) RELAX(i, step_cost);
+      }
+      if(start_cluster == goal_cluster && local_cost(&from_start, maze, goal_cell) != UINT32_MAX)
+        RELAX(goal_node, local_cost(&from_start, maze, goal_cell));
+      continue;
+    }
+    uint64_t e;
+    for(e = index->first[at]; e < index->first[at + 1]; e++)
+      RELAX(index->edge[e].to, index->edge[e].cost);
+    if(cluster_of(&grid, index->node_cell[at]) == goal_cluster
+       && local_cost(&to_goal, maze, index->node_cell[at]) != UINT32_MAX)
+      RELAX(goal_node, local_cost(&to_goal, maze, index->node_cell[at]));
+  }
+
+  /// Refine the route into cells, one cluster at a time
+  if(found){
+    size_t length = 0, k;
+    uint32_t at;
+    for(at = goal_node; at != start_node; at = parent[at])
+      length++;
+    route = malloc((length + 1) * sizeof(uint32_t));
+    if(route == NULL) goto out_of_memory;
+    k = length;
+    for(at = goal_node; ; at = parent[at]){
+      route[k] = NODE_CELL(at);
+      if(at == start_node) break;
+      k--;
+    }
+
+    /// Cells of the whole route in order. Hops refined on their own can
+    /// double back or run alongside each other near an entrance, so the
+    /// loops they leave are cut out as the cells are added
+    seen = calloc(((size_t) maze->width * maze->height + 7) / 8, 1);
+    if(seen == NULL || grow((void**) &cells, &cells_capacity, 0, sizeof(uint32_t)) != 0)
+      goto out_of_memory;
+    cells[cell_count++] = start_cell;
+    seen[start_cell >> 3] |= 1 << (start_cell & 7);
+    for(k = 1; k <= length; k++){
+      uint32_t from = route[k - 1], to = route[k];
+      size_t hop = cell_count;
+      // Hops between clusters are a single step across the border
+      if(cluster_of(&grid, from) == cluster_of(&grid, to)){
+        refine.settled = 0;
+        if(local_search(&refine, &grid, from % maze->width, from / maze->width, 0,
+                        to % maze->width, to / maze->width) != 0)
+          goto out_of_memory;
+        if(count != NULL) count(refine.settled);
+        // A route refined only part of the way is not marked
+        if(*stop){
+          found = 0;
+          goto done;
+        }
+        uint32_t local_from = (from / maze->width - refine.y0) * refine.w + (from % maze->width - refine.x0);
+        uint32_t local = (to / maze->width - refine.y0) * refine.w + (to % maze->width - refine.x0);
+        while((local = refine.from[local]) != local_from){
+          if(grow((void**) &cells, &cells_capacity, cell_count, sizeof(uint32_t)) != 0)
+            goto out_of_memory;
+          cells[cell_count++] = cell_at(maze, refine.x0 + local % refine.w, refine.y0 + local / refine.w);
+        }
+        // The search walks back from to, turn the hop round
+        for(i = 0; i < (cell_count - hop) / 2; i++){
+          uint32_t swap = cells[hop + i];
+          cells[hop + i] = cells[cell_count - 1 - i];
+          cells[cell_count - 1 - i] = swap;
+        }
+      }
+      if(grow((void**) &cells, &cells_capacity, cell_count, sizeof(uint32_t)) != 0)
+        goto out_of_memory;
+      cells[cell_count++] = to;
+
+      /// Keep the route simple: a cell seen before, or one touching a cell
+      /// earlier than the last, cuts the route back to that cell
+      size_t next = hop;
+      for(; hop < cell_count; hop++){
+        uint32_t cell = cells[hop];
+        if(ON_ROUTE(seen, cell)){
+          while(cells[next - 1] != cell){
+            next--;
+            seen[cells[next] >> 3] &= ~(1 << (cells[next] & 7));
+          }
+          continue;
+        }
+        while(next > 1 && route_touches(maze, seen, cell, cells[next - 1])){
+          next--;
+          seen[cells[next] >> 3] &= ~(1 << (cells[next] & 7));
+        }
+        seen[cell >> 3] |= 1 << (cell & 7);
+        cells[next++] = cell;
+      }
+      cell_count = next;
+    }
+
+    /// The cost is that of the cells marked, not of the abstract route
+    *cost = 0;
+    for(k = 1; k < cell_count; k++){
+      maze_component_t type = maze_at(maze, cells[k] % maze->width, cells[k] / maze->width)->type;
+      *cost += CELL_COST(type);
+    }
+    for(k = 1; k < cell_count; k++)
+      mark_path(maze, cells[k]);
+  }
+  goto done;
+
+#undef RELAX
+#undef GOAL_DISTANCE
+#undef NODE_CELL
+
+out_of_memory:
+  perror("Out of memory");
+  found = -1;
+done:
+  local_free(&from_start);
+  local_free(&to_goal);
+  local_free(&refine);
+  free(open.entries);
+  free(best);
+  free(parent);
+  free(closed);
+  free(route);
+  free(seen);
+  free(cells);
+  return found;
+}
+/** @} */
@@ -0,0 +1,99 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      hpa.h
+ * @brief     Hierarchical pathfinding (HPA*) index for large mazes
+ *
+ * The maze is cut into square clusters. Wherever open cells face each
+ * other across a cluster border an entrance is placed, and the cells on
+ * either side become nodes of an abstract graph: one edge crosses the
+ * border, and inside each cluster every pair of nodes is joined by the
+ * cost of the cheapest path between them that stays in the cluster.
+ * Building the index searches every cluster (on all cores); a query then
+ * searches only the abstract graph and refines the clusters on the route
+ * it picks. Routes are optimal up to the detours forced by where the
+ * entrances are placed.
+ *
+ * Unlike tricks that need a perfect maze this works with loops and
+ * terrain costs. An index is tied to the maze's walls and terrain, not to
+ * where its S and G are.
+ */
+
+#ifndef HPA_H
+#define HPA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "maze_types.h"
+#include "maze_io.h"
+
+#define HPA_MAGIC "MZHP"
+#define HPA_VERSION 1
+
+/// Cluster side used unless --cluster says otherwise, and its limits
+#define HPA_CLUSTER 64
+#define HPA_MIN_CLUSTER 4
+#define HPA_MAX_CLUSTER 1024
+
+/// Index file header, followed by the arrays of hpa_index_t in order
+typedef struct hpa_header {
+  char magic[4];
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  uint32_t cluster;
+  uint32_t nodes;
+  uint64_t edges;
+  /// hpa_layout_hash of the maze the index was built for
+  uint64_t layout;
+} hpa_header_t;
+
+/// Abstract graph edge
+typedef struct hpa_edge {
+  uint32_t to;
+  uint32_t cost;
+} hpa_edge_t;
+
+/// A built or loaded index, the arrays point into one block of memory
+typedef struct hpa_index {
+  const hpa_header_t* header;
+  /// Edges of node i are edge[first[i]] .. edge[first[i + 1] - 1]
+  const uint64_t* first;
+  const hpa_edge_t* edge;
+  /// Nodes of cluster c are cluster_first[c] .. cluster_first[c + 1] - 1
+  const uint32_t* cluster_first;
+  /// Cell (y * width + x) of each node, sorted within each cluster
+  const uint32_t* node_cell;
+  /// Where the block came from: a loaded file, or malloc'd by hpa_build
+  maze_text_t file;
+  char* built;
+  size_t length;
+} hpa_index_t;
+
+/// Hash of the maze's walls and terrain, ignoring S, G and solution marks
+uint64_t hpa_layout_hash(const maze_t* maze);
+
+/// Builds the index of a maze with the given cluster side; -1 on error
+int hpa_build(hpa_index_t* index, const maze_t* maze, int cluster);
+
+/// Writes an index to a file ("-" for stdout); -1 on error
+int hpa_save(const hpa_index_t* index, const char* path);
+
+/// Maps an index file into memory; -1 on error
+int hpa_load(hpa_index_t* index, const char* path);
+
+/// Non-zero if the index was built for this maze's layout
+int hpa_matches(const hpa_index_t* index, const maze_t* maze);
+
+/// Finds a path from the maze's start to its goal and marks it; 1 if found.
+/// Nodes and cells searched are passed to count, setting stop ends the search.
+int hpa_solve(maze_t* maze, const hpa_index_t* index, const volatile int* stop,
+              unsigned long long* cost, void (*count)(unsigned long cells));
+
+/// Releases an index
+void hpa_free(hpa_index_t* index);
+
+#endif
+/** @} */
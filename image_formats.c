@@ -0,0 +1,196 @@
+/**
+ * @file      image_formats.c
+ * @brief     Streaming encoders for simple image formats
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "image_formats.h"
+
+/**
+ * @brief     Allocates a row buffer with room for the callback's slack
+ */
+static uint8_t* alloc_row(size_t bytes){
+  return malloc(bytes + IMAGE_ROW_SLACK);
+}
+
+/**
+ * @brief     Binary PPM (P6): a text header followed by raw RGB rows
+ */
+int write_ppm(FILE* out, const image_rows_t* image){
+  size_t bytes = (size_t) image->width * 3;
+  uint8_t* row = alloc_row(bytes);
+  uint32_t y, i;
+  int status = 0;
+
+  if(row == NULL) return -1;
+  fprintf(out, "P6\n%u %u\n255\n", image->width, image->height);
+
+  for(y = 0; status == 0 && y < image->height / image->repeat; y++){
+    image->row(image->ctx, y, row);
+    for(i = 0; i < image->repeat; i++){
+      if(fwrite(row, 1, bytes, out) != bytes){
+        status = -1;
+        break;
+      }
+    }
+  }
+
+  free(row);
+  return status;
+}
+
+/**
+ * @brief     Binary PBM (P4): one bit per pixel, most significant bit
+ * first, set for pixels darker than mid grey (the walls)
+ */
+int write_pbm(FILE* out, const image_rows_t* image){
+  size_t bytes = (image->width + 7) / 8;
+  uint8_t* row = alloc_row((size_t) image->width * 3);
+  uint8_t* bits = malloc(bytes);
+  uint32_t x, y, i;
+  int status = 0;
+
+  if(row == NULL || bits == NULL){
+    free(row);
+    free(bits);
+    return -1;
+  }
+  fprintf(out, "P4\n%u %u\n", image->width, image->height);
+
+  for(y = 0; status == 0 && y < image->height / image->repeat; y++){
+    image->row(image->ctx, y, row);
+    memset(bits, 0, bytes);
+    for(x = 0; x < image->width; x++){
+      const uint8_t* p = row + 3 * (size_t) x;
+      // Integer luma, ITU-R BT.601 weights
+      if(p[0] * 299 + p[1] * 587 + p[2] * 114 < 128000)
+        bits[x >> 3] |= 0x80 >> (x & 7);
+    }
+    for(i = 0; i < image->repeat; i++){
+      if(fwrite(bits, 1, bytes, out) != bytes){
+        status = -1;
+        break;
+      }
+    }
+  }
+
+  free(row);
+  free(bits);
+  return status;
+}
+
+// QOI chunk tags, see https://qoiformat.org/qoi-specification.pdf
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+
+#define QOI_HASH(r, g, b) (((r) * 3 + (g) * 5 + (b) * 7 + 255 * 11) % 64)
+
+static void put_be32(uint8_t* p, uint32_t v){
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+/**
+ * @brief     QOI encoder
+ * The encoder state (previous pixel, running index and current run) simply
+ * carries on from one row to the next, as the format's pixel stream is
+ * continuous. Each row is encoded into a buffer sized for the worst case
+ * (four bytes per pixel) and written with one fwrite.
+ */
+int write_qoi(FILE* out, const image_rows_t* image){
+  size_t bytes = (size_t) image->width * 3;
+  uint8_t* row = alloc_row(bytes);
+  uint8_t* enc = malloc((size_t) image->width * 4 + 8);
+  // Seen pixels as RGBA; unused slots are transparent so never match
+  uint8_t index[64][4];
+  uint8_t header[14];
+  uint8_t pr = 0, pg = 0, pb = 0;
+  uint32_t run = 0;
+  uint32_t x, y, i;
+  int status = 0;
+
+  if(row == NULL || enc == NULL){
+    free(row);
+    free(enc);
+    return -1;
+  }
+
+  memcpy(header, "qoif", 4);
+  put_be32(header + 4, image->width);
+  put_be32(header + 8, image->height);
+  header[12] = 3;  // RGB
+  header[13] = 0;  // sRGB with linear alpha
+  if(fwrite(header, 1, sizeof(header), out) != sizeof(header)) status = -1;
+  memset(index, 0, sizeof(index));
+
+  for(y = 0; status == 0 && y < image->height / image->repeat; y++){
+    image->row(image->ctx, y, row);
+    for(i = 0; status == 0 && i < image->repeat; i++){
+      uint8_t* o = enc;
+      const uint8_t* p = row;
+      for(x = 0; x < image->width; x++, p += 3){
+        uint8_t r = p[0], g = p[1], b = p[2];
+        if(r == pr && g == pg && b == pb){
+          if(++run == 62){
+            *o++ = QOI_OP_RUN | (run - 1);
+            run = 0;
+          }
+          continue;
+        }
+        if(run > 0){
+          *o++ = QOI_OP_RUN | (run - 1);
+          run = 0;
+        }
+
+        int h = QOI_HASH(r, g, b);
+        if(index[h][0] == r && index[h][1] == g && index[h][2] == b && index[h][3] == 255){
+          *o++ = QOI_OP_INDEX | h;
+        }else{
+          index[h][0] = r;
+          index[h][1] = g;
+          index[h][2] = b;
+          index[h][3] = 255;
+
+          int8_t dr = (int8_t) (r - pr);
+          int8_t dg = (int8_t) (g - pg);
+          int8_t db = (int8_t) (b - pb);
+          int8_t dr_dg = (int8_t) (dr - dg);
+          int8_t db_dg = (int8_t) (db - dg);
+          if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1){
+            *o++ = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+          }else if(dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                   db_dg >= -8 && db_dg <= 7){
+            *o++ = QOI_OP_LUMA | (dg + 32);
+            *o++ = (dr_dg + 8) << 4 | (db_dg + 8);
+          }else{
+            *o++ = QOI_OP_RGB;
+            *o++ = r;
+            *o++ = g;
+            *o++ = b;
+          }
+        }
+        pr = r;
+        pg = g;
+        pb = b;
+      }
+      if(fwrite(enc, 1, o - enc, out) != (size_t) (o - enc)) status = -1;
+    }
+  }
+
+  // Flush the last run and write the end marker
+  if(status == 0){
+    static const uint8_t end[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    if(run > 0 && fputc(QOI_OP_RUN | (run - 1), out) == EOF) status = -1;
+    if(fwrite(end, 1, sizeof(end), out) != sizeof(end)) status = -1;
+  }
+
+  free(row);
+  free(enc);
+  return status;
+}
@@ -0,0 +1,38 @@
+/**
+ * @file      image_formats.h
+ * @brief     Streaming encoders for simple image formats
+ *
+ * These trade PNG's compression for encode speed: PPM and PBM are raw
+ * pixels, QOI is a single pass byte oriented encoding. All of them write
+ * the image a row at a time from a row callback, so no image is ever held
+ * in memory.
+ */
+
+#ifndef IMAGE_FORMATS_H
+#define IMAGE_FORMATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/// Bytes past the end of each row buffer that a row callback may write
+#define IMAGE_ROW_SLACK 64
+
+/// Image rows as RGB triples, each produced row is used "repeat" times
+typedef struct image_rows {
+  uint32_t width;
+  uint32_t height;
+  uint32_t repeat;
+  void (*row)(void* ctx, uint32_t y, uint8_t* rgb);
+  void* ctx;
+} image_rows_t;
+
+/// Binary PPM (P6), 8-bit RGB
+int write_ppm(FILE* out, const image_rows_t* image);
+
+/// Binary PBM (P4), one bit per pixel, dark pixels are set
+int write_pbm(FILE* out, const image_rows_t* image);
+
+/// QOI, the "Quite OK Image" format, RGB
+int write_qoi(FILE* out, const image_rows_t* image);
+
+#endif
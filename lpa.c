@@ -0,0 +1,298 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      lpa.c
+ * @brief     Incremental shortest paths (LPA*) for mazes whose walls change
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lpa.h"
+
+/// Step of each dir_t
+static const int step[4][2] = {{0, -1}, {1, 0}, {0, 1}, {-1, 0}};
+
+/**
+ * @brief     Returns the cost of entering (x, y), LPA_INF for a wall
+ */
+static inline uint32_t enter_cost(const maze_t* maze, int x, int y){
+  maze_component_t type = maze_at(maze, x, y)->type;
+  return type == WALL ? LPA_INF : (uint32_t) CELL_COST(type);
+}
+
+/**
+ * @brief     Returns a cell's queue key, LPA A* order with ties to smaller g
+ */
+static inline uint64_t cell_key(const lpa_t* lpa, uint32_t cell){
+  uint32_t best = lpa->g[cell] < lpa->rhs[cell] ? lpa->g[cell] : lpa->rhs[cell];
+  int width = lpa->maze->width;
+  uint64_t h;
+
+  if(best == LPA_INF) return UINT64_MAX;
+  h = (uint64_t) abs((int) (cell % width) - lpa->maze->goalX)
+      + abs((int) (cell / width) - lpa->maze->goalY);
+  return (best + h) << 32 | best;
+}
+
+/// Moves the entry at position i of the heap, recording its slot
+static inline void heap_place(lpa_t* lpa, size_t i, lpa_entry_t entry){
+  lpa->heap[i] = entry;
+  lpa->slot[entry.cell] = (uint32_t) i + 1;
+}
+
+static void heap_up(lpa_t* lpa, size_t i){
+  lpa_entry_t entry = lpa->heap[i];
+  while(i > 0 && lpa->heap[(i - 1) / 2].key > entry.key){
+    heap_place(lpa, i, lpa->heap[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  heap_place(lpa, i, entry);
+}
+
+static void heap_down(lpa_t* lpa, size_t i){
+  lpa_entry_t entry = lpa->heap[i];
+  for(;;){
+    size_t child = 2 * i + 1;
+    if(child >= lpa->count) break;
+    if(child + 1 < lpa->count && lpa->heap[child + 1].key < lpa->heap[child].key)
+      child++;
+    if(lpa->heap[child].key >= entry.key) break;
+    heap_place(lpa, i, lpa->heap[child]);
+    i = child;
+  }
+  heap_place(lpa, i, entry);
+}
+
+/**
+ * @brief     Takes a cell off the queue, if it is queued
+ */
+static void heap_remove(lpa_t* lpa, uint32_t cell){
+  size_t i;
+
+  if(lpa->slot[cell] == 0) return;
+  i = lpa->slot[cell] - 1;
+  lpa->slot[cell] = 0;
+  if(--lpa->count == i) return;
+  // The last entry fills the hole and may need to go either way
+  lpa_entry_t moved = lpa->heap[lpa->count];
+  heap_place(lpa, i, moved);
+  heap_up(lpa, i);
+  heap_down(lpa, lpa->slot[moved.cell] - 1);
+}
+
+/**
+ * @brief     Queues a cell under its current key, or moves it if queued
+ * Returns -1 if out of memory.
+ */
+static int heap_set(lpa_t* lpa, uint32_t cell){
+  lpa_entry_t entry = { cell_key(lpa, cell), cell };
+
+  if(lpa->slot[cell] != 0){
+    size_t i = lpa->slot[cell] - 1;
+    lpa->heap[i] = entry;
+    heap_up(lpa, i);
+    heap_down(lpa, lpa->slot[cell] - 1);
+    return 0;
+  }
+  if(lpa->count == lpa->capacity){
+    size_t capacity = lpa->capacity ? lpa->capacity * 2 : 1024;
+    lpa_entry_t* grown = realloc(lpa->heap, capacity * sizeof(lpa_entry_t));
+    if(grown == NULL) return -1;
+    lpa->heap = grown;
+    lpa->capacity = capacity;
+  }
+  lpa->heap[lpa->count] = entry;
+  lpa->slot[cell] = (uint32_t) ++lpa->count;
+  heap_up(lpa, lpa->count - 1);
+  return 0;
+}
+
+/**
+ * @brief     Recomputes rhs of a cell from its neighbours and requeues it
+ * Returns -1 if out of memory.
+ */
+static int update_cell(lpa_t* lpa, int x, int y){
+  const maze_t* maze = lpa->maze;
+  uint32_t cell = (uint32_t) y * maze->width + x;
+  int dir;
+
+  if(cell != lpa->start){
+    uint32_t cost = enter_cost(maze, x, y);
+    uint32_t best = LPA_INF;
+    for(dir = NORTH; cost != LPA_INF && dir <= WEST; dir++){
+      int from_x = x + step[dir][0];
+      int from_y = y + step[dir][1];
+      // Walls, the sentinel ring included, lead nowhere
+      if(maze_at(maze, from_x, from_y)->type == WALL) continue;
+      uint32_t from = lpa->g[(uint32_t) from_y * maze->width + from_x];
+      if(from != LPA_INF && from + cost < best)
+        best = from + cost;
+    }
+    lpa->rhs[cell] = best;
+  }
+  if(lpa->g[cell] != lpa->rhs[cell])
+    return heap_set(lpa, cell);
+  heap_remove(lpa, cell);
+  return 0;
+}
+
+/**
+ * @brief     Updates the open neighbours of a cell
+ */
+static int update_neighbours(lpa_t* lpa, int x, int y){
+  int dir;
+
+  for(dir = NORTH; dir <= WEST; dir++){
+    int next_x = x + step[dir][0];
+    int next_y = y + step[dir][1];
+    if(maze_at(lpa->maze, next_x, next_y)->type == WALL) continue;
+    if(update_cell(lpa, next_x, next_y) != 0) return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief     Sets up a search from the maze's start to its goal
+ * Nothing is searched yet, lpa_solve does the first search in full.
+ * Returns 0 on success or -1 after printing the reason.
+ */
+int lpa_init(lpa_t* lpa, maze_t* maze){
+  size_t cells = (size_t) maze->width * maze->height;
+
+  memset(lpa, 0, sizeof(lpa_t));
+  // Keys pack a cost and a cost plus the heuristic into 32 bits each
+  if(cells > (LPA_INF >> 1) / MAX_CELL_COST){
+    fprintf(stderr,"Maze too large for incremental solving\n");
+    return -1;
+  }
+  lpa->maze = maze;
+  lpa->start = (uint32_t) maze->startY * maze->width + maze->startX;
+  lpa->goal = (uint32_t) maze->goalY * maze->width + maze->goalX;
+  lpa->g = malloc(cells * sizeof(uint32_t));
+  lpa->rhs = malloc(cells * sizeof(uint32_t));
+  lpa->slot = calloc(cells, sizeof(uint32_t));
+  if(lpa->g == NULL || lpa->rhs == NULL || lpa->slot == NULL){
+    perror("Out of memory");
+    lpa_free(lpa);
+    return -1;
+  }
+  memset(lpa->g, 0xff, cells * sizeof(uint32_t));
+  memset(lpa->rhs, 0xff, cells * sizeof(uint32_t));
+  lpa->rhs[lpa->start] = 0;
+  if(heap_set(lpa, lpa->start) != 0){
+    perror("Out of memory");
+    lpa_free(lpa);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief     Makes (x, y) a wall or open space, ready for the next lpa_solve
+ * Terrain made into a wall comes back as blank. The start and goal cannot
+ * be walled in. Returns 0 on success (also when nothing changed), -1 if
+ * the cell is outside the maze or is the start or goal, or if out of memory.
+ */
+int lpa_set_wall(lpa_t* lpa, int x, int y, int wall){
+  maze_t* maze = lpa->maze;
+  maze_cell_t* cell;
+
+  if(x < 0 || y < 0 || x >= maze->width || y >= maze->height) return -1;
+  cell = maze_at(maze, x, y);
+  if(cell->type == START || cell->type == GOAL) return -1;
+  if((cell->type == WALL) == (wall != 0)) return 0;
+  cell->type = wall ? WALL : BLANK;
+
+  /// The cell's own rhs changes, and so do those of the cells it leads to
+  if(update_cell(lpa, x, y) != 0 || update_neighbours(lpa, x, y) != 0) return -1;
+  return 0;
+}
+
+/**
+ * @brief     Brings the search up to date with the edits so far
+ * Runs until the goal is consistent and nothing queued could still lower
+ * it. Returns 1 if the goal is reachable, 0 if not, -1 if out of memory.
+ */
+int lpa_solve(lpa_t* lpa, unsigned long long* cost, unsigned long* expanded){
+  int width = lpa->maze->width;
+  uint32_t goal = lpa->goal;
+
+  *expanded = 0;
+  while(lpa->count > 0
+        && (lpa->heap[0].key < cell_key(lpa, goal) || lpa->rhs[goal] != lpa->g[goal])){
+    uint32_t cell = lpa->heap[0].cell;
+    int x = cell % width;
+    int y = cell / width;
+
+    heap_remove(lpa, cell);
+    (*expanded)++;
+    if(lpa->g[cell] > lpa->rhs[cell]){
+      // Overconsistent: the cell got closer, settle it and pass it on
+      lpa->g[cell] = lpa->rhs[cell];
+      if(update_neighbours(lpa, x, y) != 0) return -1;
+    }else{
+      // Underconsistent: the cell got further, start it over
+      lpa->g[cell] = LPA_INF;
+      if(update_cell(lpa, x, y) != 0 || update_neighbours(lpa, x, y) != 0) return -1;
+    }
+  }
+  *cost = lpa->g[goal] == LPA_INF ? 0 : lpa->g[goal];
+  return lpa->g[goal] != LPA_INF;
+}
+
+/**
+ * @brief     Fills route with the current shortest path
+ * Walks back from the goal to the neighbour the goal's cost came from,
+ * then reverses the moves. Returns 1 if there is a path, 0 if not, -1 if
+ * out of memory.
+ */
+int lpa_route(const lpa_t* lpa, maze_route_t* route){
+  const maze_t* maze = lpa->maze;
+  int x = maze->goalX;
+  int y = maze->goalY;
+  size_t i;
+
+  route->x = maze->startX;
+  route->y = maze->startY;
+  route->length = 0;
+  if(lpa->g[lpa->goal] == LPA_INF) return 0;
+
+  while(x != maze->startX || y != maze->startY){
+    uint32_t here = lpa->g[(uint32_t) y * maze->width + x] - enter_cost(maze, x, y);
+    int dir;
+    for(dir = NORTH; dir <= WEST; dir++){
+      int from_x = x + step[dir][0];
+      int from_y = y + step[dir][1];
+      if(maze_at(maze, from_x, from_y)->type != WALL
+         && lpa->g[(uint32_t) from_y * maze->width + from_x] == here)
+        break;
+    }
+    // An up to date search always has one
+    if(dir > WEST) return 0;
+    // The step forward is the opposite direction
+    if(route_push(route, (dir_t) ((dir + 2) % 4), 1) != 0) return -1;
+    x += step[dir][0];
+    y += step[dir][1];
+  }
+  for(i = 0; i < route->length / 2; i++){
+    uint8_t swap = route->moves[i];
+    route->moves[i] = route->moves[route->length - 1 - i];
+    route->moves[route->length - 1 - i] = swap;
+  }
+  return 1;
+}
+
+/**
+ * @brief     Releases the search state
+ */
+void lpa_free(lpa_t* lpa){
+  free(lpa->g);
+  free(lpa->rhs);
+  free(lpa->slot);
+  free(lpa->heap);
+  memset(lpa, 0, sizeof(lpa_t));
+}
+/** @} */
@@ -0,0 +1,71 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      lpa.h
+ * @brief     Incremental shortest paths (LPA*) for mazes whose walls change
+ *
+ * Lifelong Planning A* keeps two estimates of every cell's distance from
+ * the start: g, what the last search settled on, and rhs, what the cell's
+ * neighbours' g values say it should be. A cell whose two differ is
+ * inconsistent and waits in a priority queue, ordered like A* on
+ * [min(g, rhs) + h, min(g, rhs)]. Adding or removing a wall only
+ * recomputes rhs around that cell, so the next search expands just the
+ * cells whose distance really changed (plus what A* needs to prove the
+ * goal's is right), instead of solving the maze again.
+ *
+ * Costs are the terrain costs of the weighted solvers. The start and goal
+ * are fixed for the life of the search.
+ */
+
+#ifndef LPA_H
+#define LPA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "maze_types.h"
+#include "maze_route.h"
+
+#define LPA_INF UINT32_MAX
+
+/// Queued cell, key is min(g, rhs) + h in the high half, min(g, rhs) low
+typedef struct lpa_entry {
+  uint64_t key;
+  uint32_t cell;
+} lpa_entry_t;
+
+/// Search state kept between edits, cells are numbered y * width + x
+typedef struct lpa {
+  maze_t* maze;
+  uint32_t start;
+  uint32_t goal;
+  uint32_t* g;
+  uint32_t* rhs;
+  /// Heap position plus one of each queued cell, 0 when not queued
+  uint32_t* slot;
+  lpa_entry_t* heap;
+  size_t count;
+  size_t capacity;
+} lpa_t;
+
+/// Sets up a search from the maze's start to its goal; -1 on error
+int lpa_init(lpa_t* lpa, maze_t* maze);
+
+/// Makes (x, y) a wall or, if wall is 0, open space; -1 if it cannot change
+int lpa_set_wall(lpa_t* lpa, int x, int y, int wall);
+
+/// Brings the search up to date with the edits so far; 1 if the goal is
+/// reachable, 0 if not, -1 if out of memory. expanded counts the cells taken
+/// off the queue.
+int lpa_solve(lpa_t* lpa, unsigned long long* cost, unsigned long* expanded);
+
+/// Fills route with the current shortest path; 1 if there is one, 0 if not,
+/// -1 if out of memory
+int lpa_route(const lpa_t* lpa, maze_route_t* route);
+
+/// Releases the search state
+void lpa_free(lpa_t* lpa);
+
+#endif
+/** @} */
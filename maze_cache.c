@@ -0,0 +1,181 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      maze_cache.c
+ * @brief     Parsed maze cache for the solve daemon
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "maze_io.h"
+#include "maze_cache.h"
+
+/**
+ * @brief     Unlinks an entry from the recency list
+ */
+static void unlink_entry(maze_cache_t* cache, maze_cache_entry_t* entry){
+  if(entry->prev) entry->prev->next = entry->next;
+  else cache->head = entry->next;
+  if(entry->next) entry->next->prev = entry->prev;
+  else cache->tail = entry->prev;
+  entry->prev = entry->next = NULL;
+}
+
+/**
+ * @brief     Makes an entry the most recently used
+ */
+static void touch_entry(maze_cache_t* cache, maze_cache_entry_t* entry){
+  if(cache->head == entry) return;
+  if(entry->prev || entry->next || cache->tail == entry)
+    unlink_entry(cache, entry);
+  entry->next = cache->head;
+  if(cache->head) cache->head->prev = entry;
+  cache->head = entry;
+  if(cache->tail == NULL) cache->tail = entry;
+}
+
+/**
+ * @brief     Drops an entry and frees its maze
+ */
+static void evict_entry(maze_cache_t* cache, maze_cache_entry_t* entry){
+  unlink_entry(cache, entry);
+  cache->entries--;
+  cache->bytes -= entry->bytes;
+  maze_free(&entry->maze);
+  hpa_free(&entry->index);
+  free(entry->path);
+  free(entry);
+}
+
+/**
+ * @brief     Starts an empty cache holding at most cap bytes of parsed mazes
+ */
+void maze_cache_init(maze_cache_t* cache, size_t cap){
+  memset(cache, 0, sizeof(maze_cache_t));
+  cache->cap = cap;
+}
+
+/**
+ * @brief     Returns the cached maze with the given content hash, or NULL
+ */
+maze_cache_entry_t* maze_cache_by_hash(maze_cache_t* cache, uint64_t hash){
+  maze_cache_entry_t* entry;
+  for(entry = cache->head; entry != NULL; entry = entry->next){
+    if(entry->hash == hash){
+      touch_entry(cache, entry);
+      cache->hits++;
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief     Returns the cached maze for a file, loading it on a miss
+ * A hit needs the same file name and an unchanged file. On a miss the
+ * file is parsed, and if its content is already cached under another name
+ * that entry is reused. Least recently used mazes are evicted to stay
+ * under the cap, but the maze just loaded is always kept. Returns NULL
+ * after printing the reason if the file cannot be loaded.
+ */
+maze_cache_entry_t* maze_cache_by_path(maze_cache_t* cache, const char* path, int* hit){
+  maze_cache_entry_t* entry;
+  maze_text_t text;
+  struct stat st;
+  uint64_t hash;
+
+  *hit = 0;
+  if(stat(path, &st) != 0){
+    perror("Error: maze data file failed to open");
+    return NULL;
+  }
+  for(entry = cache->head; entry != NULL; entry = entry->next){
+    if(strcmp(entry->path, path) == 0 && entry->dev == st.st_dev && entry->ino == st.st_ino
+       && entry->size == st.st_size && entry->mtime.tv_sec == st.st_mtim.tv_sec
+       && entry->mtime.tv_nsec == st.st_mtim.tv_nsec){
+      touch_entry(cache, entry);
+      cache->hits++;
+      *hit = 1;
+      return entry;
+    }
+  }
+
+  if(maze_text_open(&text, path) != 0){
+    perror("Error: maze data file failed to open");
+    return NULL;
+  }
+  hash = maze_hash(text.data, text.length);
+  entry = maze_cache_by_hash(cache, hash);
+  if(entry != NULL){
+    *hit = 1;
+  }else{
+    cache->misses++;
+    entry = calloc(1, sizeof(maze_cache_entry_t));
+    if(entry == NULL || maze_parse(&entry->maze, text.data, text.length, 0) != 0){
+      if(entry != NULL) maze_free(&entry->maze);
+      free(entry);
+      maze_text_close(&text);
+      return NULL;
+    }
+    entry->hash = hash;
+    entry->bytes = sizeof(maze_cache_entry_t)
+                   + entry->maze.grid_cells * sizeof(maze_cell_t)
+                   + ((size_t) entry->maze.height + 2 * MAZE_BORDER) * sizeof(maze_cell_t*);
+    touch_entry(cache, entry);
+    cache->entries++;
+    cache->bytes += entry->bytes;
+  }
+  maze_text_close(&text);
+
+  // Remember where the maze came from for the next lookup by name
+  free(entry->path);
+  entry->path = strdup(path);
+  entry->dev = st.st_dev;
+  entry->ino = st.st_ino;
+  entry->size = st.st_size;
+  entry->mtime = st.st_mtim;
+
+  while(cache->bytes > cache->cap && cache->tail != entry)
+    evict_entry(cache, cache->tail);
+  return entry;
+}
+
+/**
+ * @brief     Returns the entry's HPA* index, building it on first use
+ * An index built with another cluster side is replaced. The index's size
+ * is added to the entry's, and least recently used mazes are evicted to
+ * stay under the cap, but never this one. Returns NULL after printing
+ * the reason if the index cannot be built.
+ */
+const hpa_index_t* maze_cache_index(maze_cache_t* cache, maze_cache_entry_t* entry, int cluster){
+  if(entry->index.header != NULL && entry->index.header->cluster == (uint32_t) cluster)
+    return &entry->index;
+  if(entry->index.header != NULL){
+    entry->bytes -= entry->index.length;
+    cache->bytes -= entry->index.length;
+    hpa_free(&entry->index);
+  }
+  if(hpa_build(&entry->index, &entry->maze, cluster) != 0){
+    hpa_free(&entry->index);
+    return NULL;
+  }
+  entry->bytes += entry->index.length;
+  cache->bytes += entry->index.length;
+
+  while(cache->bytes > cache->cap && cache->tail != entry)
+    evict_entry(cache, cache->tail);
+  return &entry->index;
+}
+
+/**
+ * @brief     Frees every cached maze
+ */
+void maze_cache_clear(maze_cache_t* cache){
+  while(cache->tail != NULL)
+    evict_entry(cache, cache->tail);
+}
+/** @} */
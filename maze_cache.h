@@ -0,0 +1,73 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      maze_cache.h
+ * @brief     Parsed maze cache for the solve daemon
+ *
+ * Parsed mazes are kept in least recently used order under a memory cap.
+ * Each is found by the content hash of its text, or by file name as long
+ * as the file's device, inode, size and modification time still match, so
+ * an unchanged file is neither re-read nor re-hashed. An HPA* index built
+ * for a maze is kept with it, and counts against the cap along with it.
+ */
+
+#ifndef MAZE_CACHE_H
+#define MAZE_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "maze_types.h"
+#include "hpa.h"
+
+/// One cached maze
+typedef struct maze_cache_entry {
+  /// maze_hash of the maze text
+  uint64_t hash;
+  /// File the maze was last loaded from, and its identity at the time
+  char* path;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  /// The parsed maze, never modified once cached
+  maze_t maze;
+  /// HPA* index of the maze, built on first use (header is NULL until then)
+  hpa_index_t index;
+  /// Memory held by the entry, maze and index together
+  size_t bytes;
+  struct maze_cache_entry* prev;
+  struct maze_cache_entry* next;
+} maze_cache_entry_t;
+
+/// The cache, entries run from most to least recently used
+typedef struct maze_cache {
+  maze_cache_entry_t* head;
+  maze_cache_entry_t* tail;
+  size_t entries;
+  size_t bytes;
+  size_t cap;
+  unsigned long hits;
+  unsigned long misses;
+} maze_cache_t;
+
+/// Starts an empty cache holding at most cap bytes of parsed mazes
+void maze_cache_init(maze_cache_t* cache, size_t cap);
+
+/// Returns the cached maze for a file, loading it on a miss; NULL on error
+maze_cache_entry_t* maze_cache_by_path(maze_cache_t* cache, const char* path, int* hit);
+
+/// Returns the cached maze with the given content hash, or NULL
+maze_cache_entry_t* maze_cache_by_hash(maze_cache_t* cache, uint64_t hash);
+
+/// Returns the entry's HPA* index for the given cluster side, building it on
+/// first use; NULL on error
+const hpa_index_t* maze_cache_index(maze_cache_t* cache, maze_cache_entry_t* entry, int cluster);
+
+/// Frees every cached maze
+void maze_cache_clear(maze_cache_t* cache);
+
+#endif
+/** @} */
@@ -0,0 +1,869 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      maze_io.c
+ * @brief     Buffered maze file input/output shared by the maze programs
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "maze_io.h"
+
+/**
+ * @brief     Returns non-zero if the file name refers to stdin/stdout
+ */
+int maze_is_stdio(const char* path){
+  return path != NULL && strcmp(path, "-") == 0;
+}
+
+/**
+ * @brief     Reads all of a stream into a growing heap buffer
+ */
+static char* read_stream(FILE* in, size_t* length){
+  size_t capacity = MAZE_IO_BUFFER;
+  size_t used = 0;
+  char* data = malloc(capacity);
+
+  while(data != NULL){
+    used += fread(data + used, 1, capacity - used - 1, in);
+    if(used < capacity - 1) break;
+
+    // Buffer filled, grow and keep reading
+    char* grown = realloc(data, capacity * 2);
+    if(grown == NULL){
+      free(data);
+      return NULL;
+    }
+    data = grown;
+    capacity *= 2;
+  }
+
+  if(data == NULL || ferror(in)){
+    free(data);
+    return NULL;
+  }
+  data[used] = '\0';
+  *length = used;
+  return data;
+}
+
+/**
+ * @brief     Returns the compression a file name's extension asks for
+ */
+maze_compression_t maze_compression(const char* path){
+  const char* dot = path != NULL ? strrchr(path, '.') : NULL;
+  if(dot != NULL && strcmp(dot, ".gz") == 0) return MAZE_GZIP;
+  if(dot != NULL && strcmp(dot, ".zst") == 0) return MAZE_ZSTD;
+  return MAZE_PLAIN;
+}
+
+/**
+ * @brief     Returns the compression of data, going by its magic number
+ */
+static maze_compression_t sniff_compression(const char* data, size_t length){
+  const unsigned char* magic = (const unsigned char*) data;
+  if(length >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) return MAZE_GZIP;
+  if(length >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+    return MAZE_ZSTD;
+  return MAZE_PLAIN;
+}
+
+/**
+ * @brief     Doubles a heap buffer, freeing it if that fails
+ */
+static char* grow_buffer(char* data, size_t* capacity){
+  char* grown = realloc(data, *capacity * 2);
+  if(grown == NULL){
+    free(data);
+    return NULL;
+  }
+  *capacity *= 2;
+  return grown;
+}
+
+/**
+ * @brief     Inflates gzip data (any number of members) into a heap buffer
+ */
+static char* gunzip_text(const char* data, size_t length, size_t* out_length){
+  z_stream zs;
+  size_t capacity = 0;
+  char* out;
+  int status = Z_OK;
+
+  // The gzip trailer holds the uncompressed size mod 2^32, a good first guess
+  if(length >= 18){
+    const unsigned char* tail = (const unsigned char*) data + length - 4;
+    capacity = (size_t) tail[0] | (size_t) tail[1] << 8 | (size_t) tail[2] << 16 | (size_t) tail[3] << 24;
+  }
+  if(capacity < length * 4) capacity = length * 4;
+  capacity += 1;
+  out = malloc(capacity);
+  memset(&zs, 0, sizeof(zs));
+  if(out == NULL || inflateInit2(&zs, 15 + 16) != Z_OK){
+    free(out);
+    return NULL;
+  }
+
+  zs.next_in = (unsigned char*) data;
+  zs.avail_in = 0;
+  size_t consumed = 0;
+  while(1){
+    // avail_in and avail_out are 32 bit, feed large inputs in pieces
+    if(zs.avail_in == 0 && consumed < length){
+      zs.avail_in = length - consumed > (1u << 30) ? (1u << 30) : (uInt) (length - consumed);
+      consumed += zs.avail_in;
+    }
+    if(zs.total_out + 1 >= capacity){
+      out = grow_buffer(out, &capacity);
+      if(out == NULL){
+        inflateEnd(&zs);
+        return NULL;
+      }
+    }
+    size_t room = capacity - 1 - zs.total_out;
+    zs.next_out = (unsigned char*) out + zs.total_out;
+    zs.avail_out = room > (1u << 30) ? (1u << 30) : (uInt) room;
+
+    // zs.total_out is a uLong, which is 64 bit on the platforms we build for
+    status = inflate(&zs, Z_NO_FLUSH);
+    if(status == Z_STREAM_END){
+      // Concatenated members, as written by pigz or cat a.gz b.gz
+      if(zs.avail_in == 0 && consumed == length) break;
+      uLong total = zs.total_out;
+      inflateReset(&zs);
+      zs.total_out = total;
+      continue;
+    }
+    if(status != Z_OK && status != Z_BUF_ERROR) break;
+    if(status == Z_BUF_ERROR && zs.avail_in == 0 && consumed == length) break;
+  }
+  inflateEnd(&zs);
+
+  if(status != Z_STREAM_END){
+    fprintf(stderr, "Corrupt or truncated gzip data\n");
+    free(out);
+    errno = EINVAL;
+    return NULL;
+  }
+  out[zs.total_out] = '\0';
+  *out_length = zs.total_out;
+  return out;
+}
+
+/**
+ * @brief     Decompresses zstd data into a heap buffer
+ */
+static char* unzstd_text(const char* data, size_t length, size_t* out_length){
+#ifdef HAVE_ZSTD
+  unsigned long long size = ZSTD_getFrameContentSize(data, length);
+  size_t capacity = size != ZSTD_CONTENTSIZE_UNKNOWN && size != ZSTD_CONTENTSIZE_ERROR
+                    ? (size_t) size + 1 : length * 4 + 1;
+  char* out = malloc(capacity);
+  ZSTD_DStream* zs = ZSTD_createDStream();
+  ZSTD_inBuffer in = { data, length, 0 };
+  ZSTD_outBuffer dst = { out, capacity - 1, 0 };
+  size_t status = 1;
+
+  if(out == NULL || zs == NULL){
+    free(out);
+    ZSTD_freeDStream(zs);
+    return NULL;
+  }
+  while(in.pos < in.size || status != 0){
+    if(dst.pos == dst.size){
+      out = grow_buffer(out, &capacity);
+      if(out == NULL){
+        ZSTD_freeDStream(zs);
+        return NULL;
+      }
+      dst.dst = out;
+      dst.size = capacity - 1;
+    }
+    size_t before = in.pos + dst.pos;
+    status = ZSTD_decompressStream(zs, &dst, &in);
+    if(ZSTD_isError(status) || (in.pos + dst.pos == before && dst.pos < dst.size)){
+      fprintf(stderr, "Corrupt or truncated zstd data\n");
+      free(out);
+      ZSTD_freeDStream(zs);
+      errno = EINVAL;
+      return NULL;
+    }
+  }
+  ZSTD_freeDStream(zs);
+  out[dst.pos] = '\0';
+  *out_length = dst.pos;
+  return out;
+#else
+  (void) data;
+  (void) length;
+  (void) out_length;
+  fprintf(stderr, "zstd input needs a build with HAVE_ZSTD (libzstd)\n");
+  errno = ENOTSUP;
+  return NULL;
+#endif
+}
+
+/**
+ * @brief     Replaces gzip or zstd compressed text with its decompressed form
+ * Returns 0 if the text was not compressed or was decompressed, -1 on error.
+ */
+static int decompress_text(maze_text_t* text){
+  maze_compression_t kind = sniff_compression(text->data, text->length);
+  size_t length = 0;
+  char* plain;
+
+  if(kind == MAZE_PLAIN) return 0;
+  plain = kind == MAZE_GZIP ? gunzip_text(text->data, text->length, &length)
+                            : unzstd_text(text->data, text->length, &length);
+  maze_text_close(text);
+  if(plain == NULL) return -1;
+  text->data = plain;
+  text->length = length;
+  text->mapped = 0;
+  return 0;
+}
+
+/**
+ * @brief     Makes the maze text available in memory
+ * Regular files are memory mapped read-only, so only the pages that are
+ * actually touched are read and they can be dropped again under memory
+ * pressure. Stdin ("-") and other unmappable inputs are read in large
+ * chunks into a heap buffer. Returns 0 on success, -1 on failure.
+ */
+int maze_text_open(maze_text_t* text, const char* path){
+  struct stat st;
+
+  text->data = NULL;
+  text->length = 0;
+  text->mapped = 0;
+
+  if(maze_is_stdio(path)){
+    text->data = read_stream(stdin, &text->length);
+    return text->data == NULL ? -1 : decompress_text(text);
+  }
+
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) return -1;
+
+  if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map != MAP_FAILED){
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      close(fd);
+      text->data = map;
+      text->length = st.st_size;
+      text->mapped = 1;
+      return decompress_text(text);
+    }
+  }
+
+  FILE* in = fdopen(fd, "rb");
+  if(in == NULL){
+    close(fd);
+    return -1;
+  }
+  text->data = read_stream(in, &text->length);
+  fclose(in);
+  return text->data == NULL ? -1 : decompress_text(text);
+}
+
+/**
+ * @brief     Releases maze text opened with maze_text_open
+ */
+void maze_text_close(maze_text_t* text){
+  if(text->mapped)
+    munmap(text->data, text->length);
+  else
+    free(text->data);
+  text->data = NULL;
+  text->length = 0;
+}
+
+/// Compressing output stream behind the FILE* from maze_open_output
+typedef struct compressed_output {
+  maze_compression_t kind;
+  FILE* file;
+  gzFile gz;
+#ifdef HAVE_ZSTD
+  ZSTD_CStream* zs;
+  char* buffer;
+  size_t buffer_size;
+#endif
+} compressed_output_t;
+
+#ifdef HAVE_ZSTD
+/**
+ * @brief     Feeds input to the zstd stream, or finishes it when ending
+ */
+static int zstd_output(compressed_output_t* out, const char* data, size_t size, int ending){
+  ZSTD_inBuffer in = { data, size, 0 };
+  size_t pending;
+
+  do{
+    ZSTD_outBuffer dst = { out->buffer, out->buffer_size, 0 };
+    pending = ZSTD_compressStream2(out->zs, &dst, &in, ending ? ZSTD_e_end : ZSTD_e_continue);
+    if(ZSTD_isError(pending) || fwrite(out->buffer, 1, dst.pos, out->file) != dst.pos)
+      return -1;
+  }while(in.pos < in.size || (ending && pending != 0));
+  return 0;
+}
+#endif
+
+/**
+ * @brief     fopencookie write hook, compresses a block of output
+ */
+static ssize_t compressed_write(void* cookie, const char* data, size_t size){
+  compressed_output_t* out = cookie;
+#ifdef HAVE_ZSTD
+  if(out->kind == MAZE_ZSTD)
+    return zstd_output(out, data, size, 0) == 0 ? (ssize_t) size : -1;
+#endif
+  // gzwrite takes an unsigned count, the stdio buffer keeps writes small
+  return gzwrite(out->gz, data, (unsigned) size) == (int) size ? (ssize_t) size : -1;
+}
+
+/**
+ * @brief     fopencookie close hook, finishes the compressed stream
+ */
+static int compressed_close(void* cookie){
+  compressed_output_t* out = cookie;
+  int status = 0;
+#ifdef HAVE_ZSTD
+  if(out->kind == MAZE_ZSTD){
+    status = zstd_output(out, NULL, 0, 1);
+    ZSTD_freeCStream(out->zs);
+    free(out->buffer);
+    if(fclose(out->file) != 0) status = -1;
+    free(out);
+    return status;
+  }
+#endif
+  if(gzclose(out->gz) != Z_OK) status = -1;
+  if(fclose(out->file) != 0) status = -1;
+  free(out);
+  return status;
+}
+
+/**
+ * @brief     Wraps a newly opened file in a compressing stream
+ */
+static FILE* open_compressed(FILE* file, maze_compression_t kind){
+  cookie_io_functions_t hooks = { NULL, compressed_write, NULL, compressed_close };
+  compressed_output_t* out = calloc(1, sizeof(compressed_output_t));
+  FILE* stream;
+
+  if(out == NULL){
+    fclose(file);
+    return NULL;
+  }
+  out->kind = kind;
+  out->file = file;
+  if(kind == MAZE_GZIP){
+    // Level 6 is zlib's default; text mazes compress about 10x at any level
+    out->gz = gzdopen(dup(fileno(file)), "wb6");
+    if(out->gz == NULL){
+      fclose(file);
+      free(out);
+      return NULL;
+    }
+    gzbuffer(out->gz, MAZE_IO_BUFFER);
+  }else{
+#ifdef HAVE_ZSTD
+    out->zs = ZSTD_createCStream();
+    out->buffer_size = ZSTD_CStreamOutSize();
+    out->buffer = malloc(out->buffer_size);
+    if(out->zs == NULL || out->buffer == NULL){
+      ZSTD_freeCStream(out->zs);
+      free(out->buffer);
+      fclose(file);
+      free(out);
+      return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, MAZE_IO_BUFFER);
+#else
+    fprintf(stderr, "zstd output needs a build with HAVE_ZSTD (libzstd)\n");
+    fclose(file);
+    free(out);
+    errno = ENOTSUP;
+    return NULL;
+#endif
+  }
+
+  stream = fopencookie(out, "wb", hooks);
+  if(stream == NULL){
+    compressed_close(out);
+    return NULL;
+  }
+  return stream;
+}
+
+/**
+ * @brief     Opens a file (or stdout for "-") for writing with a large buffer
+ * File names ending in .gz or .zst are compressed as they are written.
+ */
+FILE* maze_open_output(const char* path){
+  FILE* out = maze_is_stdio(path) ? stdout : fopen(path, "wb");
+  if(out != NULL && out != stdout && maze_compression(path) != MAZE_PLAIN)
+    out = open_compressed(out, maze_compression(path));
+  if(out != NULL) setvbuf(out, NULL, _IOFBF, MAZE_IO_BUFFER);
+  return out;
+}
+
+/**
+ * @brief     Flushes and closes a stream returned by maze_open_output
+ */
+int maze_close_output(FILE* out){
+  if(out == stdout) return fflush(out);
+  return fclose(out);
+}
+
+/// Errors a chunk of maze text can hold, in the order they are reported
+enum { SCAN_OK, SCAN_BAD_DIMENSIONS, SCAN_BAD_CHARACTER };
+
+/// One newline aligned chunk of maze text and what scanning it found
+typedef struct scan_chunk {
+  const char* text;
+  size_t begin;
+  size_t end;
+  int width;
+  int allow_marks;
+  /// Complete rows, and the cells after the last newline in the chunk
+  int rows;
+  int tail;
+  /// Last start and goal in the chunk, rows relative to the chunk
+  int has_start, startX, startY;
+  int has_goal, goalX, goalY;
+  int starts, goals;
+  /// First error in the chunk
+  int error;
+} scan_chunk_t;
+
+/**
+ * @brief     Scans one chunk of maze text, stopping at its first error
+ */
+static void* scan_chunk(void* arg){
+  scan_chunk_t* chunk = arg;
+  const char* text = chunk->text;
+  size_t pos;
+  int i = 0;
+  int j = 0;
+
+  for(pos = chunk->begin; pos < chunk->end; pos++){
+    switch(text[pos]){
+      case VISIT: case WRONG: case PATH:
+        if(!chunk->allow_marks){
+          chunk->error = SCAN_BAD_CHARACTER;
+          return NULL;
+        }
+        j++;
+        break;
+      case START:
+        chunk->has_start = 1;
+        chunk->starts++;
+        chunk->startX = j;
+        chunk->startY = i;
+        j++;
+        break;
+      case GOAL:
+        chunk->has_goal = 1;
+        chunk->goals++;
+        chunk->goalX = j;
+        chunk->goalY = i;
+        j++;
+        break;
+      case WALL: case BLANK:
+        j++;
+        break;
+      case '\n':
+        if(j != chunk->width){
+          chunk->error = SCAN_BAD_DIMENSIONS;
+          return NULL;
+        }
+        i++;
+        j = 0;
+        break;
+      default:
+        if(IS_TERRAIN(text[pos])){
+          j++;
+          break;
+        }
+        chunk->error = SCAN_BAD_CHARACTER;
+        return NULL;
+    }
+  }
+  chunk->rows = i;
+  chunk->tail = j;
+  return NULL;
+}
+
+/**
+ * @brief     Number of threads to spread "work" bytes of maze text over
+ */
+static int maze_io_threads(size_t work){
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t threads = work / MAZE_PARSE_CHUNK + 1;
+  if(cores < 1) cores = 1;
+  if(threads > (size_t) cores) threads = cores;
+  if(threads > MAZE_PARSE_THREADS) threads = MAZE_PARSE_THREADS;
+  return (int) threads;
+}
+
+/**
+ * @brief     Runs fn on each of count args, on threads when there are several
+ */
+static void run_parallel(void* (*fn)(void*), void* args, size_t arg_size, int count){
+  pthread_t threads[MAZE_PARSE_THREADS];
+  int started[MAZE_PARSE_THREADS];
+  int k;
+
+  for(k = 1; k < count; k++)
+    started[k] = pthread_create(&threads[k], NULL, fn, (char*) args + k * arg_size) == 0;
+  fn(args);
+  for(k = 1; k < count; k++){
+    if(started[k])
+      pthread_join(threads[k], NULL);
+    else
+      fn((char*) args + k * arg_size);
+  }
+}
+
+/**
+ * @brief     Validates maze text without building the cells
+ * Every row must be the same width and end in a newline. Only walls, open
+ * space, terrain, start and goal are accepted unless allow_marks is set, in which
+ * case the solution marks (visit, wrong, path) are accepted as well.
+ * Sets the maze dimensions, start and goal (the last of each when there
+ * are several) and counts the starts and goals. Returns 0 on success or -1
+ * after printing the reason.
+ *
+ * Large files are cut into chunks on newline boundaries and scanned on all
+ * cores. The width is the length of the first row, so every chunk can check
+ * its rows on its own; the chunks are merged in file order so the error
+ * reported, start and goal are the same as for a single pass.
+ */
+int maze_scan(maze_t* maze, const char* text, size_t length, int allow_marks){
+  scan_chunk_t chunks[MAZE_PARSE_THREADS];
+  const char* newline = memchr(text, '\n', length);
+  int count = maze_io_threads(length);
+  int width = newline != NULL ? (int) (newline - text) : (int) length;
+  int rows = 0;
+  int tail = 0;
+  size_t begin = 0;
+  int k;
+
+  for(k = 0; k < count; k++){
+    size_t end = length;
+    if(k + 1 < count){
+      // Start the next chunk just past a newline
+      const char* cut = memchr(text + length / count * (k + 1), '\n',
+                               length - length / count * (k + 1));
+      end = cut != NULL ? (size_t) (cut - text) + 1 : length;
+      if(end < begin) end = begin;
+    }
+    memset(&chunks[k], 0, sizeof(scan_chunk_t));
+    chunks[k].text = text;
+    chunks[k].begin = begin;
+    chunks[k].end = end;
+    chunks[k].width = width;
+    chunks[k].allow_marks = allow_marks;
+    begin = end;
+  }
+  run_parallel(scan_chunk, chunks, sizeof(scan_chunk_t), count);
+
+  /// Merge the chunks in file order
+  maze->startCount = maze->goalCount = 0;
+  for(k = 0; k < count; k++){
+    if(chunks[k].error == SCAN_BAD_DIMENSIONS){
+      perror("Invalid maze dimensions");
+      return -1;
+    }
+    if(chunks[k].error == SCAN_BAD_CHARACTER){
+      perror("Invalid character in maze");
+      return -1;
+    }
+    if(chunks[k].has_start){
+      maze->startX = chunks[k].startX;
+      maze->startY = rows + chunks[k].startY;
+    }
+    if(chunks[k].has_goal){
+      maze->goalX = chunks[k].goalX;
+      maze->goalY = rows + chunks[k].goalY;
+    }
+    maze->startCount += chunks[k].starts;
+    maze->goalCount += chunks[k].goals;
+    rows += chunks[k].rows;
+    // Only the chunk holding the end of the text can end mid row
+    tail += chunks[k].tail;
+  }
+
+  // Accept a final row that is missing its newline
+  maze->width = width;
+  if(tail > 0){
+    if(tail != width){
+      perror("Invalid maze dimensions");
+      return -1;
+    }
+    rows++;
+  }
+  maze->height = rows;
+
+  return 0;
+}
+
+/**
+ * @brief     Validates one window of maze text without reading the rest
+ * The width comes from the first row and the height from the text length,
+ * since every row is the same width; only rows y .. y+h-1 and columns
+ * x .. x+w-1 are read and checked. The maze dimensions are the full maze's,
+ * the start and goal counts the window's.
+ * Returns 0 on success or -1 after printing the reason.
+ */
+int maze_scan_window(maze_t* maze, const char* text, size_t length, int allow_marks,
+                     int x, int y, int w, int h){
+  const char* newline = memchr(text, '\n', length);
+  size_t stride;
+  int i, j;
+
+  maze->width = newline != NULL ? (int) (newline - text) : (int) length;
+  stride = (size_t) maze->width + 1;
+  // The last row may be missing its newline
+  maze->height = (int) ((length + 1) / stride);
+  if(maze->width == 0 || (size_t) maze->height * stride - length > 1){
+    perror("Invalid maze dimensions");
+    return -1;
+  }
+  if(x < 0 || y < 0 || w < 1 || h < 1 || x + w > maze->width || y + h > maze->height){
+    perror("Window outside the maze");
+    return -1;
+  }
+
+  maze->startCount = maze->goalCount = 0;
+  for(i = y; i < y + h; i++){
+    const char* row = text + (size_t) i * stride;
+    if(i + 1 < maze->height && row[maze->width] != '\n'){
+      perror("Invalid maze dimensions");
+      return -1;
+    }
+    for(j = x; j < x + w; j++){
+      switch(row[j]){
+        case VISIT: case WRONG: case PATH:
+          if(!allow_marks){
+            perror("Invalid character in maze");
+            return -1;
+          }
+          break;
+        case START:
+          maze->startX = j;
+          maze->startY = i;
+          maze->startCount++;
+          break;
+        case GOAL:
+          maze->goalX = j;
+          maze->goalY = i;
+          maze->goalCount++;
+          break;
+        case WALL: case BLANK:
+          break;
+        default:
+          if(IS_TERRAIN(row[j]))
+            break;
+          perror("Invalid character in maze");
+          return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/// Sentinel ring cell
+static const maze_cell_t wall_cell = { WALL, UNDISCOVERED, { -1, -1 } };
+
+/**
+ * @brief     Allocates the cells of a width x height maze in one block
+ * The cells are surrounded by a ring of WALL cells MAZE_BORDER wide, so
+ * the solvers can look at any neighbour without a bounds check; the maze
+ * cells themselves are left for the caller to fill. In the default
+ * row-major layout cells[y][x] reaches the ring as well. Returns 0 on
+ * success or -1 if out of memory.
+ */
+int maze_alloc(maze_t* maze, int width, int height){
+  size_t padded_width = (size_t) width + 2 * MAZE_BORDER;
+  size_t padded_height = (size_t) height + 2 * MAZE_BORDER;
+  size_t i;
+
+  maze->width = width;
+  maze->height = height;
+  maze->cells = NULL;
+#ifdef MAZE_TILED
+  size_t tile_rows = (padded_height + MAZE_TILE - 1) >> MAZE_TILE_BITS;
+  maze->stride = (int) ((padded_width + MAZE_TILE - 1) >> MAZE_TILE_BITS);
+  maze->grid_cells = (size_t) maze->stride * tile_rows << (2 * MAZE_TILE_BITS);
+  maze->grid = (maze_cell_t*) malloc(maze->grid_cells * sizeof(maze_cell_t));
+  if(maze->grid == NULL) return -1;
+  // Tiles overhang the maze, so simply make every cell a wall first
+  for(i = 0; i < maze->grid_cells; i++)
+    maze->grid[i] = wall_cell;
+#else
+  maze_cell_t** rows = (maze_cell_t**) malloc(padded_height * sizeof(maze_cell_t*));
+  int x, y;
+  maze->stride = (int) padded_width;
+  maze->grid_cells = padded_width * padded_height;
+  maze->grid = (maze_cell_t*) malloc(maze->grid_cells * sizeof(maze_cell_t));
+  if(maze->grid == NULL || rows == NULL){
+    free(maze->grid);
+    free(rows);
+    maze->grid = NULL;
+    return -1;
+  }
+  for(i = 0; i < padded_height; i++)
+    rows[i] = maze->grid + i * padded_width + MAZE_BORDER;
+  maze->cells = rows + MAZE_BORDER;
+
+  // Only the ring is set here, the maze cells are written by the caller
+  for(y = -MAZE_BORDER; y < height + MAZE_BORDER; y++){
+    int inside = y >= 0 && y < height;
+    for(x = -MAZE_BORDER; x < width + MAZE_BORDER; x++){
+      if(inside && x == 0) x = width;
+      maze->cells[y][x] = wall_cell;
+    }
+  }
+#endif
+  return 0;
+}
+
+/// A band of rows for maze_parse to build
+typedef struct parse_band {
+  maze_t* maze;
+  const char* text;
+  int begin;
+  int end;
+} parse_band_t;
+
+/**
+ * @brief     Builds the cells of one band of rows
+ */
+static void* parse_band(void* arg){
+  parse_band_t* band = arg;
+  maze_t* maze = band->maze;
+  int i, j;
+
+  for(i = band->begin; i < band->end; i++){
+    const char* row = band->text + (size_t) i * (maze->width + 1);
+    for(j = 0; j < maze->width; j++){
+      maze_cell_t* cell = maze_at(maze, j, i);
+      cell->type = (maze_component_t) row[j];
+      cell->state = UNDISCOVERED;
+      cell->parent[0] = -1;
+      cell->parent[1] = -1;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief     Validates maze text and builds the maze cells
+ * The rows are split into bands that are built on all cores, which also
+ * spreads the grid's first touch (and so its pages) over them.
+ * Returns 0 on success or -1 after printing the reason.
+ */
+int maze_parse(maze_t* maze, const char* text, size_t length, int allow_marks){
+  parse_band_t bands[MAZE_PARSE_THREADS];
+  int count, k;
+
+  if(maze_scan(maze, text, length, allow_marks) != 0)
+    return -1;
+
+  /// Size the maze grid and copy in the maze data
+  if(maze_alloc(maze, maze->width, maze->height) != 0){
+    perror("Out of memory");
+    return -1;
+  }
+
+  // Building a cell writes 16 bytes for every byte of text
+  count = maze_io_threads(length * sizeof(maze_cell_t));
+  for(k = 0; k < count; k++){
+    bands[k].maze = maze;
+    bands[k].text = text;
+    bands[k].begin = (int) ((long long) maze->height * k / count);
+    bands[k].end = (int) ((long long) maze->height * (k + 1) / count);
+  }
+  run_parallel(parse_band, bands, sizeof(parse_band_t), count);
+  return 0;
+}
+
+/**
+ * @brief     Fast 64-bit hash of maze text, eight bytes per step
+ * Not cryptographic; it keys caches of mazes we generated ourselves.
+ */
+uint64_t maze_hash(const char* text, size_t length){
+  const uint64_t prime = 0x9e3779b97f4a7c15ULL;
+  uint64_t hash = 0x243f6a8885a308d3ULL ^ (length * prime);
+  size_t i;
+
+  for(i = 0; i + 8 <= length; i += 8){
+    uint64_t word;
+    memcpy(&word, text + i, 8);
+    hash = (hash ^ word) * prime;
+    hash ^= hash >> 29;
+  }
+  for(; i < length; i++)
+    hash = (hash ^ (unsigned char) text[i]) * 0x100000001b3ULL;
+
+  // Final avalanche so every input bit reaches every output bit
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+/**
+ * @brief     Frees the cells built by maze_alloc or maze_parse
+ */
+void maze_free(maze_t* maze){
+  if(maze->grid == NULL) return;
+  if(maze->cells != NULL)
+    free(maze->cells - MAZE_BORDER);
+  free(maze->grid);
+  maze->cells = NULL;
+  maze->grid = NULL;
+}
+
+/**
+ * @brief     Writes the maze cells as text, one buffered row at a time
+ */
+int maze_write(FILE* out, const maze_t* maze){
+  char* row = malloc(maze->width + 1);
+  int i, j;
+
+  if(row == NULL) return -1;
+  row[maze->width] = '\n';
+
+  for(i = 0; i < maze->height; i++){
+    for(j = 0; j < maze->width; j++){
+      row[j] = (char) maze_at(maze, j, i)->type;
+    }
+    if(fwrite(row, 1, maze->width + 1, out) != (size_t) maze->width + 1){
+      free(row);
+      return -1;
+    }
+  }
+
+  free(row);
+  return 0;
+}
+/** @} */
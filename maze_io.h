@@ -0,0 +1,92 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      maze_io.h
+ * @brief     Buffered maze file input/output shared by the maze programs
+ *
+ * A file name of "-" means stdin when reading and stdout when writing, so
+ * the programs can be chained: ./generate 101 101 -o - | ./solve - | ./render -
+ *
+ * gzip and zstd compressed input is recognised by its magic number and
+ * decompressed while loading; output file names ending in .gz or .zst are
+ * compressed as they are written. zstd needs a build with HAVE_ZSTD.
+ */
+
+#ifndef MAZE_IO_H
+#define MAZE_IO_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "maze_types.h"
+
+/// Size of the stdio buffers used for maze and image output
+#define MAZE_IO_BUFFER (1 << 20)
+
+/// Bytes of maze text per thread when parsing, smaller files use fewer threads
+#define MAZE_PARSE_CHUNK (4 << 20)
+
+/// Most threads a parse is split over
+#define MAZE_PARSE_THREADS 64
+
+/// Compression of a maze file
+typedef enum {
+  MAZE_PLAIN,
+  MAZE_GZIP,
+  MAZE_ZSTD
+} maze_compression_t;
+
+/// Raw maze text, memory mapped for files or read into memory for stdin
+typedef struct maze_text {
+  char* data;
+  size_t length;
+  int mapped;
+} maze_text_t;
+
+/// Returns a pointer to row y of maze text whose rows are width cells wide
+#define MAZE_ROW(text, width, y) ((text)->data + (size_t) (y) * ((width) + 1))
+
+/// Returns non-zero if the file name refers to stdin/stdout
+int maze_is_stdio(const char* path);
+
+/// Returns the compression a file name's .gz or .zst extension asks for
+maze_compression_t maze_compression(const char* path);
+
+/// Maps a maze file (or reads stdin for "-") into memory
+int maze_text_open(maze_text_t* text, const char* path);
+
+/// Releases maze text opened with maze_text_open
+void maze_text_close(maze_text_t* text);
+
+/// Opens a file (or stdout for "-") for writing with a large buffer
+FILE* maze_open_output(const char* path);
+
+/// Flushes and closes a stream returned by maze_open_output
+int maze_close_output(FILE* out);
+
+/// Validates maze text and fills in the maze dimensions, start and goal
+int maze_scan(maze_t* maze, const char* text, size_t length, int allow_marks);
+
+/// Validates only a w x h window at (x,y) of maze text with fixed-width rows
+int maze_scan_window(maze_t* maze, const char* text, size_t length, int allow_marks,
+                     int x, int y, int w, int h);
+
+/// Allocates the cells of a maze, in one block inside a ring of WALL cells
+int maze_alloc(maze_t* maze, int width, int height);
+
+/// Validates maze text and fills in the maze dimensions, cells, start and goal
+int maze_parse(maze_t* maze, const char* text, size_t length, int allow_marks);
+
+/// Fast 64-bit (non-cryptographic) hash of maze text
+uint64_t maze_hash(const char* text, size_t length);
+
+/// Frees the cells built by maze_alloc or maze_parse
+void maze_free(maze_t* maze);
+
+/// Writes the maze cells as text, one buffered row at a time
+int maze_write(FILE* out, const maze_t* maze);
+
+#endif
+/** @} */
@@ -0,0 +1,178 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      maze_route.c
+ * @brief     Compact path output, written by solve --moves and drawn by render --path
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "maze_io.h"
+#include "maze_route.h"
+
+/// Step and letter of each dir_t
+static const int step[4][2] = {{0, -1}, {1, 0}, {0, 1}, {-1, 0}};
+static const char letters[] = "NESW";
+
+/**
+ * @brief     Appends count steps in one direction, returns -1 if out of memory
+ */
+int route_push(maze_route_t* route, dir_t dir, size_t count){
+  if(count > SIZE_MAX - route->length) return -1;
+  if(route->length + count > route->capacity){
+    size_t capacity = route->capacity ? route->capacity : 4096;
+    while(capacity < route->length + count)
+      capacity = capacity > SIZE_MAX / 2 ? route->length + count : capacity * 2;
+    uint8_t* grown = realloc(route->moves, capacity);
+    if(grown == NULL) return -1;
+    route->moves = grown;
+    route->capacity = capacity;
+  }
+  memset(route->moves + route->length, dir, count);
+  route->length += count;
+  return 0;
+}
+
+/**
+ * @brief     Follows the PATH cells of a solved maze from its start to a goal
+ * The walk is a depth first search using the route itself as its stack, so
+ * paths that touch (as --nearest leaves them) are still followed to a goal.
+ * Cells are marked VISIT as they are walked, which is what keeps the
+ * search from going round a loop. Returns 1 if a goal was reached, 0 if
+ * not, -1 if out of memory.
+ */
+int route_trace(maze_route_t* route, maze_t* maze){
+  int x = maze->startX;
+  int y = maze->startY;
+  int dir;
+
+  route->x = x;
+  route->y = y;
+  route->length = 0;
+  for(;;){
+    // No bounds checks, the sentinel ring around the maze is all wall
+    for(dir = NORTH; dir <= WEST; dir++){
+      if(maze_at(maze, x + step[dir][0], y + step[dir][1])->type == GOAL)
+        return route_push(route, dir, 1) == 0 ? 1 : -1;
+    }
+    for(dir = NORTH; dir <= WEST; dir++){
+      maze_cell_t* next = maze_at(maze, x + step[dir][0], y + step[dir][1]);
+      if(next->type == PATH){
+        next->type = VISIT;
+        break;
+      }
+    }
+    if(dir <= WEST){
+      if(route_push(route, dir, 1) != 0) return -1;
+      x += step[dir][0];
+      y += step[dir][1];
+      continue;
+    }
+    // Dead end, step back
+    if(route->length == 0) return 0;
+    dir = route->moves[--route->length];
+    x -= step[dir][0];
+    y -= step[dir][1];
+  }
+}
+
+/**
+ * @brief     Writes a route in the run-length format
+ * Returns 0 on success or -1 on a write error.
+ */
+int route_write(FILE* out, const maze_route_t* route){
+  size_t i = 0;
+
+  fprintf(out, "%d,%d\n", route->x, route->y);
+  while(i < route->length){
+    size_t run = 1;
+    while(i + run < route->length && route->moves[i + run] == route->moves[i])
+      run++;
+    if(run > 1)
+      fprintf(out, "%zu", run);
+    fputc(letters[route->moves[i]], out);
+    i += run;
+  }
+  fputc('\n', out);
+  return ferror(out) ? -1 : 0;
+}
+
+/**
+ * @brief     Reads a route file, "-" reads stdin
+ * A route longer than limit moves (no simple path through a maze of limit
+ * cells is) is rejected before anything is allocated for it. Returns 0 on
+ * success or -1 after printing the reason.
+ */
+int route_read(maze_route_t* route, const char* path, size_t limit){
+  maze_text_t text;
+  char first[64];
+  size_t i, count = 0;
+  int has_count = 0;
+
+  memset(route, 0, sizeof(maze_route_t));
+  if(maze_text_open(&text, path) != 0){
+    perror("Error: path file failed to open");
+    return -1;
+  }
+
+  /// Start cell
+  for(i = 0; i < text.length && i + 1 < sizeof(first) && text.data[i] != '\n'; i++)
+    first[i] = text.data[i];
+  first[i] = '\0';
+  if(sscanf(first, "%d,%d", &route->x, &route->y) != 2){
+    fprintf(stderr,"Path file does not start with the start cell (x,y)\n");
+    maze_text_close(&text);
+    return -1;
+  }
+
+  /// Moves
+  for(; i < text.length; i++){
+    char c = text.data[i];
+    const char* letter = c != '\0' ? strchr(letters, c) : NULL;
+    if(c >= '0' && c <= '9'){
+      count = count * 10 + (size_t) (c - '0');
+      has_count = 1;
+      if(count > limit){
+        fprintf(stderr,"Path file has more moves than the maze has cells\n");
+        maze_text_close(&text);
+        route_free(route);
+        return -1;
+      }
+    }else if(letter != NULL){
+      if(route->length + (has_count ? count : 1) > limit){
+        fprintf(stderr,"Path file has more moves than the maze has cells\n");
+        maze_text_close(&text);
+        route_free(route);
+        return -1;
+      }
+      if(route_push(route, (dir_t) (letter - letters), has_count ? count : 1) != 0){
+        perror("Out of memory");
+        maze_text_close(&text);
+        route_free(route);
+        return -1;
+      }
+      count = 0;
+      has_count = 0;
+    }else if(c != ' ' && c != '\n' && c != '\r' && c != '\t'){
+      fprintf(stderr,"Invalid move '%c' in path file\n", c);
+      maze_text_close(&text);
+      route_free(route);
+      return -1;
+    }
+  }
+  maze_text_close(&text);
+  return 0;
+}
+
+/**
+ * @brief     Releases a route's moves
+ */
+void route_free(maze_route_t* route){
+  free(route->moves);
+  route->moves = NULL;
+  route->length = route->capacity = 0;
+}
+/** @} */
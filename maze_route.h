@@ -0,0 +1,58 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      maze_route.h
+ * @brief     Compact path output, written by solve --moves and drawn by render --path
+ *
+ * A route file holds the start cell as "x,y" on its first line, then the
+ * moves from there to the goal as the letters N, E, S and W, each with an
+ * optional repeat count in front: "3E2SW" is three steps east, two south
+ * and one west. Whitespace between moves is ignored. A path of millions of
+ * cells takes a few MB this way, where the solved grid takes width x
+ * height bytes.
+ */
+
+#ifndef MAZE_ROUTE_H
+#define MAZE_ROUTE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "maze_types.h"
+
+/// A start cell and the dir_t of every step from it
+typedef struct maze_route {
+  int x;
+  int y;
+  uint8_t* moves;
+  size_t length;
+  size_t capacity;
+} maze_route_t;
+
+/// Moves (x, y) one step in direction dir
+static inline void route_move(int dir, int* x, int* y){
+  *x += dir == EAST ? 1 : dir == WEST ? -1 : 0;
+  *y += dir == SOUTH ? 1 : dir == NORTH ? -1 : 0;
+}
+
+/// Appends count steps in one direction; -1 if out of memory
+int route_push(maze_route_t* route, dir_t dir, size_t count);
+
+/// Follows the PATH cells of a solved maze from its start to a goal; 1 if
+/// one was reached, 0 if not, -1 if out of memory. Walked cells become VISIT.
+int route_trace(maze_route_t* route, maze_t* maze);
+
+/// Writes a route in the run-length format; -1 on error
+int route_write(FILE* out, const maze_route_t* route);
+
+/// Reads a route file ("-" for stdin) of at most limit moves; -1 after
+/// printing the reason on error
+int route_read(maze_route_t* route, const char* path, size_t limit);
+
+/// Releases a route's moves
+void route_free(maze_route_t* route);
+
+#endif
+/** @} */
@@ -0,0 +1,341 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      maze_trace.c
+ * @brief     Solver exploration trace, recorded by solve and drawn by render
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "maze_io.h"
+#include "maze_trace.h"
+
+/// Events per ring, a power of two
+#define TRACE_RING_EVENTS 4096
+
+/// How long the drain thread sleeps when every ring is empty
+#define TRACE_DRAIN_NS 200000
+
+/// Ring states, a retired ring is drained then handed to the next thread
+enum { RING_ACTIVE, RING_RETIRED, RING_FREE };
+
+/// Single producer, single consumer ring of events owned by one thread
+typedef struct trace_ring {
+  trace_event_t events[TRACE_RING_EVENTS];
+  /// Written only by the owning thread
+  uint64_t head;
+  /// Written only by the drain thread
+  uint64_t tail;
+  int state;
+  struct trace_ring* next_free;
+} trace_ring_t;
+
+int trace_enabled = 0;
+
+static FILE* trace_file;
+static uint32_t trace_width;
+static struct timespec trace_epoch;
+static int trace_failed;
+static volatile int trace_stopping;
+static pthread_t trace_drainer;
+static pthread_key_t trace_key;
+static uint16_t trace_next_thread;
+
+// Every ring ever handed out (never freed before trace_stop) and the free list
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_ring_t** trace_rings;
+static size_t trace_ring_count;
+static size_t trace_ring_capacity;
+static trace_ring_t* trace_free;
+
+static __thread trace_ring_t* my_ring;
+static __thread uint16_t my_thread;
+static __thread uint64_t my_last_time;
+
+/**
+ * @brief     Nanoseconds since the trace started
+ */
+static uint64_t trace_now(void){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) (now.tv_sec - trace_epoch.tv_sec) * 1000000000u
+         + (uint64_t) (now.tv_nsec - trace_epoch.tv_nsec);
+}
+
+/**
+ * @brief     Thread exit hook, hands the thread's ring back to the drainer
+ */
+static void retire_ring(void* ring){
+  __atomic_store_n(&((trace_ring_t*) ring)->state, RING_RETIRED, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief     Gives the calling thread a ring, reusing a drained one if possible
+ */
+static trace_ring_t* acquire_ring(void){
+  trace_ring_t* ring;
+
+  pthread_mutex_lock(&trace_lock);
+  ring = trace_free;
+  if(ring != NULL){
+    trace_free = ring->next_free;
+  }else{
+    ring = calloc(1, sizeof(trace_ring_t));
+    if(ring != NULL && trace_ring_count == trace_ring_capacity){
+      size_t capacity = trace_ring_capacity ? trace_ring_capacity * 2 : 64;
+      trace_ring_t** grown = realloc(trace_rings, capacity * sizeof(trace_ring_t*));
+      if(grown == NULL){
+        free(ring);
+        ring = NULL;
+      }else{
+        trace_rings = grown;
+        trace_ring_capacity = capacity;
+      }
+    }
+    if(ring != NULL)
+      trace_rings[trace_ring_count++] = ring;
+  }
+  if(ring != NULL)
+    __atomic_store_n(&ring->state, RING_ACTIVE, __ATOMIC_RELEASE);
+  my_thread = trace_next_thread++;
+  pthread_mutex_unlock(&trace_lock);
+
+  if(ring != NULL)
+    pthread_setspecific(trace_key, ring);
+  return ring;
+}
+
+/**
+ * @brief     Records one event in the calling thread's ring
+ * Never takes a lock once the thread has its ring; if the drainer has
+ * fallen a whole ring behind the thread yields until there is room.
+ */
+void trace_record(int x, int y, maze_component_t type){
+  trace_ring_t* ring = my_ring;
+  trace_event_t* event;
+  uint64_t now;
+
+  if(ring == NULL){
+    ring = my_ring = acquire_ring();
+    if(ring == NULL){
+      trace_failed = 1;
+      return;
+    }
+  }
+
+  while(ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_EVENTS)
+    sched_yield();
+
+  // Keep each thread's times strictly increasing so sorting keeps its order
+  now = trace_now();
+  if(now <= my_last_time && ring->head > 0)
+    now = my_last_time + 1;
+  my_last_time = now;
+
+  event = &ring->events[ring->head & (TRACE_RING_EVENTS - 1)];
+  event->time = now;
+  event->cell = (uint32_t) y * trace_width + (uint32_t) x;
+  event->thread = my_thread;
+  event->type = (uint8_t) type;
+  event->reserved = 0;
+  __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief     Writes out everything waiting in one ring
+ * Returns the number of events written.
+ */
+static size_t drain_ring(trace_ring_t* ring){
+  // Read the state first, a retired ring's head can no longer move
+  int state = __atomic_load_n(&ring->state, __ATOMIC_ACQUIRE);
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint64_t tail = ring->tail;
+  size_t drained = (size_t) (head - tail);
+
+  while(tail < head){
+    size_t start = tail & (TRACE_RING_EVENTS - 1);
+    size_t run = TRACE_RING_EVENTS - start;
+    if(run > head - tail) run = (size_t) (head - tail);
+    if(fwrite(&ring->events[start], sizeof(trace_event_t), run, trace_file) != run)
+      trace_failed = 1;
+    tail += run;
+  }
+  __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+  if(state == RING_RETIRED){
+    ring->head = ring->tail = 0;
+    pthread_mutex_lock(&trace_lock);
+    ring->state = RING_FREE;
+    ring->next_free = trace_free;
+    trace_free = ring;
+    pthread_mutex_unlock(&trace_lock);
+  }
+  return drained;
+}
+
+/**
+ * @brief     Drains every ring once, returns the number of events written
+ */
+static size_t drain_all(void){
+  size_t count, i, drained = 0;
+  trace_ring_t** rings;
+
+  // Rings never move, so a snapshot of the list can be drained unlocked
+  pthread_mutex_lock(&trace_lock);
+  count = trace_ring_count;
+  rings = malloc((count ? count : 1) * sizeof(trace_ring_t*));
+  if(rings != NULL && count > 0)
+    memcpy(rings, trace_rings, count * sizeof(trace_ring_t*));
+  pthread_mutex_unlock(&trace_lock);
+  if(rings == NULL){
+    trace_failed = 1;
+    return 0;
+  }
+
+  for(i = 0; i < count; i++){
+    if(__atomic_load_n(&rings[i]->state, __ATOMIC_ACQUIRE) != RING_FREE)
+      drained += drain_ring(rings[i]);
+  }
+  free(rings);
+  return drained;
+}
+
+/**
+ * @brief     Drain thread, streams the rings to the file until stopped
+ */
+static void* drain_worker(void* arg){
+  struct timespec pause = { 0, TRACE_DRAIN_NS };
+  (void) arg;
+
+  while(!trace_stopping){
+    if(drain_all() == 0)
+      nanosleep(&pause, NULL);
+  }
+  return NULL;
+}
+
+/**
+ * @brief     Opens the trace file and starts the drain thread
+ * Returns 0 on success or -1 after printing the reason.
+ */
+int trace_start(const char* path, int width, int height){
+  trace_header_t header;
+
+  trace_file = maze_open_output(path);
+  if(trace_file == NULL){
+    perror("Error: trace file failed to open");
+    return -1;
+  }
+
+  memcpy(header.magic, TRACE_MAGIC, 4);
+  header.version = TRACE_VERSION;
+  header.width = (uint32_t) width;
+  header.height = (uint32_t) height;
+  if(fwrite(&header, sizeof(header), 1, trace_file) != 1){
+    perror("Error: failed to write trace");
+    maze_close_output(trace_file);
+    return -1;
+  }
+
+  trace_width = (uint32_t) width;
+  trace_failed = 0;
+  trace_stopping = 0;
+  pthread_key_create(&trace_key, retire_ring);
+  clock_gettime(CLOCK_MONOTONIC, &trace_epoch);
+  if(pthread_create(&trace_drainer, NULL, drain_worker, NULL) != 0){
+    perror("Error: failed to start trace thread");
+    maze_close_output(trace_file);
+    return -1;
+  }
+  trace_enabled = 1;
+  return 0;
+}
+
+/**
+ * @brief     Stops the drain thread and writes out what is left
+ * Must only be called once the solver threads have finished.
+ * Returns 0 on success or -1 after printing the reason.
+ */
+int trace_stop(void){
+  size_t i;
+
+  trace_enabled = 0;
+  trace_stopping = 1;
+  pthread_join(trace_drainer, NULL);
+  drain_all();
+
+  for(i = 0; i < trace_ring_count; i++)
+    free(trace_rings[i]);
+  free(trace_rings);
+  trace_rings = NULL;
+  trace_ring_count = trace_ring_capacity = 0;
+  trace_free = NULL;
+  my_ring = NULL;
+  pthread_setspecific(trace_key, NULL);
+  pthread_key_delete(trace_key);
+
+  if(maze_close_output(trace_file) != 0)
+    trace_failed = 1;
+  if(trace_failed){
+    perror("Error: failed to write trace");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief     qsort comparison putting events in time order
+ */
+static int compare_events(const void* a, const void* b){
+  const trace_event_t* ea = a;
+  const trace_event_t* eb = b;
+  if(ea->time != eb->time) return ea->time < eb->time ? -1 : 1;
+  return 0;
+}
+
+/**
+ * @brief     Reads a trace file and sorts its events by time
+ * Returns 0 on success or -1 after printing the reason.
+ */
+int trace_load(const char* path, trace_header_t* header,
+               trace_event_t** events, size_t* count){
+  maze_text_t text;
+
+  if(maze_text_open(&text, path) != 0){
+    perror("Error: trace file failed to open");
+    return -1;
+  }
+  if(text.length < sizeof(trace_header_t)
+     || memcmp(text.data, TRACE_MAGIC, 4) != 0
+     || (text.length - sizeof(trace_header_t)) % sizeof(trace_event_t) != 0){
+    perror("Invalid trace file");
+    maze_text_close(&text);
+    return -1;
+  }
+  memcpy(header, text.data, sizeof(trace_header_t));
+  if(header->version != TRACE_VERSION){
+    perror("Unsupported trace version");
+    maze_text_close(&text);
+    return -1;
+  }
+
+  *count = (text.length - sizeof(trace_header_t)) / sizeof(trace_event_t);
+  *events = malloc((*count ? *count : 1) * sizeof(trace_event_t));
+  if(*events == NULL){
+    perror("Out of memory");
+    maze_text_close(&text);
+    return -1;
+  }
+  memcpy(*events, text.data + sizeof(trace_header_t), *count * sizeof(trace_event_t));
+  maze_text_close(&text);
+
+  qsort(*events, *count, sizeof(trace_event_t), compare_events);
+  return 0;
+}
+/** @} */
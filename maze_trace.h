@@ -0,0 +1,71 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      maze_trace.h
+ * @brief     Solver exploration trace, recorded by solve and drawn by render
+ *
+ * Every cell type change a solver makes is logged as a timestamped event.
+ * Each solver thread appends to its own single producer ring buffer with no
+ * locks, and a drain thread streams the rings to the trace file while the
+ * solve runs. Events from different threads interleave in the file, so
+ * readers sort them by time (trace_load does this).
+ *
+ * File layout: a trace_header_t followed by trace_event_t records, all in
+ * host byte order.
+ */
+
+#ifndef MAZE_TRACE_H
+#define MAZE_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "maze_types.h"
+
+#define TRACE_MAGIC "MZTR"
+#define TRACE_VERSION 1
+
+/// Trace file header
+typedef struct trace_header {
+  char magic[4];
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+} trace_header_t;
+
+/// One cell type change
+typedef struct trace_event {
+  /// Nanoseconds since trace_start
+  uint64_t time;
+  /// Cell index, y * width + x
+  uint32_t cell;
+  /// Sequential id of the recording thread (wraps at 65536)
+  uint16_t thread;
+  /// The maze_component_t the cell was set to
+  uint8_t type;
+  uint8_t reserved;
+} trace_event_t;
+
+/// Non-zero while a trace is being recorded
+extern int trace_enabled;
+
+/// Records a cell type change if tracing, cheap enough to leave in hot loops
+#define TRACE_CELL(x, y, type) \
+  do { if(trace_enabled) trace_record((x), (y), (type)); } while(0)
+
+/// Starts recording events for a width x height maze to path
+int trace_start(const char* path, int width, int height);
+
+/// Appends an event to the calling thread's ring, use TRACE_CELL instead
+void trace_record(int x, int y, maze_component_t type);
+
+/// Stops recording once every solver thread is done and flushes the file
+int trace_stop(void);
+
+/// Reads a whole trace file, returning its events sorted by time
+int trace_load(const char* path, trace_header_t* header,
+               trace_event_t** events, size_t* count);
+
+#endif
+/** @} */
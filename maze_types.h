@@ -26,6 +26,15 @@ typedef enum {
   PATH = 'o'
 } maze_component_t;
 
+/// Weighted terrain: the digits TERRAIN_MIN to TERRAIN_MAX are open cells
+/// that cost their digit to enter (mud, water, doors); blank, start and
+/// goal cost 1. Solvers that ignore costs treat terrain as blank.
+#define TERRAIN_MIN '1'
+#define TERRAIN_MAX '9'
+#define MAX_CELL_COST (TERRAIN_MAX - '0')
+#define IS_TERRAIN(c) ((c) >= TERRAIN_MIN && (c) <= TERRAIN_MAX)
+#define CELL_COST(c) (IS_TERRAIN(c) ? (c) - '0' : 1)
+
 /// BFS State enumeration
 typedef enum{
   UNDISCOVERED,
@@ -42,15 +51,60 @@ typedef struct maze_cell{
 
 /// The maze struct definition
 typedef struct maze {
+  /// Row pointers into grid; cells[y][x] also reaches the sentinel ring.
+  /// NULL in the tiled layout, where only maze_at works.
   maze_cell_t** cells;
+  /// Every cell, sentinel ring included, in one block of grid_cells cells
+  maze_cell_t* grid;
+  size_t grid_cells;
+  /// Cells per grid row, or tiles per grid row in the tiled layout
+  int stride;
   int width;
   int height;
   int startX;
   int startY;
   int goalX;
   int goalY;
+  /// Number of S and G markers; startX/Y and goalX/Y are the last of each
+  int startCount;
+  int goalCount;
 } maze_t;
 
+/// Width of the ring of WALL cells around every maze, so any neighbour of
+/// a maze cell can be read without a bounds check
+#define MAZE_BORDER 1
+
+#ifdef MAZE_TILED
+/// Tiled layout (make TILED=1): the grid is stored in 16x16 cell tiles of
+/// 4 KB, one page each, with the cells of a tile in Z-order, so vertical
+/// neighbours share a TLB entry and each 2x2 block shares a cache line.
+#define MAZE_TILE_BITS 4
+#define MAZE_TILE (1 << MAZE_TILE_BITS)
+
+/// Interleaves the bits of two coordinates within a tile
+static inline unsigned maze_morton(unsigned x, unsigned y){
+  x = (x | x << 2) & 0x33;
+  x = (x | x << 1) & 0x55;
+  y = (y | y << 2) & 0x33;
+  y = (y | y << 1) & 0x55;
+  return x | y << 1;
+}
+
+/// Returns the cell at (x, y), which may lie in the sentinel ring
+static inline maze_cell_t* maze_at(const maze_t* maze, int x, int y){
+  unsigned px = (unsigned) (x + MAZE_BORDER);
+  unsigned py = (unsigned) (y + MAZE_BORDER);
+  size_t tile = (size_t) (py >> MAZE_TILE_BITS) * maze->stride + (px >> MAZE_TILE_BITS);
+  return maze->grid + (tile << (2 * MAZE_TILE_BITS))
+         + maze_morton(px & (MAZE_TILE - 1), py & (MAZE_TILE - 1));
+}
+#else
+/// Returns the cell at (x, y), which may lie in the sentinel ring
+static inline maze_cell_t* maze_at(const maze_t* maze, int x, int y){
+  return &maze->cells[y][x];
+}
+#endif
+
 /// Directions
 typedef enum {NORTH, EAST, SOUTH, WEST} dir_t;
 
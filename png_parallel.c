@@ -0,0 +1,422 @@
+/**
+ * @file      png_parallel.c
+ * @brief     Multi-threaded PNG encoder
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "png_parallel.h"
+
+/// Raw bytes aimed for in one strip, large enough for deflate to do well
+#define STRIP_BYTES (1 << 20)
+
+/// Deflate's window, the most of the previous strips a strip can refer to
+#define DICT_BYTES 32768
+
+/// Compressed strip waiting to be written out in order
+typedef struct strip {
+  uint8_t* data;
+  size_t capacity;
+  size_t size;
+  uLong adler;
+  uLong raw_size;
+  int done;
+} strip_t;
+
+/// State shared between the writer and the worker threads
+typedef struct encoder {
+  const png_image_spec_t* spec;
+  png_row_fn row_fn;
+  void* ctx;
+  size_t row_bytes;
+  int bpp;
+  uint32_t rows_per_strip;
+  uint32_t num_strips;
+
+  strip_t* slots;
+  uint32_t num_slots;
+  uint32_t next_strip;
+  uint32_t written;
+  int failed;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} encoder_t;
+
+/**
+ * @brief     The Paeth predictor from the PNG specification
+ */
+static uint8_t paeth(int a, int b, int c){
+  int p = a + b - c;
+  int pa = abs(p - a);
+  int pb = abs(p - b);
+  int pc = abs(p - c);
+  if(pa <= pb && pa <= pc) return a;
+  if(pb <= pc) return b;
+  return c;
+}
+
+/**
+ * @brief     Filters one row with the given filter type into out
+ */
+static void filter_row(int type, const uint8_t* cur, const uint8_t* prev,
+                       size_t n, int bpp, uint8_t* out){
+  size_t i;
+  switch(type){
+    case 0:
+      memcpy(out, cur, n);
+      break;
+    case 1:
+      for(i = 0; i < n; i++) out[i] = cur[i] - (i >= (size_t) bpp ? cur[i-bpp] : 0);
+      break;
+    case 2:
+      for(i = 0; i < n; i++) out[i] = cur[i] - prev[i];
+      break;
+    case 3:
+      for(i = 0; i < n; i++)
+        out[i] = cur[i] - ((i >= (size_t) bpp ? cur[i-bpp] : 0) + prev[i]) / 2;
+      break;
+    case 4:
+      for(i = 0; i < n; i++){
+        int a = i >= (size_t) bpp ? cur[i-bpp] : 0;
+        int c = i >= (size_t) bpp ? prev[i-bpp] : 0;
+        out[i] = cur[i] - paeth(a, prev[i], c);
+      }
+      break;
+  }
+}
+
+/**
+ * @brief     Sum of the filtered bytes taken as signed values, the usual
+ * heuristic (also libpng's) for picking a filter per row
+ */
+static unsigned long filter_cost(const uint8_t* out, size_t n){
+  unsigned long sum = 0;
+  size_t i;
+  for(i = 0; i < n; i++) sum += out[i] < 128 ? out[i] : 256 - out[i];
+  return sum;
+}
+
+/**
+ * @brief     Filters row cur against prev with the cheapest filter
+ * The result, filter type byte first, ends up in *filtered; *trial is
+ * scratch space, and the two may be swapped.
+ */
+static void filter_best(const encoder_t* enc, const uint8_t* cur, const uint8_t* prev,
+                        uint8_t** filtered, uint8_t** trial){
+  size_t n = enc->row_bytes;
+  int adaptive = enc->spec->bit_depth >= 8 && enc->spec->color_type != 3;
+  int best = 0;
+
+  filter_row(0, cur, prev, n, enc->bpp, *filtered + 1);
+  if(adaptive){
+    unsigned long best_cost = filter_cost(*filtered + 1, n);
+    int type;
+    for(type = 1; type <= 4; type++){
+      filter_row(type, cur, prev, n, enc->bpp, *trial + 1);
+      unsigned long cost = filter_cost(*trial + 1, n);
+      if(cost < best_cost){
+        uint8_t* swap = *filtered;
+        *filtered = *trial;
+        *trial = swap;
+        best_cost = cost;
+        best = type;
+      }
+    }
+  }
+  (*filtered)[0] = (uint8_t) best;
+}
+
+/**
+ * @brief     Filters and deflates one strip of the image into slot
+ * The first row of a strip is filtered against the last row of the
+ * previous strip, which is simply produced again here. Like pigz, every
+ * strip but the first starts with the last DICT_BYTES the previous strips
+ * fed to deflate as its dictionary, so matches reach back across the
+ * strip boundary; those rows are produced and filtered again too, which
+ * gives the same bytes since filtering only looks at a row and the one
+ * before it.
+ */
+static int compress_strip(encoder_t* enc, uint32_t index, strip_t* slot,
+                          uint8_t* rows[2], uint8_t* filtered, uint8_t* trial,
+                          uint8_t* dict){
+  const png_image_spec_t* spec = enc->spec;
+  uint32_t first = index * enc->rows_per_strip;
+  uint32_t last = first + enc->rows_per_strip;
+  uint32_t y;
+  size_t n = enc->row_bytes;
+  size_t dict_size = 0;
+  int adaptive = spec->bit_depth >= 8 && spec->color_type != 3;
+  uint8_t* prev = rows[0];
+  uint8_t* cur = rows[1];
+  uint8_t* swap;
+  z_stream zs;
+
+  if(last > spec->height) last = spec->height;
+
+  /// Rows just before the strip, for the dictionary and the first filter
+  uint32_t primed = (uint32_t) ((DICT_BYTES + n) / (n + 1));
+  uint32_t from = first > primed ? first - primed : 0;
+  memset(prev, 0, n);
+  if(from > 0) enc->row_fn(enc->ctx, from - 1, prev);
+  for(y = from; y < first; y++){
+    enc->row_fn(enc->ctx, y, cur);
+    filter_best(enc, cur, prev, &filtered, &trial);
+    memcpy(dict + dict_size, filtered, n + 1);
+    dict_size += n + 1;
+    swap = prev;
+    prev = cur;
+    cur = swap;
+  }
+
+  memset(&zs, 0, sizeof(zs));
+  if(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                  adaptive ? Z_FILTERED : Z_DEFAULT_STRATEGY) != Z_OK)
+    return -1;
+  if(dict_size > DICT_BYTES){
+    memmove(dict, dict + dict_size - DICT_BYTES, DICT_BYTES);
+    dict_size = DICT_BYTES;
+  }
+  if(dict_size > 0 && deflateSetDictionary(&zs, dict, (uInt) dict_size) != Z_OK){
+    deflateEnd(&zs);
+    return -1;
+  }
+
+  size_t bound = deflateBound(&zs, (uLong) (n + 1) * (last - first)) + 64;
+  if(slot->capacity < bound){
+    free(slot->data);
+    slot->data = malloc(bound);
+    slot->capacity = slot->data == NULL ? 0 : bound;
+    if(slot->data == NULL){
+      deflateEnd(&zs);
+      return -1;
+    }
+  }
+
+  slot->adler = adler32(0L, Z_NULL, 0);
+  slot->raw_size = 0;
+  zs.next_out = slot->data;
+  zs.avail_out = slot->capacity;
+
+  for(y = first; y < last; y++){
+    enc->row_fn(enc->ctx, y, cur);
+    filter_best(enc, cur, prev, &filtered, &trial);
+    swap = prev;
+    prev = cur;
+    cur = swap;
+
+    slot->adler = adler32(slot->adler, filtered, n + 1);
+    slot->raw_size += n + 1;
+    zs.next_in = filtered;
+    zs.avail_in = n + 1;
+    if(deflate(&zs, Z_NO_FLUSH) != Z_OK || zs.avail_in != 0){
+      deflateEnd(&zs);
+      return -1;
+    }
+  }
+
+  // The last strip closes the stream, the others end byte aligned
+  int flush = last == spec->height ? Z_FINISH : Z_SYNC_FLUSH;
+  int ret = deflate(&zs, flush);
+  slot->size = slot->capacity - zs.avail_out;
+  deflateEnd(&zs);
+
+  return (ret == Z_STREAM_END || (flush == Z_SYNC_FLUSH && ret == Z_OK)) ? 0 : -1;
+}
+
+/**
+ * @brief     Worker thread, compresses strips in order of claim while there
+ * is a free output slot for them
+ */
+static void* strip_worker(void* arg){
+  encoder_t* enc = (encoder_t*) arg;
+  uint8_t* rows[2];
+  uint8_t* filtered = malloc(enc->row_bytes + 1);
+  uint8_t* trial = malloc(enc->row_bytes + 1);
+  uint8_t* dict = malloc(DICT_BYTES + 2 * (enc->row_bytes + 1));
+  rows[0] = malloc(enc->row_bytes + PNG_ROW_SLACK);
+  rows[1] = malloc(enc->row_bytes + PNG_ROW_SLACK);
+
+  if(filtered == NULL || trial == NULL || dict == NULL || rows[0] == NULL || rows[1] == NULL){
+    pthread_mutex_lock(&enc->lock);
+    enc->failed = 1;
+    pthread_cond_broadcast(&enc->cond);
+    pthread_mutex_unlock(&enc->lock);
+  }
+
+  for(;;){
+    pthread_mutex_lock(&enc->lock);
+    while(!enc->failed && enc->next_strip < enc->num_strips &&
+          enc->next_strip >= enc->written + enc->num_slots)
+      pthread_cond_wait(&enc->cond, &enc->lock);
+    if(enc->failed || enc->next_strip >= enc->num_strips){
+      pthread_mutex_unlock(&enc->lock);
+      break;
+    }
+    uint32_t index = enc->next_strip++;
+    strip_t* slot = &enc->slots[index % enc->num_slots];
+    pthread_mutex_unlock(&enc->lock);
+
+    int status = compress_strip(enc, index, slot, rows, filtered, trial, dict);
+
+    pthread_mutex_lock(&enc->lock);
+    if(status != 0) enc->failed = 1;
+    slot->done = 1;
+    pthread_cond_broadcast(&enc->cond);
+    pthread_mutex_unlock(&enc->lock);
+  }
+
+  free(rows[0]);
+  free(rows[1]);
+  free(filtered);
+  free(trial);
+  free(dict);
+  return NULL;
+}
+
+static void put_u32(uint8_t* p, uint32_t v){
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+/**
+ * @brief     Writes a PNG chunk whose data is the concatenation of up to three
+ * pieces, so the zlib header and trailer need not be copied into a strip
+ */
+static int write_chunk(FILE* out, const char* type,
+                       const uint8_t* a, size_t na, const uint8_t* b, size_t nb,
+                       const uint8_t* c, size_t nc){
+  uint8_t len[4], crc_bytes[4];
+  uLong crc = crc32(0L, (const Bytef*) type, 4);
+  // crc32() with a NULL buffer returns the initial value, skip empty pieces
+  if(na) crc = crc32(crc, a, na);
+  if(nb) crc = crc32(crc, b, nb);
+  if(nc) crc = crc32(crc, c, nc);
+  put_u32(len, (uint32_t) (na + nb + nc));
+  put_u32(crc_bytes, (uint32_t) crc);
+
+  if(fwrite(len, 1, 4, out) != 4 || fwrite(type, 1, 4, out) != 4) return -1;
+  if(na && fwrite(a, 1, na, out) != na) return -1;
+  if(nb && fwrite(b, 1, nb, out) != nb) return -1;
+  if(nc && fwrite(c, 1, nc, out) != nc) return -1;
+  if(fwrite(crc_bytes, 1, 4, out) != 4) return -1;
+  return 0;
+}
+
+/**
+ * @brief     Encodes the image produced by row_fn to out
+ * Rows are produced on demand by the workers, and at most two strips per
+ * thread are held in memory at any time. Returns 0 on success.
+ */
+int png_write_parallel(FILE* out, const png_image_spec_t* spec,
+                       png_row_fn row_fn, void* ctx, int threads){
+  static const uint8_t signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  int channels = spec->color_type == 2 ? 3 : spec->color_type == 6 ? 4 :
+                 spec->color_type == 4 ? 2 : 1;
+  encoder_t enc;
+  uint8_t ihdr[13];
+  uint32_t s;
+  int i;
+
+  if(threads < 1) threads = 1;
+
+  memset(&enc, 0, sizeof(enc));
+  enc.spec = spec;
+  enc.row_fn = row_fn;
+  enc.ctx = ctx;
+  enc.row_bytes = ((size_t) spec->width * channels * spec->bit_depth + 7) / 8;
+  enc.bpp = (channels * spec->bit_depth + 7) / 8;
+  enc.rows_per_strip = STRIP_BYTES / (enc.row_bytes + 1);
+  if(enc.rows_per_strip < 1) enc.rows_per_strip = 1;
+  enc.num_strips = (spec->height + enc.rows_per_strip - 1) / enc.rows_per_strip;
+  enc.num_slots = 2 * threads;
+  enc.slots = calloc(enc.num_slots, sizeof(strip_t));
+  if(enc.slots == NULL || spec->height == 0) {
+    free(enc.slots);
+    return -1;
+  }
+  pthread_mutex_init(&enc.lock, NULL);
+  pthread_cond_init(&enc.cond, NULL);
+
+  /// Signature, header and palette
+  put_u32(ihdr, spec->width);
+  put_u32(ihdr + 4, spec->height);
+  ihdr[8] = spec->bit_depth;
+  ihdr[9] = spec->color_type;
+  ihdr[10] = ihdr[11] = ihdr[12] = 0;
+  int status = 0;
+  if(fwrite(signature, 1, 8, out) != 8 ||
+     write_chunk(out, "IHDR", ihdr, 13, NULL, 0, NULL, 0) != 0)
+    status = -1;
+  if(status == 0 && spec->palette_entries > 0 &&
+     write_chunk(out, "PLTE", spec->palette, 3 * spec->palette_entries,
+                 NULL, 0, NULL, 0) != 0)
+    status = -1;
+
+  /// Start the workers
+  pthread_t* workers = calloc(threads, sizeof(pthread_t));
+  int started = 0;
+  for(i = 0; status == 0 && workers != NULL && i < threads; i++){
+    if(pthread_create(&workers[i], NULL, strip_worker, &enc) != 0) break;
+    started++;
+  }
+  if(started == 0) status = -1;
+
+  /// Write the strips out in order as they complete, one IDAT each
+  // zlib header: deflate with a 32K window, default compression level
+  static const uint8_t zlib_header[2] = {0x78, 0x9C};
+  uLong adler = adler32(0L, Z_NULL, 0);
+  for(s = 0; status == 0 && s < enc.num_strips; s++){
+    strip_t* slot = &enc.slots[s % enc.num_slots];
+
+    pthread_mutex_lock(&enc.lock);
+    while(!slot->done && !enc.failed)
+      pthread_cond_wait(&enc.cond, &enc.lock);
+    int failed = enc.failed;
+    pthread_mutex_unlock(&enc.lock);
+    if(failed){
+      status = -1;
+      break;
+    }
+
+    adler = adler32_combine(adler, slot->adler, slot->raw_size);
+    uint8_t trailer[4];
+    put_u32(trailer, (uint32_t) adler);
+    int first = s == 0;
+    int last = s + 1 == enc.num_strips;
+    if(write_chunk(out, "IDAT", zlib_header, first ? 2 : 0,
+                   slot->data, slot->size, trailer, last ? 4 : 0) != 0)
+      status = -1;
+
+    pthread_mutex_lock(&enc.lock);
+    slot->done = 0;
+    enc.written++;
+    if(status != 0) enc.failed = 1;
+    pthread_cond_broadcast(&enc.cond);
+    pthread_mutex_unlock(&enc.lock);
+  }
+
+  if(status != 0){
+    pthread_mutex_lock(&enc.lock);
+    enc.failed = 1;
+    pthread_cond_broadcast(&enc.cond);
+    pthread_mutex_unlock(&enc.lock);
+  }
+  for(i = 0; i < started; i++)
+    pthread_join(workers[i], NULL);
+
+  if(status == 0 && write_chunk(out, "IEND", NULL, 0, NULL, 0, NULL, 0) != 0)
+    status = -1;
+
+  for(s = 0; s < enc.num_slots; s++)
+    free(enc.slots[s].data);
+  free(enc.slots);
+  free(workers);
+  pthread_mutex_destroy(&enc.lock);
+  pthread_cond_destroy(&enc.cond);
+  return status;
+}
@@ -0,0 +1,39 @@
+/**
+ * @file      png_parallel.h
+ * @brief     Multi-threaded PNG encoder
+ *
+ * The image is cut into horizontal strips which worker threads filter and
+ * deflate independently. Every strip but the last ends on a byte aligned
+ * sync flush, so the compressed strips concatenate into a single valid
+ * zlib stream (the same trick pigz uses), whose Adler-32 is stitched
+ * together with adler32_combine.
+ */
+
+#ifndef PNG_PARALLEL_H
+#define PNG_PARALLEL_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/// Bytes past the end of each row buffer that a row_fn may scribble on
+#define PNG_ROW_SLACK 64
+
+/// Produces unfiltered row y of the image into row, must be thread safe
+typedef void (*png_row_fn)(void* ctx, uint32_t y, uint8_t* row);
+
+/// Description of the image to encode
+typedef struct png_image_spec {
+  uint32_t width;
+  uint32_t height;
+  int bit_depth;
+  int color_type;
+  /// RGB triples written as the PLTE chunk for palette images
+  const uint8_t* palette;
+  int palette_entries;
+} png_image_spec_t;
+
+/// Encodes the image produced by row_fn to out using the given thread count
+int png_write_parallel(FILE* out, const png_image_spec_t* spec,
+                       png_row_fn row_fn, void* ctx, int threads);
+
+#endif
@@ -1,12 +1,26 @@
 #include <png.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "maze_types.h"
+#include "maze_io.h"
+#include "png_parallel.h"
+#include "image_formats.h"
+#include "maze_trace.h"
+#include "maze_route.h"
+#include "result_cache.h"
 
 #define DEBUG 0
-#define SCALE 2
+#define DEFAULT_SCALE 2
 
 /* Modified from code written by Ben Bullock provided at:
            http://www.lemoda.net/c/write-png/ 
@@ -22,47 +36,320 @@ typedef struct {
     uint8_t blue;
 } pixel_t;
 
-/* A picture. */
-    
-typedef struct  {
-    pixel_t *pixels;
-    size_t width;
-    size_t height;
-} bitmap_t;
-
-// Maze object to store maze 
+// Maze object to store the maze dimensions, the cells are read straight
+// from the maze text one row at a time
 maze_t maze;
+maze_text_t maze_text;
+
+// Window of the maze text being drawn, set with --crop. maze.width and
+// maze.height are the window size, text_width is the full row width.
+int crop_x = 0;
+int crop_y = 0;
+int text_width = 0;
+int text_height = 0;
+
+// Returns the cells of row y of the window
+#define CELL_ROW(y) ((const uint8_t *) MAZE_ROW (& maze_text, text_width, (y) + crop_y) + crop_x)
+
+// Size in pixels of one maze cell, set with --scale
+int scale = DEFAULT_SCALE;
+
+// Palette output: every maze component, terrain included, gets an index
+// into a PLTE chunk (16 in all, the most 4 bits hold)
+// and pixels are packed two to a byte
+int use_palette = 0;
+#define PALETTE_DEPTH 4
+static const char palette_components[] = {
+    WALL, BLANK, START, GOAL, VISIT, WRONG, PATH,
+    '1', '2', '3', '4', '5', '6', '7', '8', '9'
+};
+#define PALETTE_SIZE ((int) sizeof (palette_components))
 
 /*
- * Given "bitmap", this returns the pixel of bitmap at the point 
- * ("x", "y"). 
+ * Returns the colour a maze component is drawn with.
  */
-static pixel_t * pixel_at (bitmap_t * bitmap, int x, int y) {
-    return bitmap->pixels + bitmap->width * y + x;
+static pixel_t component_colour (char component) {
+    pixel_t pixel;
+    switch(component){
+      case WALL:
+        pixel.red = pixel.green = pixel.blue = 0;
+        break;
+      case BLANK:
+        pixel.red = pixel.green = pixel.blue = 255;
+        break;
+      case START:
+        pixel.red = 0;
+        pixel.green = 204;
+        pixel.blue = 0;
+        break;
+      case GOAL:
+        pixel.red = 204;
+        pixel.green = 0;
+        pixel.blue = 0;
+        break;
+      case VISIT:
+        pixel.red = 153;
+        pixel.green = 153;
+        pixel.blue = 102;
+        break;
+      case WRONG:
+        pixel.red = 102;
+        pixel.green = 0;
+        pixel.blue = 51;
+        break;
+      case PATH:
+        pixel.red = 51;
+        pixel.green = 102;
+        pixel.blue = 255;
+        break;
+      default:
+        if (IS_TERRAIN (component)) {
+            /* Terrain darkens from pale sand (cost 1) to deep brown (cost 9). */
+            int level = component - TERRAIN_MIN;
+            int levels = TERRAIN_MAX - TERRAIN_MIN;
+            pixel.red = (uint8_t) (235 - (235 - 90) * level / levels);
+            pixel.green = (uint8_t) (225 - (225 - 55) * level / levels);
+            pixel.blue = (uint8_t) (170 - (170 - 20) * level / levels);
+            break;
+        }
+        perror("Invalid maze component");
+        exit(0);
+    }
+    return pixel;
 }
-    
+
+/*
+ * Fills "palette" with the RGB triples of the palette entries.
+ */
+static void build_palette (png_color * palette) {
+    int i;
+    for (i = 0; i < PALETTE_SIZE; i++) {
+        pixel_t pixel = component_colour (palette_components[i]);
+        palette[i].red = pixel.red;
+        palette[i].green = pixel.green;
+        palette[i].blue = pixel.blue;
+    }
+}
+
+/*
+ * Returns the priority of a maze component when zooming out.
+ */
+static uint8_t component_priority (char component) {
+    switch (component) {
+      case START: case GOAL:
+        return 2;
+      case PATH:
+        return 1;
+      default:
+        return 0;
+    }
+}
+
+/*
+ * Lookup tables indexed by the maze text character, built once so that
+ * rasterizing a row needs no per-cell branches. The patterns hold a
+ * cell's pixels repeated to a whole number of 16 byte vectors (48 bytes
+ * is 16 RGB pixels), so a cell "scale" pixels wide is drawn with a few
+ * full-width stores; each store may run past the cell into its right
+ * neighbour, which is overwritten next.
+ */
+
+#define PATTERN_BYTES 48
+#define ROW_SLACK PATTERN_BYTES
+#if ROW_SLACK > PNG_ROW_SLACK
+#error "png_parallel row buffers are too small for the blitter"
+#endif
+#if ROW_SLACK > IMAGE_ROW_SLACK
+#error "image_formats row buffers are too small for the blitter"
+#endif
+
+static uint8_t colour_lut[256][3];
+static uint8_t priority_lut[256];
+static uint8_t palette_lut[256];
+static uint8_t rgb_pattern[256][PATTERN_BYTES];
+static uint8_t nibble_pattern[256][16];
+
+static void build_luts (void) {
+    int i, k;
+    for (i = 0; i < PALETTE_SIZE; i++) {
+        uint8_t c = (uint8_t) palette_components[i];
+        pixel_t pixel = component_colour (palette_components[i]);
+        colour_lut[c][0] = pixel.red;
+        colour_lut[c][1] = pixel.green;
+        colour_lut[c][2] = pixel.blue;
+        priority_lut[c] = component_priority (palette_components[i]);
+        palette_lut[c] = (uint8_t) i;
+        for (k = 0; k < PATTERN_BYTES; k++) {
+            rgb_pattern[c][k] = colour_lut[c][k % 3];
+        }
+        memset (nibble_pattern[c], (i << 4) | i, 16);
+    }
+}
+
+/*
+ * Copies 16 bytes with a single unaligned vector load and store.
+ */
+static inline void store16 (uint8_t * dst, const uint8_t * src) {
+#ifdef __SSE2__
+    _mm_storeu_si128 ((__m128i *) dst, _mm_loadu_si128 ((const __m128i *) src));
+#else
+    memcpy (dst, src, 16);
+#endif
+}
+
+/*
+ * An image to be written: its size in pixels and where its rows come
+ * from. Source row "y" supplies the "repeat" image rows starting at
+ * y * repeat, so a scaled maze row is only rasterized once.
+ */
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint32_t repeat;
+    void (*row) (uint32_t y, png_byte * row);
+} image_source_t;
+
+/*
+ * Returns the number of bytes in one row of an image "width" pixels wide.
+ */
+static size_t image_row_bytes (uint32_t width) {
+    if (use_palette) {
+        return ((size_t) width * PALETTE_DEPTH + 7) / 8;
+    }
+    return (size_t) width * 3;
+}
+
 /*
- * Write "bitmap" to a PNG file specified by "path"; returns 0 on
- * success, non-zero on error. 
+ * Fills "row" with the pixels of maze row "y", each cell drawn "scale"
+ * pixels wide: RGB triples, or packed palette indices in palette mode.
+ * "row" needs ROW_SLACK bytes of room past the end of the row.
  */
-static int save_png_to_file (bitmap_t *bitmap, char *path) {
+static void render_maze_row (uint32_t y, png_byte * row) {
+    const uint8_t * cells = CELL_ROW (y);
+    size_t span, k;
+    int x;
+
+    if (use_palette && (scale & 1)) {
+        /* Odd widths split bytes between cells, place each nibble. */
+        size_t px = 0;
+        int i;
+        memset (row, 0, image_row_bytes ((uint32_t) maze.width * scale));
+        for (x = 0; x < maze.width; x++) {
+            uint8_t index = nibble_pattern[cells[x]][0] & 0x0f;
+            for (i = 0; i < scale; i++, px++) {
+                row[px / 2] |= (px & 1) ? index : index << 4;
+            }
+        }
+        return;
+    }
+
+    if (use_palette) {
+        span = scale / 2;
+        if (span <= 16) {
+            for (x = 0; x < maze.width; x++, row += span) {
+                store16 (row, nibble_pattern[cells[x]]);
+            }
+        } else {
+            for (x = 0; x < maze.width; x++, row += span) {
+                for (k = 0; k < span; k += 16) {
+                    store16 (row + k, nibble_pattern[cells[x]]);
+                }
+            }
+        }
+        return;
+    }
+
+    span = (size_t) scale * 3;
+    if (span <= 16) {
+        for (x = 0; x < maze.width; x++, row += span) {
+            store16 (row, rgb_pattern[cells[x]]);
+        }
+    } else {
+        for (x = 0; x < maze.width; x++, row += span) {
+            const uint8_t * pattern = rgb_pattern[cells[x]];
+            for (k = 0; k < span; k += 16) {
+                store16 (row + k, pattern + k % PATTERN_BYTES);
+            }
+        }
+    }
+}
+
+/*
+ * Returns the full size maze image.
+ */
+static image_source_t maze_image (void) {
+    image_source_t src;
+    src.width = (uint32_t) maze.width * scale;
+    src.height = (uint32_t) maze.height * scale;
+    src.repeat = scale;
+    src.row = render_maze_row;
+    return src;
+}
+
+/*
+ * Row callback for the parallel encoder: output row "y" of the image.
+ */
+static void image_row (void * ctx, uint32_t y, uint8_t * row) {
+    const image_source_t * src = ctx;
+    src->row (y / src->repeat, row);
+}
+
+/*
+ * Write "src" to a PNG file specified by "path" ("-" for stdout) using
+ * "threads" compression threads; returns 0 on success, non-zero on error.
+ */
+static int save_png_parallel (char *path, image_source_t * src, int threads) {
+    png_image_spec_t spec;
+    png_color palette[PALETTE_SIZE];
+    FILE * fp;
+    int status;
+
+    spec.width = src->width;
+    spec.height = src->height;
+    spec.bit_depth = 8;
+    spec.color_type = PNG_COLOR_TYPE_RGB;
+    spec.palette = NULL;
+    spec.palette_entries = 0;
+    if (use_palette) {
+        build_palette (palette);
+        spec.bit_depth = PALETTE_DEPTH;
+        spec.color_type = PNG_COLOR_TYPE_PALETTE;
+        spec.palette = (const uint8_t *) palette;
+        spec.palette_entries = PALETTE_SIZE;
+    }
+
+    fp = maze_open_output (path);
+    if (! fp) {
+        return -1;
+    }
+    status = png_write_parallel (fp, & spec, image_row, src, threads);
+    if (maze_close_output (fp) != 0) {
+        status = -1;
+    }
+    return status;
+}
+
+/*
+ * Write "src" to a PNG file specified by "path" ("-" for stdout);
+ * returns 0 on success, non-zero on error. The image is never held in
+ * memory: each source row is produced once into a single output row
+ * which is handed to png_write_row "repeat" times.
+ */
+static int save_png_to_file (char *path, image_source_t * src) {
     FILE * fp;
     png_structp png_ptr = NULL;
     png_infop info_ptr = NULL;
-    size_t x, y;
-    png_byte ** row_pointers = NULL;
+    uint32_t y, i;
+    png_byte * row = NULL;
     /* "status" contains the return value of this function. At first
        it is set to a value which means 'failure'. When the routine
        has finished its work, it is set to a value which means
        'success'. */
     int status = -1;
-    /* The following number is set by trial and error only. I cannot
-       see where it it is documented in the libpng manual.
-    */
-    int pixel_size = 3;
-    int depth = 8;
+    int depth = use_palette ? PALETTE_DEPTH : 8;
+    png_color palette[PALETTE_SIZE];
     
-    fp = fopen (path, "wb");
+    fp = maze_open_output (path);
     if (! fp) {
         goto fopen_failed;
     }
@@ -76,6 +363,13 @@ static int save_png_to_file (bitmap_t *bitmap, char *path) {
     if (info_ptr == NULL) {
         goto png_create_info_struct_failed;
     }
+
+    /* One output row, reused for every row of the image. */
+
+    row = malloc (image_row_bytes (src->width) + ROW_SLACK);
+    if (row == NULL) {
+        goto png_create_info_struct_failed;
+    }
     
     /* Set up error handling. */
 
@@ -87,155 +381,841 @@ static int save_png_to_file (bitmap_t *bitmap, char *path) {
 
     png_set_IHDR (png_ptr,
                   info_ptr,
-                  bitmap->width,
-                  bitmap->height,
+                  src->width,
+                  src->height,
                   depth,
-                  PNG_COLOR_TYPE_RGB,
+                  use_palette ? PNG_COLOR_TYPE_PALETTE : PNG_COLOR_TYPE_RGB,
                   PNG_INTERLACE_NONE,
                   PNG_COMPRESSION_TYPE_DEFAULT,
                   PNG_FILTER_TYPE_DEFAULT);
-    
-    /* Initialize rows of PNG. */
-
-    row_pointers = png_malloc (png_ptr, bitmap->height * sizeof (png_byte *));
-    for (y = 0; y < bitmap->height; ++y) {
-        png_byte *row = 
-            png_malloc (png_ptr, sizeof (uint8_t) * bitmap->width * pixel_size);
-        row_pointers[y] = row;
-        for (x = 0; x < bitmap->width; ++x) {
-            pixel_t * pixel = pixel_at (bitmap, x, y);
-            *row++ = pixel->red;
-            *row++ = pixel->green;
-            *row++ = pixel->blue;
-        }
+    if (use_palette) {
+        build_palette (palette);
+        png_set_PLTE (png_ptr, info_ptr, palette, PALETTE_SIZE);
     }
     
-    /* Write the image data to "fp". */
+    /* Write the header, then stream the rows to "fp". */
 
     png_init_io (png_ptr, fp);
-    png_set_rows (png_ptr, info_ptr, row_pointers);
-    png_write_png (png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
+    png_write_info (png_ptr, info_ptr);
+
+    for (y = 0; y < src->height / src->repeat; y++) {
+        src->row (y, row);
+        for (i = 0; i < src->repeat; i++) {
+            png_write_row (png_ptr, row);
+        }
+    }
+    png_write_end (png_ptr, NULL);
 
     /* The routine has successfully written the file, so we set
        "status" to a value which indicates success. */
 
     status = 0;
     
-    for (y = 0; y < bitmap->height; y++) {
-        png_free (png_ptr, row_pointers[y]);
-    }
-    png_free (png_ptr, row_pointers);
-    
  png_failure:
  png_create_info_struct_failed:
+    free (row);
     png_destroy_write_struct (&png_ptr, &info_ptr);
  png_create_write_struct_failed:
-    fclose (fp);
+    if (maze_close_output (fp) != 0) {
+        status = -1;
+    }
  fopen_failed:
     return status;
 }
 
-/* Given "value" and "max", the maximum value which we expect "value"
-   to take, this returns an integer between 0 and 255 proportional to
-   "value" divided by "max". */
-static int pix (int value, int max) {
-    if (value < 0)
-        return 0;
-    return (int) (256.0 *((double) (value)/(double) max));
+/*
+ * Deep zoom tile pyramid.
+ *
+ * Level "tile_max_level" is the full size image, every level above it is
+ * half the size of the one below, down to a single pixel at level 0. Each
+ * tile is built exactly once: tiles on the full size level are drawn from
+ * the maze, all others by averaging 2x2 blocks of their four children.
+ * Pixels carry a priority next to their colour so the start, goal and
+ * solution path are never averaged away when zoomed out.
+ */
+
+#define TILE_SIZE 256
+#define TILE_CHANNELS 4
+
+static const char * tile_prefix;
+static int tile_max_level;
+static int tile_split_level;
+static uint8_t ** tile_split;
+static volatile int tile_failed;
+static uint32_t tile_next;
+static pthread_mutex_t tile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Width and height of the image at "level". */
+
+static uint32_t level_width (int level) {
+    uint64_t full = (uint64_t) maze.width * scale;
+    return (uint32_t) ((full + (1ULL << (tile_max_level - level)) - 1) >> (tile_max_level - level));
 }
 
-/**
- * @brief     Sets the maze component at the given indices with the correct
- * maze component.
- */
-void set_maze_component(maze_cell_t* cell, char component){
-
-  // Set cell component type
-  switch(component){
-    case WALL:
-      cell->type = WALL;
-      return;
-    case BLANK:
-      cell->type = BLANK;
-      return;
-    case START:
-      cell->type = START;
-      return;
-    case GOAL:
-      cell->type = GOAL;
-      return;
-    case VISIT:
-      cell->type = VISIT;
-      return;
-    case WRONG:
-      cell->type = WRONG;
-      return;
-    case PATH:
-      cell->type = PATH;
-      return;
-    default:
-      perror("Invalid maze component");
-      exit(0);
-  }
-  
+static uint32_t level_height (int level) {
+    uint64_t full = (uint64_t) maze.height * scale;
+    return (uint32_t) ((full + (1ULL << (tile_max_level - level)) - 1) >> (tile_max_level - level));
 }
 
-void read_in_maze(char* maze_file_name){
+static uint32_t level_columns (int level) {
+    return (level_width (level) + TILE_SIZE - 1) / TILE_SIZE;
+}
 
-  /// Open the maze data file
-	FILE *maze_file = NULL;
-  maze_file = fopen(maze_file_name,"r");
-  if(maze_file == NULL){
-    perror("Error: maze data file failed to open");
-    exit(0);
-  }
+static uint32_t level_rows (int level) {
+    return (level_height (level) + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+/*
+ * Writes a tile buffer out as "<prefix>_files/<level>/<col>_<row>.png".
+ */
+static int write_tile (int level, uint32_t col, uint32_t row,
+                       const uint8_t * tile, uint32_t w, uint32_t h) {
+    char path[4096];
+    png_structp png_ptr;
+    png_infop info_ptr;
+    png_byte line[TILE_SIZE * 3];
+    FILE * fp;
+    uint32_t x, y;
+
+    snprintf (path, sizeof (path), "%s_files/%d/%u_%u.png", tile_prefix, level, col, row);
+    fp = fopen (path, "wb");
+    if (! fp) {
+        return -1;
+    }
+    png_ptr = png_create_write_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    info_ptr = png_ptr ? png_create_info_struct (png_ptr) : NULL;
+    if (info_ptr == NULL || setjmp (png_jmpbuf (png_ptr))) {
+        png_destroy_write_struct (&png_ptr, &info_ptr);
+        fclose (fp);
+        return -1;
+    }
+    png_set_IHDR (png_ptr, info_ptr, w, h, 8, PNG_COLOR_TYPE_RGB,
+                  PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                  PNG_FILTER_TYPE_DEFAULT);
+    png_init_io (png_ptr, fp);
+    png_write_info (png_ptr, info_ptr);
+    for (y = 0; y < h; y++) {
+        const uint8_t * src = tile + (size_t) y * TILE_SIZE * TILE_CHANNELS;
+        for (x = 0; x < w; x++) {
+            line[3*x] = src[TILE_CHANNELS*x];
+            line[3*x + 1] = src[TILE_CHANNELS*x + 1];
+            line[3*x + 2] = src[TILE_CHANNELS*x + 2];
+        }
+        png_write_row (png_ptr, line);
+    }
+    png_write_end (png_ptr, NULL);
+    png_destroy_write_struct (&png_ptr, &info_ptr);
+    return fclose (fp);
+}
+
+/*
+ * Draws a full size tile straight from the maze cells.
+ */
+static void draw_tile (uint32_t col, uint32_t row, uint8_t * tile,
+                       uint32_t w, uint32_t h) {
+    uint32_t x, y;
+    for (y = 0; y < h; y++) {
+        uint32_t gy = row * TILE_SIZE + y;
+        const uint8_t * cells = CELL_ROW (gy / scale);
+        uint8_t * dst = tile + (size_t) y * TILE_SIZE * TILE_CHANNELS;
+        for (x = 0; x < w; x++) {
+            uint8_t component = cells[(col * TILE_SIZE + x) / scale];
+            dst[0] = colour_lut[component][0];
+            dst[1] = colour_lut[component][1];
+            dst[2] = colour_lut[component][2];
+            dst[3] = priority_lut[component];
+            dst += TILE_CHANNELS;
+        }
+    }
+}
+
+/*
+ * Fills the quarter of "tile" covered by the "child" tile by averaging
+ * its 2x2 blocks; the highest priority pixel in a block wins outright.
+ */
+static void reduce_child (uint8_t * tile, const uint8_t * child,
+                          uint32_t child_w, uint32_t child_h,
+                          uint32_t x_offset, uint32_t y_offset) {
+    uint32_t x, y;
+    for (y = 0; y < (child_h + 1) / 2; y++) {
+        uint8_t * dst = tile + ((size_t) (y_offset + y) * TILE_SIZE + x_offset) * TILE_CHANNELS;
+        for (x = 0; x < (child_w + 1) / 2; x++) {
+            unsigned sum[3] = {0, 0, 0};
+            unsigned count = 0;
+            const uint8_t * best = NULL;
+            uint32_t dx, dy;
+            for (dy = 2*y; dy < 2*y + 2 && dy < child_h; dy++) {
+                for (dx = 2*x; dx < 2*x + 2 && dx < child_w; dx++) {
+                    const uint8_t * src = child + ((size_t) dy * TILE_SIZE + dx) * TILE_CHANNELS;
+                    sum[0] += src[0];
+                    sum[1] += src[1];
+                    sum[2] += src[2];
+                    count++;
+                    if (src[3] > 0 && (best == NULL || src[3] > best[3])) {
+                        best = src;
+                    }
+                }
+            }
+            if (best != NULL) {
+                memcpy (dst, best, TILE_CHANNELS);
+            } else {
+                dst[0] = sum[0] / count;
+                dst[1] = sum[1] / count;
+                dst[2] = sum[2] / count;
+                dst[3] = 0;
+            }
+            dst += TILE_CHANNELS;
+        }
+    }
+}
+
+/*
+ * Builds (and writes) tile ("col", "row") of "level" together with every
+ * tile below it in the pyramid. Returns the tile buffer, which the caller
+ * frees, or NULL on failure. Once the worker threads are done, tiles on
+ * the split level are handed out from "tile_split" ("use_split").
+ */
+static uint8_t * build_tile (int level, uint32_t col, uint32_t row, int use_split) {
+    uint32_t w = level_width (level) - col * TILE_SIZE;
+    uint32_t h = level_height (level) - row * TILE_SIZE;
+    uint8_t * tile;
+
+    if (use_split && level == tile_split_level) {
+        tile = tile_split[(size_t) row * level_columns (level) + col];
+        tile_split[(size_t) row * level_columns (level) + col] = NULL;
+        return tile;
+    }
+
+    if (w > TILE_SIZE) w = TILE_SIZE;
+    if (h > TILE_SIZE) h = TILE_SIZE;
+    tile = malloc ((size_t) TILE_SIZE * TILE_SIZE * TILE_CHANNELS);
+    if (tile == NULL) {
+        return NULL;
+    }
+
+    if (level == tile_max_level) {
+        draw_tile (col, row, tile, w, h);
+    } else {
+        uint32_t child_w_total = level_width (level + 1);
+        uint32_t child_h_total = level_height (level + 1);
+        int i;
+        for (i = 0; i < 4; i++) {
+            uint32_t child_col = 2*col + (i & 1);
+            uint32_t child_row = 2*row + (i >> 1);
+            if (child_col * TILE_SIZE >= child_w_total || child_row * TILE_SIZE >= child_h_total) {
+                continue;
+            }
+            uint8_t * child = build_tile (level + 1, child_col, child_row, use_split);
+            if (child == NULL) {
+                free (tile);
+                return NULL;
+            }
+            uint32_t child_w = child_w_total - child_col * TILE_SIZE;
+            uint32_t child_h = child_h_total - child_row * TILE_SIZE;
+            reduce_child (tile, child,
+                          child_w > TILE_SIZE ? TILE_SIZE : child_w,
+                          child_h > TILE_SIZE ? TILE_SIZE : child_h,
+                          (i & 1) * TILE_SIZE / 2, (i >> 1) * TILE_SIZE / 2);
+            free (child);
+        }
+    }
+
+    if (write_tile (level, col, row, tile, w, h) != 0) {
+        free (tile);
+        return NULL;
+    }
+    return tile;
+}
+
+/*
+ * Worker thread: builds whole subtrees rooted at the split level.
+ */
+static void * tile_worker (void * arg) {
+    uint32_t count = level_columns (tile_split_level) * level_rows (tile_split_level);
+    (void) arg;
+    while (! tile_failed) {
+        pthread_mutex_lock (&tile_lock);
+        uint32_t index = tile_next++;
+        pthread_mutex_unlock (&tile_lock);
+        if (index >= count) {
+            break;
+        }
+        uint32_t col = index % level_columns (tile_split_level);
+        uint32_t row = index / level_columns (tile_split_level);
+        tile_split[index] = build_tile (tile_split_level, col, row, 0);
+        if (tile_split[index] == NULL) {
+            tile_failed = 1;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Writes the maze as a deep zoom pyramid: "<prefix>.dzi" describes the
+ * image and "<prefix>_files/<level>/<col>_<row>.png" hold the tiles.
+ * Subtrees are spread over "threads" threads; returns 0 on success.
+ */
+static int save_tile_pyramid (const char * prefix, int threads) {
+    char path[4096];
+    uint64_t largest = (uint64_t) (maze.width > maze.height ? maze.width : maze.height) * scale;
+    uint32_t count, i;
+    int level;
+    FILE * fp;
+
+    tile_prefix = prefix;
+    tile_max_level = 0;
+    while ((1ULL << tile_max_level) < largest) {
+        tile_max_level++;
+    }
+
+    /* One directory per level. */
+
+    snprintf (path, sizeof (path), "%s_files", prefix);
+    if (mkdir (path, 0755) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    for (level = 0; level <= tile_max_level; level++) {
+        snprintf (path, sizeof (path), "%s_files/%d", prefix, level);
+        if (mkdir (path, 0755) != 0 && errno != EEXIST) {
+            return -1;
+        }
+    }
+
+    /* Split at the first level with a few subtrees per thread. */
+
+    if (threads < 1) {
+        threads = 1;
+    }
+    tile_split_level = 0;
+    while (tile_split_level < tile_max_level &&
+           level_columns (tile_split_level) * level_rows (tile_split_level) < 4u * threads) {
+        tile_split_level++;
+    }
+    count = level_columns (tile_split_level) * level_rows (tile_split_level);
+    tile_split = calloc (count, sizeof (uint8_t *));
+    if (tile_split == NULL) {
+        return -1;
+    }
+
+    pthread_t * workers = calloc (threads, sizeof (pthread_t));
+    int started = 0;
+    tile_next = 0;
+    tile_failed = 0;
+    for (i = 0; workers != NULL && i < (uint32_t) threads; i++) {
+        if (pthread_create (&workers[i], NULL, tile_worker, NULL) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        tile_worker (NULL);
+    }
+    for (i = 0; i < (uint32_t) started; i++) {
+        pthread_join (workers[i], NULL);
+    }
+    free (workers);
+
+    /* Levels above the split are small, finish them here. */
+
+    uint8_t * root = tile_failed ? NULL : build_tile (0, 0, 0, 1);
+    free (root);
+    for (i = 0; i < count; i++) {
+        free (tile_split[i]);
+    }
+    free (tile_split);
+    tile_split = NULL;
+    if (root == NULL) {
+        return -1;
+    }
+
+    snprintf (path, sizeof (path), "%s.dzi", prefix);
+    fp = fopen (path, "w");
+    if (! fp) {
+        return -1;
+    }
+    fprintf (fp,
+             "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+             "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\"\n"
+             "       TileSize=\"%d\" Overlap=\"0\" Format=\"png\">\n"
+             "  <Size Width=\"%u\" Height=\"%u\"/>\n"
+             "</Image>\n",
+             TILE_SIZE, level_width (tile_max_level), level_height (tile_max_level));
+    return fclose (fp);
+}
+
+/*
+ * Thumbnails.
+ *
+ * Each thumbnail pixel stands for a square block of "thumb_block" cells.
+ * Blocks are reduced from per-component cell counts: RGB thumbnails take
+ * the area-weighted average colour, palette thumbnails the most common
+ * component. Either way a block holding the start, goal or any PATH cell
+ * takes that colour, so the solution stays visible at any size. Only the
+ * thumbnail itself is held in memory; its rows are split between threads.
+ */
 
-  /// Read in maze data
-  /// Determine maze size and validate data, determine start and goal locations
-  char cell;
-  int i = 0;
-  int j = 0;
-  if(DEBUG) printf("Input Maze:\n");
-  while(fscanf(maze_file,"%c",&cell) != EOF){
-    switch(cell){
-      case START: case GOAL: case WALL: case BLANK:
-      case VISIT: case WRONG: case PATH:
-        if(DEBUG) printf("%c",cell);
-        j++;
+static uint32_t thumb_block;
+static uint32_t thumb_width;
+static uint32_t thumb_height;
+static uint8_t * thumb_pixels;
+static uint32_t thumb_next;
+static pthread_mutex_t thumb_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Reduces the cell counts of one block to a pixel: three RGB bytes, or
+ * a palette index in palette mode.
+ */
+static void reduce_block (const uint32_t * counts, uint8_t * pixel) {
+    int i, best = -1;
+    uint64_t sum[3] = {0, 0, 0};
+    uint32_t total = 0;
+
+    for (i = 0; i < PALETTE_SIZE; i++) {
+        uint8_t c = (uint8_t) palette_components[i];
+        if (counts[i] > 0 && priority_lut[c] > 0 &&
+            (best < 0 || priority_lut[c] > priority_lut[(uint8_t) palette_components[best]])) {
+            best = i;
+        }
+    }
+    if (best < 0 && use_palette) {
+        for (i = 0; i < PALETTE_SIZE; i++) {
+            if (best < 0 || counts[i] > counts[best]) {
+                best = i;
+            }
+        }
+    }
+
+    if (best >= 0) {
+        uint8_t c = (uint8_t) palette_components[best];
+        if (use_palette) {
+            pixel[0] = (uint8_t) best;
+        } else {
+            memcpy (pixel, colour_lut[c], 3);
+        }
+        return;
+    }
+
+    for (i = 0; i < PALETTE_SIZE; i++) {
+        uint8_t c = (uint8_t) palette_components[i];
+        sum[0] += (uint64_t) counts[i] * colour_lut[c][0];
+        sum[1] += (uint64_t) counts[i] * colour_lut[c][1];
+        sum[2] += (uint64_t) counts[i] * colour_lut[c][2];
+        total += counts[i];
+    }
+    pixel[0] = (uint8_t) ((sum[0] + total / 2) / total);
+    pixel[1] = (uint8_t) ((sum[1] + total / 2) / total);
+    pixel[2] = (uint8_t) ((sum[2] + total / 2) / total);
+}
+
+/*
+ * Worker thread: claims thumbnail rows one at a time and reduces the
+ * band of maze rows behind each of them.
+ */
+static void * thumb_worker (void * arg) {
+    size_t pixel_bytes = use_palette ? 1 : 3;
+    uint32_t * counts = malloc ((size_t) thumb_width * PALETTE_SIZE * sizeof (uint32_t));
+    (void) arg;
+
+    while (counts != NULL) {
+        pthread_mutex_lock (&thumb_lock);
+        uint32_t ty = thumb_next++;
+        pthread_mutex_unlock (&thumb_lock);
+        if (ty >= thumb_height) {
+            break;
+        }
+
+        memset (counts, 0, (size_t) thumb_width * PALETTE_SIZE * sizeof (uint32_t));
+        uint32_t y, y_end = (ty + 1) * thumb_block;
+        if (y_end > (uint32_t) maze.height) {
+            y_end = maze.height;
+        }
+        for (y = ty * thumb_block; y < y_end; y++) {
+            const uint8_t * cells = CELL_ROW (y);
+            uint32_t tx, x = 0;
+            for (tx = 0; tx < thumb_width; tx++) {
+                uint32_t * block = counts + (size_t) tx * PALETTE_SIZE;
+                uint32_t x_end = x + thumb_block;
+                if (x_end > (uint32_t) maze.width) {
+                    x_end = maze.width;
+                }
+                for (; x < x_end; x++) {
+                    block[palette_lut[cells[x]]]++;
+                }
+            }
+        }
+
+        uint8_t * dst = thumb_pixels + (size_t) ty * thumb_width * pixel_bytes;
+        uint32_t tx;
+        for (tx = 0; tx < thumb_width; tx++) {
+            reduce_block (counts + (size_t) tx * PALETTE_SIZE, dst + tx * pixel_bytes);
+        }
+    }
+
+    free (counts);
+    return NULL;
+}
+
+/*
+ * Row callback for thumbnails: copies (or packs) a row of "thumb_pixels".
+ */
+static void thumb_row (uint32_t y, png_byte * row) {
+    if (use_palette) {
+        const uint8_t * src = thumb_pixels + (size_t) y * thumb_width;
+        uint32_t x;
+        memset (row, 0, image_row_bytes (thumb_width));
+        for (x = 0; x < thumb_width; x++) {
+            row[x / 2] |= (x & 1) ? src[x] : src[x] << 4;
+        }
+    } else {
+        memcpy (row, thumb_pixels + (size_t) y * thumb_width * 3, (size_t) thumb_width * 3);
+    }
+}
+
+/*
+ * Builds a thumbnail whose longer side is at most "max_side" pixels with
+ * "threads" threads; returns the image to write, with a zero height if
+ * memory ran out.
+ */
+static image_source_t make_thumbnail (uint32_t max_side, int threads) {
+    uint32_t longest = maze.width > maze.height ? maze.width : maze.height;
+    image_source_t src;
+    int i, started = 0;
+
+    thumb_block = (longest + max_side - 1) / max_side;
+    if (thumb_block < 1) {
+        thumb_block = 1;
+    }
+    thumb_width = (maze.width + thumb_block - 1) / thumb_block;
+    thumb_height = (maze.height + thumb_block - 1) / thumb_block;
+    thumb_pixels = malloc ((size_t) thumb_width * thumb_height * (use_palette ? 1 : 3));
+
+    src.width = thumb_width;
+    src.height = thumb_pixels != NULL ? thumb_height : 0;
+    src.repeat = 1;
+    src.row = thumb_row;
+    if (thumb_pixels == NULL) {
+        return src;
+    }
+
+    if (threads < 1) {
+        threads = 1;
+    }
+    pthread_t * workers = calloc (threads, sizeof (pthread_t));
+    thumb_next = 0;
+    for (i = 0; workers != NULL && i < threads; i++) {
+        if (pthread_create (&workers[i], NULL, thumb_worker, NULL) != 0) {
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        thumb_worker (NULL);
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join (workers[i], NULL);
+    }
+    free (workers);
+    return src;
+}
+
+/*
+ * Solver traces (solve --trace).
+ *
+ * A heat map colours every cell the solver touched by when it first got
+ * there, from blue (early) to red (late); untouched cells keep their
+ * normal colour. Frames replay the trace onto a private copy of the maze
+ * text and write a full image at even steps in time, so every output
+ * format and option that reads the maze text works on them unchanged.
+ */
+
+#define HEAT_LEVELS 256
+
+static uint8_t heat_ramp[HEAT_LEVELS][3];
+// First visit time bucket of every window cell, 0 for never visited
+static uint8_t * heat;
+
+/*
+ * Returns the window cell index of trace cell "cell", or -1 if it is
+ * outside the window.
+ */
+static int64_t window_cell (uint32_t cell) {
+    int64_t x = (int64_t) (cell % (uint32_t) text_width) - crop_x;
+    int64_t y = (int64_t) (cell / (uint32_t) text_width) - crop_y;
+    if (x < 0 || y < 0 || x >= maze.width || y >= maze.height) {
+        return -1;
+    }
+    return y * maze.width + x;
+}
+
+/*
+ * Fills "heat_ramp": blue, cyan, green, yellow, red.
+ */
+static void build_heat_ramp (void) {
+    static const uint8_t stops[5][3] = {
+        { 0, 0, 255 }, { 0, 255, 255 }, { 0, 255, 0 }, { 255, 255, 0 }, { 255, 0, 0 }
+    };
+    int i, c;
+    for (i = 0; i < HEAT_LEVELS; i++) {
+        int pos = i * 4 * 255 / (HEAT_LEVELS - 1);
+        int stop = pos / 255 < 4 ? pos / 255 : 3;
+        int frac = pos - stop * 255;
+        for (c = 0; c < 3; c++) {
+            heat_ramp[i][c] = (uint8_t) (stops[stop][c]
+                + (stops[stop + 1][c] - stops[stop][c]) * frac / 255);
+        }
+    }
+}
+
+/*
+ * Row callback for heat maps.
+ */
+static void heat_row (uint32_t y, png_byte * row) {
+    const uint8_t * cells = CELL_ROW (y);
+    const uint8_t * levels = heat + (size_t) y * maze.width;
+    int x, i;
+    for (x = 0; x < maze.width; x++) {
+        const uint8_t * colour = levels[x] ? heat_ramp[levels[x] - 1] : colour_lut[cells[x]];
+        for (i = 0; i < scale; i++, row += 3) {
+            row[0] = colour[0];
+            row[1] = colour[1];
+            row[2] = colour[2];
+        }
+    }
+}
+
+/*
+ * Builds the heat map image for sorted "events"; the returned source has
+ * a height of 0 if there is no memory for it.
+ */
+static image_source_t heat_image (const trace_event_t * events, size_t count) {
+    image_source_t src = maze_image ();
+    uint64_t span = count > 0 ? events[count - 1].time + 1 : 1;
+    size_t i;
+
+    build_heat_ramp ();
+    heat = calloc ((size_t) maze.width * maze.height, 1);
+    if (heat == NULL) {
+        src.height = 0;
+        return src;
+    }
+    for (i = 0; i < count; i++) {
+        int64_t cell = window_cell (events[i].cell);
+        if (cell >= 0 && heat[cell] == 0) {
+            heat[cell] = (uint8_t) (1 + events[i].time * (HEAT_LEVELS - 1) / span);
+        }
+    }
+    src.row = heat_row;
+    return src;
+}
+
+/*
+ * Applies trace events to the maze text until the first one after "until",
+ * starting from event "next"; returns the index of that event.
+ */
+static size_t replay_trace (char * text, const trace_event_t * events,
+                            size_t count, size_t next, uint64_t until) {
+    for (; next < count && events[next].time <= until; next++) {
+        uint32_t cell = events[next].cell;
+        uint32_t x = cell % (uint32_t) text_width;
+        uint32_t y = cell / (uint32_t) text_width;
+        if (y < (uint32_t) text_height) {
+            text[(size_t) y * (text_width + 1) + x] = (char) events[next].type;
+        }
+    }
+    return next;
+}
+
+/*
+ * Output formats. PNG is the default; the others encode far faster at the
+ * cost of file size: raw PPM, 1-bit PBM (walls only, for unsolved mazes)
+ * and QOI.
+ */
+
+typedef enum { FORMAT_PNG, FORMAT_QOI, FORMAT_PPM, FORMAT_PBM } image_format_t;
+
+static const char * format_names[] = { "png", "qoi", "ppm", "pbm" };
+#define NUM_FORMATS ((int) (sizeof (format_names) / sizeof (format_names[0])))
+
+/*
+ * Returns the format named "name" (a flag value or file extension), or
+ * -1 if there is none.
+ */
+static int find_format (const char * name) {
+    int i;
+    for (i = 0; i < NUM_FORMATS; i++) {
+        if (strcasecmp (name, format_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Row callback for the image_formats encoders.
+ */
+static void rgb_row (void * ctx, uint32_t y, uint8_t * row) {
+    const image_source_t * src = ctx;
+    src->row (y, row);
+}
+
+/*
+ * Write "src" to "path" ("-" for stdout) as a QOI, PPM or PBM image;
+ * returns 0 on success, non-zero on error.
+ */
+static int save_simple_image (char * path, image_source_t * src, image_format_t format) {
+    image_rows_t rows;
+    FILE * fp;
+    int status;
+
+    rows.width = src->width;
+    rows.height = src->height;
+    rows.repeat = src->repeat;
+    rows.row = rgb_row;
+    rows.ctx = src;
+
+    fp = maze_open_output (path);
+    if (! fp) {
+        return -1;
+    }
+    switch (format) {
+      case FORMAT_QOI:
+        status = write_qoi (fp, & rows);
         break;
-      case '\n':
-        if(i == 0) maze.width = j;
-        if(maze.width != j){
-          perror("Invalid maze dimensions");
-          exit(0);
-        }
-        i++;
-        j = 0;
-        if(DEBUG) printf("%c",cell);
+      case FORMAT_PPM:
+        status = write_ppm (fp, & rows);
         break;
       default:
-        perror("Invalid character in maze");
-        exit(0);
+        status = write_pbm (fp, & rows);
+        break;
     }
-  }
-  maze.height = i;
-  if(DEBUG) printf("Start: (%d,%d)\nGoal: (%d,%d)\n",maze.startX,maze.startY,maze.goalX,maze.goalY);
+    if (maze_close_output (fp) != 0) {
+        status = -1;
+    }
+    return status;
+}
+
+/*
+ * Write "src" to "path" in "format"; returns 0 on success, non-zero on
+ * error.
+ */
+static int save_image (char * path, image_source_t * src, image_format_t format, int threads) {
+    if (format != FORMAT_PNG) {
+        return save_simple_image (path, src, format);
+    }
+    if (threads > 1) {
+        return save_png_parallel (path, src, threads);
+    }
+    return save_png_to_file (path, src);
+}
 
-  /// Size the maze matrix and read in the maze data
-  rewind(maze_file);
+/*
+ * Replays sorted "events" onto the maze and writes "frames" images named
+ * "base"_NNNN."format"; returns 0 on success, non-zero on error.
+ */
+static int save_trace_frames (const char * base, const trace_event_t * events,
+                              size_t count, int frames, image_format_t format,
+                              int threads) {
+    char * original = maze_text.data;
+    char * text = malloc (maze_text.length);
+    uint64_t span = count > 0 ? events[count - 1].time : 0;
+    size_t next = 0, length = strlen (base) + 16;
+    char * name = malloc (length);
+    int frame, status = 0;
 
-  maze.cells = (maze_cell_t**) calloc(maze.height, sizeof(maze_cell_t*));
-  for(i = 0; i < maze.height; i++){
-    maze.cells[i] = (maze_cell_t*) calloc(maze.width, sizeof(maze_cell_t));
+    if (text == NULL || name == NULL) {
+        free (text);
+        free (name);
+        return -1;
+    }
+    memcpy (text, original, maze_text.length);
+    maze_text.data = text;
 
-    for(j = 0; j < maze.width; j++){
-      fscanf(maze_file, "%c", &cell);
-      set_maze_component(&maze.cells[i][j], cell);
+    for (frame = 1; frame <= frames && status == 0; frame++) {
+        image_source_t image = maze_image ();
+        next = replay_trace (text, events, count, next, span * frame / frames);
+        snprintf (name, length, "%s_%04d.%s", base, frame - 1, format_names[format]);
+        status = save_image (name, &image, format, threads);
     }
-    fscanf(maze_file, "%c", &cell);
+
+    maze_text.data = original;
+    free (text);
+    free (name);
+    return status;
+}
+
+/*
+ * Draws a route written by solve --moves over the maze. The maze text is
+ * copied and every cell the route passes through, other than S and G, is
+ * set to PATH, so the copy renders like a solution. Returns the copy, or
+ * NULL after printing the reason if the route leaves the maze or crosses
+ * a wall.
+ */
+static char * overlay_route (const maze_route_t * route) {
+    char * text = malloc (maze_text.length);
+    int x = route->x;
+    int y = route->y;
+    size_t i;
+
+    if (text == NULL) {
+        perror ("Error: out of memory");
+        return NULL;
+    }
+    memcpy (text, maze_text.data, maze_text.length);
+    for (i = 0; i < route->length; i++) {
+        char * cell;
+        route_move (route->moves[i], & x, & y);
+        if (x < 0 || y < 0 || x >= text_width || y >= text_height) {
+            fprintf (stderr, "Path leaves the maze at move %zu\n", i + 1);
+            free (text);
+            return NULL;
+        }
+        cell = text + (size_t) y * (text_width + 1) + x;
+        if (* cell == WALL) {
+            fprintf (stderr, "Path runs into the wall at (%d,%d)\n", x, y);
+            free (text);
+            return NULL;
+        }
+        if (* cell != START && * cell != GOAL) {
+            * cell = PATH;
+        }
+    }
+    return text;
+}
+
+/**
+ * @brief     Maps the maze (or solution) data into memory, "-" reads the
+ * maze from stdin.
+ */
+void open_maze(char* maze_file_name){
+  if(maze_text_open(&maze_text, maze_file_name) != 0){
+    perror("Error: maze data file failed to open");
+    exit(0);
   }
+}
+
+/**
+ * @brief     Validates the maze (or solution) data and finds its size, only
+ * the window rows when cropping.
+ */
+void read_in_maze(const int* crop){
 
-  fclose(maze_file);
+  /// Determine maze size and validate data, only the window rows when cropping
+  if(crop == NULL){
+    if(maze_scan(&maze, maze_text.data, maze_text.length, 1) != 0)
+      exit(0);
+    text_width = maze.width;
+    text_height = maze.height;
+  }else{
+    if(maze_scan_window(&maze, maze_text.data, maze_text.length, 1, crop[0], crop[1], crop[2], crop[3]) != 0)
+      exit(0);
+    text_width = maze.width;
+    text_height = maze.height;
+    crop_x = crop[0];
+    crop_y = crop[1];
+    maze.width = crop[2];
+    maze.height = crop[3];
+  }
+  if(DEBUG) printf("Start: (%d,%d)\nGoal: (%d,%d)\n",maze.startX,maze.startY,maze.goalX,maze.goalY);
 }
 
 int main (int argc, char** argv) {
@@ -246,78 +1226,232 @@ int main (int argc, char** argv) {
   }
 
 	char* maze_file_name = argv[1];
+  char* image_file_name = NULL;
+  char* tile_prefix_arg = NULL;
+  int thumb_size = 0;
+  int format = -1;
+  int crop[4];
+  int cropping = 0;
+  char* trace_file_name = NULL;
+  char* path_file_name = NULL;
+  char* cache_dir = NULL;
+  int frames = 0;
+  int threads = 1;
+  int i;
   if(DEBUG) printf("%s\n",maze_file_name);
 
-  // Read in maze data from file
-  read_in_maze(maze_file_name);
+  for(i = 2; i < argc; i++){
+    if(strcmp(argv[i],"-o") == 0 && i + 1 < argc){
+      image_file_name = argv[++i];
+    }else if(strcmp(argv[i],"-j") == 0 && i + 1 < argc){
+      // -j 0 uses every online core
+      threads = atoi(argv[++i]);
+      if(threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }else if(strcmp(argv[i],"-f") == 0 && i + 1 < argc){
+      format = find_format(argv[++i]);
+      if(format < 0){
+        fprintf(stderr,"Unknown image format '%s'. Valid options: png qoi ppm pbm\n", argv[i]);
+        exit(0);
+      }
+    }else if(strcmp(argv[i],"-p") == 0){
+      use_palette = 1;
+    }else if(strcmp(argv[i],"--tiles") == 0 && i + 1 < argc){
+      tile_prefix_arg = argv[++i];
+    }else if(strcmp(argv[i],"--thumb") == 0 && i + 1 < argc){
+      thumb_size = atoi(argv[++i]);
+      if(thumb_size < 1){
+        fprintf(stderr,"Thumbnail size must be a positive number of pixels\n");
+        exit(0);
+      }
+    }else if(strcmp(argv[i],"--crop") == 0 && i + 1 < argc){
+      if(sscanf(argv[++i], "%d,%d,%d,%d", &crop[0], &crop[1], &crop[2], &crop[3]) != 4){
+        fprintf(stderr,"Crop must be given as x,y,width,height in cells\n");
+        exit(0);
+      }
+      cropping = 1;
+    }else if(strcmp(argv[i],"--cache") == 0 && i + 1 < argc){
+      cache_dir = argv[++i];
+    }else if(strcmp(argv[i],"--trace") == 0 && i + 1 < argc){
+      trace_file_name = argv[++i];
+    }else if(strcmp(argv[i],"--path") == 0 && i + 1 < argc){
+      path_file_name = argv[++i];
+    }else if(strcmp(argv[i],"--frames") == 0 && i + 1 < argc){
+      frames = atoi(argv[++i]);
+      if(frames < 1){
+        fprintf(stderr,"Frame count must be a positive number\n");
+        exit(0);
+      }
+    }else if(strcmp(argv[i],"--scale") == 0 && i + 1 < argc){
+      scale = atoi(argv[++i]);
+      if(scale < 1){
+        fprintf(stderr,"Scale must be a positive number of pixels per cell\n");
+        exit(0);
+      }
+    }else{
+      fprintf(stderr,"Usage: %s <maze file|-> [-o image file|-] [-f png|qoi|ppm|pbm] [-j threads] [-p] [--tiles prefix] [--scale N] [--crop x,y,w,h] [--thumb max side] [--trace file [--frames N]] [--path moves file] [--cache dir]\n", argv[0]);
+      exit(0);
+    }
+  }
 
-  bitmap_t maze_image;
-  int x;
-  int y;
+  if(frames > 0 && trace_file_name == NULL){
+    fprintf(stderr,"--frames needs a solver trace, given with --trace\n");
+    exit(0);
+  }
+  if(trace_file_name != NULL && path_file_name != NULL){
+    fprintf(stderr,"--path cannot be combined with --trace\n");
+    exit(0);
+  }
+  if(trace_file_name != NULL && (tile_prefix_arg != NULL || thumb_size > 0)){
+    fprintf(stderr,"--trace cannot be combined with --tiles or --thumb\n");
+    exit(0);
+  }
 
-  /// Create an image.
-  maze_image.width = maze.width * SCALE;
-  maze_image.height = maze.height * SCALE;
+  /// Pick the format: -f, else the image file extension, else PNG
+  if(format < 0 && image_file_name != NULL && strrchr(image_file_name, '.') != NULL){
+    // Look past a .gz or .zst extension, maze_open_output compresses those
+    char* name = strdup(image_file_name);
+    if(maze_compression(name) != MAZE_PLAIN)
+      *strrchr(name, '.') = '\0';
+    if(strrchr(name, '.') != NULL)
+      format = find_format(strrchr(name, '.') + 1);
+    free(name);
+  }
+  if(format < 0)
+    format = FORMAT_PNG;
+  // Palette output only exists for PNG, the other formats take RGB rows,
+  // and heat map colours are not in the palette
+  if(format != FORMAT_PNG || (trace_file_name != NULL && frames == 0))
+    use_palette = 0;
 
-  maze_image.pixels = calloc (sizeof (pixel_t), maze_image.width * maze_image.height);
-  int i,j;
+  /// Pick the image file name, a maze read from stdin goes back out on stdout
+  char* owned_name = NULL;
+  if(image_file_name == NULL && maze_is_stdio(maze_file_name))
+    image_file_name = "-";
+  if(image_file_name == NULL){
+    char* addon = thumb_size > 0 ? "_thumb." : trace_file_name != NULL && frames == 0 ? "_heat." : ".";
+    size_t length = strlen(maze_file_name) + strlen(addon) + strlen(format_names[format]) + 1;
+    // Drop a .gz or .zst extension: maze.gz -> maze.png
+    int base = (int) strlen(maze_file_name);
+    if(maze_compression(maze_file_name) != MAZE_PLAIN)
+      base -= (int) strlen(strrchr(maze_file_name, '.'));
+    owned_name = (char*) calloc(sizeof(char), length);
 
-  for (y = 0; y < maze.height; y++) {
-    for (x = 0; x < maze.width; x++) {
-      for (i = 0; i < SCALE; i++) {
-        for (j = 0; j < SCALE; j++) {
-          pixel_t * pixel = pixel_at (& maze_image, SCALE*x+i, SCALE*y+j);
-          switch(maze.cells[y][x].type){
-            case WALL:
-              pixel->red = pixel->green = pixel->blue = 0;
-              break;
-            case BLANK:
-              pixel->red = pixel->green = pixel->blue = 255;
-              break;
-            case START:
-              pixel->red = 0;
-              pixel->green = 204;
-              pixel->blue = 0;
-              break;
-            case GOAL:
-              pixel->red = 204;
-              pixel->green = 0;
-              pixel->blue = 0;
-              break;
-            case VISIT:
-              pixel->red = 153;
-              pixel->green = 153;
-              pixel->blue = 102;
-              break;
-            case WRONG:
-              pixel->red = 102;
-              pixel->green = 0;
-              pixel->blue = 51;
-              break;
-            case PATH:
-              pixel->red = 51;
-              pixel->green = 102;
-              pixel->blue = 255;
-              break;
-            default:
-              perror("Invalid maze component");
-              exit(0);
-          }
-        }
-      }
+    snprintf(owned_name, length, "%.*s%s%s", base, maze_file_name, addon, format_names[format]);
+    image_file_name = owned_name;
+  }
+
+  // Read in maze data from file
+  open_maze(maze_file_name);
+
+  /// An image cached for this exact maze and these options is copied out
+  // without parsing or drawing. Tiles, traces and paths depend on more than
+  // the maze.
+  result_cache_t cache;
+  int cached = tile_prefix_arg == NULL && trace_file_name == NULL && path_file_name == NULL
+               && result_cache_open(&cache, cache_dir) == 0;
+  uint64_t hash = 0;
+  char mode[96];
+  if(cached){
+    hash = maze_hash(maze_text.data, maze_text.length);
+    snprintf(mode, sizeof(mode), "render-%s-s%d-p%d-t%d-c%d,%d,%d,%d%s",
+             format_names[format], scale, use_palette, thumb_size,
+             cropping ? crop[0] : 0, cropping ? crop[1] : 0,
+             cropping ? crop[2] : 0, cropping ? crop[3] : 0,
+             maze_compression(image_file_name) == MAZE_GZIP ? ".gz"
+             : maze_compression(image_file_name) == MAZE_ZSTD ? ".zst" : "");
+    if(result_cache_fetch(&cache, hash, mode, image_file_name) == 0){
+      maze_text_close(&maze_text);
+      result_cache_close(&cache);
+      free(owned_name);
+      return 0;
     }
   }
 
-  char* addon = ".png";
-  char* image_file_name = (char*) calloc(sizeof(char), (strlen(maze_file_name) + strlen(addon) + 1));
+  read_in_maze(cropping ? crop : NULL);
+  build_luts();
+  if((uint64_t) maze.width * scale > 0x7fffffff || (uint64_t) maze.height * scale > 0x7fffffff){
+    fprintf(stderr,"Image too large for a scale of %d\n", scale);
+    exit(0);
+  }
+
+  /// Draw a route from solve --moves over a private copy of the maze
+  char* maze_data = maze_text.data;
+  char* overlay = NULL;
+  if(path_file_name != NULL){
+    maze_route_t route;
+    if(route_read(&route, path_file_name, (size_t) text_width * text_height) != 0)
+      exit(0);
+    overlay = overlay_route(&route);
+    route_free(&route);
+    if(overlay == NULL)
+      exit(0);
+    maze_text.data = overlay;
+  }
+
+  /// Deep zoom output replaces the single image
+  if(tile_prefix_arg != NULL){
+    if(save_tile_pyramid(tile_prefix_arg, threads) != 0)
+      perror("Error: failed to write tile pyramid");
+    free(owned_name);
+    maze_text.data = maze_data;
+    free(overlay);
+    maze_text_close(&maze_text);
+    return 0;
+  }
+
+  /// Load a solver trace, drawn as a heat map or replayed as frames
+  trace_header_t trace_header;
+  trace_event_t* events = NULL;
+  size_t event_count = 0;
+  if(trace_file_name != NULL){
+    if(trace_load(trace_file_name, &trace_header, &events, &event_count) != 0)
+      exit(0);
+    if(trace_header.width != (uint32_t) text_width || trace_header.height != (uint32_t) text_height){
+      fprintf(stderr,"Trace is for a %ux%u maze, not this %dx%d one\n",
+              trace_header.width, trace_header.height, text_width, text_height);
+      exit(0);
+    }
+  }
 
-  strncat(image_file_name, maze_file_name, strlen(maze_file_name));
-  strncat(image_file_name, addon, strlen(addon));
+  if(frames > 0){
+    if(maze_is_stdio(image_file_name)){
+      fprintf(stderr,"Frames are written to files, give a name with -o\n");
+      exit(0);
+    }
+    // Frames are named after the image file, less its extension
+    char* base = strdup(image_file_name);
+    char* dot = strrchr(base, '.');
+    if(dot != NULL && strchr(dot, '/') == NULL)
+      *dot = '\0';
+    if(save_trace_frames(base, events, event_count, frames, format, threads) != 0)
+      perror("Error: failed to write frames");
+    free(base);
+    free(events);
+    free(owned_name);
+    maze_text_close(&maze_text);
+    return 0;
+  }
 
   /// Write the image to a file
-  save_png_to_file (& maze_image, image_file_name);
+  image_source_t image = trace_file_name != NULL ? heat_image(events, event_count)
+                       : thumb_size > 0 ? make_thumbnail(thumb_size, threads) : maze_image();
+  if(image.height == 0){
+    perror("Error: out of memory");
+    exit(0);
+  }
+  if(save_image(image_file_name, &image, format, threads) != 0)
+    perror("Error: failed to write image");
+  else if(cached && !maze_is_stdio(image_file_name))
+    result_cache_store(&cache, hash, mode, image_file_name);
+  if(cached)
+    result_cache_close(&cache);
 
-  free(image_file_name);
+  free(events);
+  free(heat);
+  free(owned_name);
+  maze_text.data = maze_data;
+  free(overlay);
+  maze_text_close(&maze_text);
 
   return 0;
 }
@@ -0,0 +1,301 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      result_cache.c
+ * @brief     On-disk cache of solutions and images, keyed by maze content
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "maze_io.h"
+#include "result_cache.h"
+
+/// Prefix of entries still being written, never served
+#define PARTIAL_PREFIX ".partial-"
+
+/// Holds the running total of the entries' bytes and when it was last
+/// counted from the directory
+#define TOTAL_FILE ".total"
+
+/// Seconds after which a partial entry is taken as left by an interrupted
+/// store and removed, and after which the total is recounted anyway
+#define STALE_SECONDS 3600
+
+/// An entry found while enforcing the cap
+typedef struct cache_file {
+  char* name;
+  off_t size;
+  struct timespec mtime;
+} cache_file_t;
+
+/**
+ * @brief     Opens the cache in dir, or MAZE_CACHE_DIR if dir is NULL
+ * Returns 0 if the cache is usable, or -1 if it is disabled or cannot be
+ * created (the caller then runs uncached).
+ */
+int result_cache_open(result_cache_t* cache, const char* dir){
+  const char* cap = getenv("MAZE_CACHE_MB");
+
+  cache->dir = NULL;
+  cache->cap = (size_t) RESULT_CACHE_MB << 20;
+  if(dir == NULL) dir = getenv("MAZE_CACHE_DIR");
+  if(dir == NULL || dir[0] == '\0') return -1;
+  if(cap != NULL && atol(cap) > 0) cache->cap = (size_t) atol(cap) << 20;
+
+  if(mkdir(dir, 0777) != 0 && errno != EEXIST){
+    perror("Warning: cache directory unavailable");
+    return -1;
+  }
+  cache->dir = strdup(dir);
+  return cache->dir != NULL ? 0 : -1;
+}
+
+/**
+ * @brief     Releases a cache opened with result_cache_open
+ */
+void result_cache_close(result_cache_t* cache){
+  free(cache->dir);
+  cache->dir = NULL;
+}
+
+/**
+ * @brief     Returns the malloc'd path of an entry, mode made file name safe
+ */
+static char* entry_path(const result_cache_t* cache, uint64_t hash, const char* mode){
+  size_t length = strlen(cache->dir) + strlen(mode) + 32;
+  char* path = malloc(length);
+  char* c;
+
+  if(path == NULL) return NULL;
+  snprintf(path, length, "%s/%016llx-%s", cache->dir, (unsigned long long) hash, mode);
+  for(c = path + strlen(cache->dir) + 1; *c; c++){
+    if(*c == '/' || *c == ' ') *c = '_';
+  }
+  return path;
+}
+
+/**
+ * @brief     Copies everything from one descriptor to another
+ * Uses copy_file_range, which shares extents on filesystems that can and
+ * copies server side on NFS 4.2, falling back to read and write.
+ */
+static int copy_fd(int from, int to){
+  char buffer[1 << 16];
+  ssize_t got;
+
+  while((got = copy_file_range(from, NULL, to, NULL, 1 << 30, 0)) > 0)
+    ;
+  if(got == 0) return 0;
+  if(errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP)
+    return -1;
+
+  while((got = read(from, buffer, sizeof(buffer))) > 0){
+    char* at = buffer;
+    while(got > 0){
+      ssize_t put = write(to, at, got);
+      if(put < 0) return -1;
+      at += put;
+      got -= put;
+    }
+  }
+  return got == 0 ? 0 : -1;
+}
+
+/**
+ * @brief     Copies the entry for hash and mode to dest ("-" for stdout)
+ * Outputs are copied rather than hard linked because the maze programs
+ * rewrite their output files in place, which would change the entry too.
+ * Returns 0 on a hit, -1 on a miss or error.
+ */
+int result_cache_fetch(const result_cache_t* cache, uint64_t hash, const char* mode,
+                       const char* dest){
+  char* path = entry_path(cache, hash, mode);
+  int from, to, status;
+
+  if(path == NULL) return -1;
+  from = open(path, O_RDONLY);
+  if(from < 0){
+    free(path);
+    return -1;
+  }
+  // A hit makes the entry the most recently used
+  futimens(from, NULL);
+  free(path);
+
+  if(maze_is_stdio(dest)){
+    fflush(stdout);
+    to = STDOUT_FILENO;
+  }else{
+    to = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  }
+  if(to < 0){
+    close(from);
+    return -1;
+  }
+  status = copy_fd(from, to);
+  close(from);
+  if(to != STDOUT_FILENO && close(to) != 0) status = -1;
+  return status;
+}
+
+/**
+ * @brief     qsort comparison putting the least recently used entry first
+ */
+static int compare_age(const void* a, const void* b){
+  const cache_file_t* fa = a;
+  const cache_file_t* fb = b;
+  if(fa->mtime.tv_sec != fb->mtime.tv_sec) return fa->mtime.tv_sec < fb->mtime.tv_sec ? -1 : 1;
+  if(fa->mtime.tv_nsec != fb->mtime.tv_nsec) return fa->mtime.tv_nsec < fb->mtime.tv_nsec ? -1 : 1;
+  return 0;
+}
+
+/**
+ * @brief     Evicts least recently used entries until the cache fits its cap
+ * The entry just stored (keep) is never evicted, even if it alone is over.
+ * Partial entries older than STALE_SECONDS are removed. Returns the bytes
+ * left in the entries.
+ */
+static size_t enforce_cap(const result_cache_t* cache, const char* keep){
+  DIR* dir = opendir(cache->dir);
+  cache_file_t* files = NULL;
+  size_t count = 0, capacity = 0, total = 0, i;
+  time_t now = time(NULL);
+  struct dirent* item;
+  struct stat kept;
+
+  if(dir == NULL) return 0;
+  if(fstatat(dirfd(dir), keep, &kept, 0) == 0) total = kept.st_size;
+  while((item = readdir(dir)) != NULL){
+    struct stat st;
+    int partial = strncmp(item->d_name, PARTIAL_PREFIX, strlen(PARTIAL_PREFIX)) == 0;
+    if((item->d_name[0] == '.' && !partial) || strcmp(item->d_name, keep) == 0) continue;
+    if(fstatat(dirfd(dir), item->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode)) continue;
+    // A store still copying is counted once it is renamed into place
+    if(partial){
+      if(st.st_mtime < now - STALE_SECONDS)
+        unlinkat(dirfd(dir), item->d_name, 0);
+      continue;
+    }
+    if(count == capacity){
+      capacity = capacity ? capacity * 2 : 64;
+      cache_file_t* grown = realloc(files, capacity * sizeof(cache_file_t));
+      if(grown == NULL) break;
+      files = grown;
+    }
+    files[count].name = strdup(item->d_name);
+    files[count].size = st.st_size;
+    files[count].mtime = st.st_mtim;
+    total += st.st_size;
+    count++;
+  }
+
+  if(total > cache->cap){
+    qsort(files, count, sizeof(cache_file_t), compare_age);
+    for(i = 0; i < count && total > cache->cap; i++){
+      if(files[i].name != NULL && unlinkat(dirfd(dir), files[i].name, 0) == 0)
+        total -= files[i].size;
+    }
+  }
+  for(i = 0; i < count; i++)
+    free(files[i].name);
+  free(files);
+  closedir(dir);
+  return total;
+}
+
+/**
+ * @brief     Adds change bytes to the cache's running total
+ * The directory is only scanned, to evict entries, when the total goes
+ * over the cap, when it is missing, or STALE_SECONDS after the last scan,
+ * so a store costs O(1) rather than a pass over every entry. Stores from
+ * several processes take turns on a lock of the total file.
+ */
+static void add_to_total(const result_cache_t* cache, const char* keep, long long change){
+  size_t length = strlen(cache->dir) + sizeof(TOTAL_FILE) + 2;
+  char* path = malloc(length);
+  unsigned long long total = 0;
+  long long scanned = 0;
+  char text[64];
+  ssize_t got;
+  int fd;
+
+  if(path == NULL) return;
+  snprintf(path, length, "%s/" TOTAL_FILE, cache->dir);
+  fd = open(path, O_RDWR | O_CREAT, 0644);
+  free(path);
+  if(fd < 0){
+    enforce_cap(cache, keep);
+    return;
+  }
+  flock(fd, LOCK_EX);
+
+  got = pread(fd, text, sizeof(text) - 1, 0);
+  text[got > 0 ? got : 0] = '\0';
+  if(sscanf(text, "%llu %lld", &total, &scanned) == 2
+     && (change >= 0 || total >= (unsigned long long) -change)
+     && total + change <= cache->cap && time(NULL) - scanned < STALE_SECONDS){
+    total += change;
+  }else{
+    total = enforce_cap(cache, keep);
+    scanned = time(NULL);
+  }
+
+  got = snprintf(text, sizeof(text), "%llu %lld\n", total, scanned);
+  if(ftruncate(fd, 0) != 0 || pwrite(fd, text, got, 0) != got)
+    perror("Warning: cache total not saved");
+  close(fd);
+}
+
+/**
+ * @brief     Stores the file src as the entry for hash and mode
+ * The copy is written under a temporary name and renamed into place, so
+ * readers never see a partial entry. Returns 0 on success, -1 on error.
+ */
+int result_cache_store(const result_cache_t* cache, uint64_t hash, const char* mode,
+                       const char* src){
+  char* path = entry_path(cache, hash, mode);
+  size_t length = strlen(cache->dir) + sizeof(PARTIAL_PREFIX) + 8;
+  char* partial = malloc(length);
+  int from = -1, to = -1, status = -1;
+  struct stat replaced, stored;
+
+  if(path == NULL || partial == NULL) goto done;
+  snprintf(partial, length, "%s/" PARTIAL_PREFIX "XXXXXX", cache->dir);
+  from = open(src, O_RDONLY);
+  to = mkstemp(partial);
+  if(from < 0 || to < 0) goto done;
+
+  status = copy_fd(from, to);
+  fchmod(to, 0644);
+  if(close(to) != 0) status = -1;
+  to = -1;
+  // An entry stored again replaces the old file, whose bytes leave the total
+  if(stat(path, &replaced) != 0) replaced.st_size = 0;
+  if(status == 0 && stat(partial, &stored) != 0) status = -1;
+  if(status == 0) status = rename(partial, path);
+  if(status != 0) unlink(partial);
+  else add_to_total(cache, strrchr(path, '/') + 1,
+                    (long long) stored.st_size - replaced.st_size);
+
+done:
+  if(from >= 0) close(from);
+  if(to >= 0){
+    close(to);
+    unlink(partial);
+  }
+  free(path);
+  free(partial);
+  return status;
+}
+/** @} */
@@ -0,0 +1,53 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      result_cache.h
+ * @brief     On-disk cache of solutions and images, keyed by maze content
+ *
+ * Every entry is a file named after the maze_hash of the maze text and a
+ * mode string describing how the output was made (solver, render options,
+ * output compression). A hit copies the stored file to the output, so the
+ * maze is neither parsed nor solved. Entries are used in least recently
+ * used order: a hit refreshes the entry's modification time, and storing
+ * an entry evicts the oldest ones until the directory is under its cap.
+ * A running total of the entries' size is kept in the directory, so it is
+ * only scanned when a store takes the total over the cap, or an hour after
+ * the last scan to clear out partial entries left by interrupted stores.
+ *
+ * The cache is enabled with --cache <dir> or the MAZE_CACHE_DIR
+ * environment variable; MAZE_CACHE_MB sets the cap.
+ */
+
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Cache size used when MAZE_CACHE_MB is not set
+#define RESULT_CACHE_MB 1024
+
+/// An open cache directory
+typedef struct result_cache {
+  char* dir;
+  size_t cap;
+} result_cache_t;
+
+/// Opens the cache in dir, or MAZE_CACHE_DIR if dir is NULL; -1 if disabled
+int result_cache_open(result_cache_t* cache, const char* dir);
+
+/// Copies the entry for hash and mode to dest ("-" for stdout); 0 on a hit
+int result_cache_fetch(const result_cache_t* cache, uint64_t hash, const char* mode,
+                       const char* dest);
+
+/// Stores the file src as the entry for hash and mode, then enforces the cap
+int result_cache_store(const result_cache_t* cache, uint64_t hash, const char* mode,
+                       const char* src);
+
+/// Releases a cache opened with result_cache_open
+void result_cache_close(result_cache_t* cache);
+
+#endif
+/** @} */
@@ -1,7 +1,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include "maze_types.h"
+#include "maze_io.h"
+#include "maze_trace.h"
+#include "maze_cache.h"
+#include "result_cache.h"
+#include "bucket_queue.h"
+#include "bitbfs.h"
+#include "maze_route.h"
+#include "lpa.h"
+#include "hpa.h"
+#include "verify.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <signal.h>
 #include <semaphore.h>
 
 #define DEBUG 0
@@ -37,10 +53,130 @@ typedef struct cursor_alt {
 // The maze
 maze_t maze;
 
+/// Solvers, chosen on the command line or with solver= in the daemon
+typedef enum {
+  SOLVER_RIGHT,
+  SOLVER_BFS,
+  SOLVER_DIJKSTRA,
+  SOLVER_ASTAR,
+  SOLVER_NEAREST,
+  SOLVER_BITBFS,
+  SOLVER_HPA
+} solver_t;
+
+static const char* solver_names[] = {"right", "bfs", "dijkstra", "astar", "nearest", "bitbfs",
+                                     "hpa"};
+static const char* solver_titles[] = {"Right-Hand", "BFS", "Dijkstra", "A*",
+                                      "multi-source BFS", "bitboard BFS", "HPA*"};
+
+// Index loaded with --index for the HPA* solver
+hpa_index_t hpa_index;
+
+// Total terrain cost of the path found by the weighted solvers, or its
+// length in steps for the bitboard BFS
+unsigned long long path_cost = 0;
+
 sem_t type_sem;
 sem_t thread_sem;
 pthread_mutex_t type_lock;
 
+/// Why a solve ended early, the first reason set wins
+typedef enum {
+  STOP_NONE,
+  STOP_GOAL,
+  STOP_TIMEOUT,
+  STOP_VISITS,
+  /// A solver ran out of memory, nothing it marked is usable
+  STOP_FAILED
+} stop_t;
+
+// Shared cancellation flag, checked by every solver step
+volatile int stop_reason = STOP_NONE;
+
+// Cells visited so far and the budgets set with --timeout and --max-visits
+unsigned long visits = 0;
+unsigned long max_visits = 0;
+double timeout = 0;
+
+// The progress monitor sleeps on this until the solve is over
+pthread_mutex_t monitor_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t monitor_cond;
+int solve_done = 0;
+
+/**
+ * @brief     Asks every solver thread to stop, keeping the first reason
+ */
+void cancel_solve(stop_t reason){
+  __sync_bool_compare_and_swap(&stop_reason, STOP_NONE, reason);
+}
+
+/**
+ * @brief     Counts visited cells against the --max-visits budget
+ */
+static inline void count_visits(unsigned long cells){
+  unsigned long count = __atomic_add_fetch(&visits, cells, __ATOMIC_RELAXED);
+  if(max_visits && count >= max_visits)
+    cancel_solve(STOP_VISITS);
+}
+
+/**
+ * @brief     Counts one visited cell against the --max-visits budget
+ */
+static inline void count_visit(){
+  count_visits(1);
+}
+
+/**
+ * @brief     Returns the seconds since start
+ */
+double seconds_since(const struct timespec* start){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief     Progress monitor thread
+ * Prints the visit count and rate to stderr once a second after the first
+ * second, and cancels the solve when the --timeout deadline passes.
+ */
+void* monitor_solve(void* arg){
+  struct timespec start, wake;
+  unsigned long last_visits = 0;
+  double last = 0;
+  (void) arg;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_mutex_lock(&monitor_lock);
+  while(!solve_done){
+    // Sleep a second, or until the deadline if that comes first
+    double elapsed = seconds_since(&start);
+    double next = (long) elapsed + 1;
+    if(timeout > elapsed && timeout < next) next = timeout;
+    wake.tv_sec = start.tv_sec + (time_t) next;
+    wake.tv_nsec = start.tv_nsec + (long) ((next - (long) next) * 1e9);
+    if(wake.tv_nsec >= 1000000000){
+      wake.tv_sec++;
+      wake.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&monitor_cond, &monitor_lock, &wake);
+    if(solve_done) break;
+
+    elapsed = seconds_since(&start);
+    if(timeout > 0 && elapsed >= timeout)
+      cancel_solve(STOP_TIMEOUT);
+    if(elapsed >= 1 && (long) elapsed > (long) last){
+      unsigned long count = __atomic_load_n(&visits, __ATOMIC_RELAXED);
+      fprintf(stderr, "%.0fs: %lu cells visited (%.0f cells/s)\n", elapsed, count,
+              (count - last_visits) / (elapsed - last));
+      last_visits = count;
+      last = elapsed;
+    }
+  }
+  pthread_mutex_unlock(&monitor_lock);
+  return NULL;
+}
+
 /**
  * @brief     Returns the cell indices on the cursor's right
  */
@@ -105,11 +241,13 @@ void turn_left(cursor_t *me){
 void go_right(cursor_t *me, int *next, int been_there){
 
   // Set the cell component we are leaving, as long as we aren't at the start
-  if(maze.cells[me->y][me->x].type != START) {
+  maze_cell_t* leaving = maze_at(&maze, me->x, me->y);
+  if(leaving->type != START) {
     if(been_there)
-      maze.cells[me->y][me->x].type = WRONG;
+      leaving->type = WRONG;
     else
-      maze.cells[me->y][me->x].type = VISIT;
+      leaving->type = VISIT;
+    TRACE_CELL(me->x, me->y, leaving->type);
   }
 
   // Turn right
@@ -159,60 +297,64 @@ int right_hand_maze_solver(){
   int goal_found = 1;
   int moved = 0;
 
-  // Loop until we reach the goal  
-  while(maze.cells[me.y][me.x].type != GOAL){
+  // Loop until we reach the goal or are cancelled
+  while(maze_at(&maze, me.x, me.y)->type != GOAL){
+    if(stop_reason != STOP_NONE){
+      goal_found = 0;
+      break;
+    }
+
     // Check the cell to the right of the current facing direction
     on_right = right_hand(&me);
     
-    // Check if cell to right is within the maze
-    if(on_right[0] > -1 && on_right[0] < maze.width && 
-       on_right[1] > -1 && on_right[1] < maze.height) {
-
-      // Determine behavior based on cell contents
-      switch(maze.cells[on_right[1]][on_right[0]].type){
-        case WALL:
-        case START:
-          // Turn left to check the next cell
-          if(DEBUG) printf("Found wall at (%d,%d) turning left.\n",on_right[0],on_right[1]);
-          turn_left(&me);
-          moved = 0;
-          break;
-        case GOAL:
-        case BLANK:
-          // Empty space or goal, go right updating cell we just vacated
-          if(DEBUG) printf("Found space at (%d,%d)\n",on_right[0],on_right[1]);
-          go_right(&me, on_right, 0);
-          moved = 1;
-          break;
-        case VISIT:
-          // Current cell is dead-end, move back and update cell we just vacated
-          go_right(&me, on_right, 1);
-          moved = 1;
-          break;
-        case WRONG:
-        case PATH:
-          // Loop detected
-          // Turn left to check the next cell
-          if(DEBUG) printf("Loop at (%d,%d) turning left.\n",on_right[0],on_right[1]);
-          turn_left(&me);
-          moved = 0;
-          break;
-        default:
-          perror("Invalid maze component");
-          exit(0);
-      }
-
-      if(!moved && me.facing == me.face_origin) {
-        // We've gone in a complete circle in the current cell, 
-        // Goal is unreachable
-        goal_found = 0;
+    // Determine behavior based on cell contents, terrain costs are ignored.
+    // Off the edge of the maze is the sentinel ring, which is all wall.
+    maze_component_t right_type = maze_at(&maze, on_right[0], on_right[1])->type;
+    if(IS_TERRAIN(right_type))
+      right_type = BLANK;
+    switch(right_type){
+      case WALL:
+      case START:
+        // Turn left to check the next cell
+        if(DEBUG) printf("Found wall at (%d,%d) turning left.\n",on_right[0],on_right[1]);
+        turn_left(&me);
+        moved = 0;
         break;
-      }
-    } else {
-      // Turn left to attempt to 're-enter' the maze
-      turn_left(&me);
-      moved = 0;
+      case GOAL:
+      case BLANK:
+        // Empty space or goal, go right updating cell we just vacated
+        if(DEBUG) printf("Found space at (%d,%d)\n",on_right[0],on_right[1]);
+        go_right(&me, on_right, 0);
+        count_visit();
+        moved = 1;
+        break;
+      case VISIT:
+        // Current cell is dead-end, move back and update cell we just vacated.
+        // The cell was counted when first entered, backing up is not a visit
+        go_right(&me, on_right, 1);
+        moved = 1;
+        break;
+      case WRONG:
+      case PATH:
+        // Loop detected
+        // Turn left to check the next cell
+        if(DEBUG) printf("Loop at (%d,%d) turning left.\n",on_right[0],on_right[1]);
+        turn_left(&me);
+        moved = 0;
+        break;
+      default:
+        perror("Invalid maze component");
+        exit(0);
     }
+
+    if(!moved && me.facing == me.face_origin) {
+      // We've gone in a complete circle in the current cell, 
+      // Goal is unreachable
+      goal_found = 0;
+      free(on_right);
+      break;
+    }
+    free(on_right);
   }
 
   if(goal_found){
@@ -222,7 +364,10 @@ int right_hand_maze_solver(){
     int i, j;
     for(i = 0; i < maze.height; i++){
       for(j = 0; j < maze.width; j++){
-        if(maze.cells[i][j].type == VISIT) maze.cells[i][j].type = PATH;
+        if(maze_at(&maze, j, i)->type == VISIT){
+          maze_at(&maze, j, i)->type = PATH;
+          TRACE_CELL(j, i, PATH);
+        }
       }
     }
   }
@@ -236,45 +381,55 @@ int right_hand_maze_solver(){
 void set_cell_type(int y, int x, maze_component_t type){
   pthread_mutex_lock(&type_lock);
   sem_wait(&type_sem);
-  maze.cells[y][x].type = type;
+  maze_at(&maze, x, y)->type = type;
   sem_post(&type_sem);
+  TRACE_CELL(x, y, type);
   pthread_mutex_unlock(&type_lock);
 }
 
 /**
  * @brief      Recursive breadth-first search algorithm
  */
-void bfs_recur(void* params){
+void* bfs_recur(void* params){
   cursor2_t* node = (cursor2_t*) params;
   int current_y = node->y;
   int current_x = node->x;
   dir_t went = node->facing;
 
-  maze_component_t current_type = maze.cells[current_y][current_x].type;
+  maze_component_t current_type = maze_at(&maze, current_x, current_y)->type;
 
+  if(current_type == GOAL)
+    cancel_solve(STOP_GOAL);
   if(current_type == WALL || current_type == START || current_type == GOAL || current_type == VISIT){
     node->type = current_type;
-    return;
+    return NULL;
+  }
+
+  // Another thread found the goal or the budget ran out, leave this branch
+  if(stop_reason != STOP_NONE){
+    node->type = current_type;
+    return NULL;
   }
 
   set_cell_type(current_y,current_x,VISIT);
+  count_visit();
 
-  cursor2_t* east_params = malloc(sizeof(cursor2_t));
+  cursor2_t east_node, *east_params = &east_node;
   east_params->y = current_y;
   east_params->x = current_x+1;
   east_params->facing = EAST;
 
-  cursor2_t* south_params = malloc(sizeof(cursor2_t));
+  cursor2_t south_node, *south_params = &south_node;
   south_params->y = current_y+1;
   south_params->x = current_x;
   south_params->facing = SOUTH;
 
-  cursor2_t* west_params = malloc(sizeof(cursor2_t));
+  cursor2_t west_node, *west_params = &west_node;
   west_params->y = current_y;
   west_params->x = current_x-1;
   west_params->facing = WEST;
 
-  cursor2_t* north_params = malloc(sizeof(cursor2_t));
+  cursor2_t north_node, *north_params = &north_node;
   north_params->y = current_y-1;
   north_params->x = current_x;
   north_params->facing = NORTH;
@@ -309,7 +464,7 @@ void bfs_recur(void* params){
          north_params->type == PATH || north_params->type == GOAL) {
         set_cell_type(current_y,current_x,PATH);
         node->type = PATH;
-        return; // Found a path/goal
+        return NULL; // Found a path/goal
       }
       break;
     case SOUTH:
@@ -337,7 +492,7 @@ void bfs_recur(void* params){
          west_params->type == PATH || west_params->type == GOAL) {
         set_cell_type(current_y,current_x,PATH);
         node->type = PATH;
-        return; // Found a path/goal
+        return NULL; // Found a path/goal
       }
       break;
     case EAST:
@@ -365,7 +520,7 @@ void bfs_recur(void* params){
          north_params->type == PATH || north_params->type == GOAL) {
         set_cell_type(current_y,current_x,PATH);
         node->type = PATH;
-        return; // Found a path/goal
+        return NULL; // Found a path/goal
       }
       break;
     case WEST:
@@ -393,7 +548,7 @@ void bfs_recur(void* params){
          north_params->type == PATH || north_params->type == GOAL) {
         set_cell_type(current_y,current_x,PATH);
         node->type = PATH;
-        return; // Found a path/goal
+        return NULL; // Found a path/goal
       }
       break;
     default:
@@ -404,7 +559,7 @@ void bfs_recur(void* params){
   // No path found set to bad path and return as such
   set_cell_type(current_y,current_x,WRONG);
   node->type = WRONG;
-  return;
+  return NULL;
 }
 
 /**
@@ -415,22 +570,22 @@ int bfs_maze_solver(){
   int startY = maze.startY;
   int startX = maze.startX;
 
-  cursor2_t* east_params = malloc(sizeof(cursor2_t));
+  cursor2_t east_node, *east_params = &east_node;
   east_params->y = startY;
   east_params->x = startX+1;
   east_params->facing = EAST;
 
-  cursor2_t* south_params = malloc(sizeof(cursor2_t));
+  cursor2_t south_node, *south_params = &south_node;
   south_params->y = startY+1;
   south_params->x = startX;
   south_params->facing = SOUTH;
 
-  cursor2_t* west_params = malloc(sizeof(cursor2_t));
+  cursor2_t west_node, *west_params = &west_node;
   west_params->y = startY;
   west_params->x = startX-1;
   west_params->facing = WEST;
 
-  cursor2_t* north_params = malloc(sizeof(cursor2_t));
+  cursor2_t north_node, *north_params = &north_node;
   north_params->y = startY-1;
   north_params->x = startX;
   north_params->facing = NORTH;
@@ -472,35 +627,1136 @@ int bfs_maze_solver(){
 }
 
 /**
- * @brief     Sets the maze component at the given indices with the correct
- * maze component.
+ * @brief     Manhattan distance to the goal, never more than the real cost
+ */
+static inline unsigned long long goal_distance(int x, int y){
+  return (unsigned long long) abs(x - maze.goalX) + abs(y - maze.goalY);
+}
+
+/**
+ * @brief     Cheapest path solver over weighted terrain - Dijkstra or A*
+ * Entering a cell costs CELL_COST of its type. Each cell is settled once,
+ * in order of cost (plus the distance to the goal for A*), and remembers
+ * the cell it was reached from in its parent field. Only the path is
+ * marked in the solution, so the terrain around it is kept for render.
+ * Returns non-zero if the goal was found, its cost is left in path_cost,
+ * or -1 if out of memory.
  */
-void set_maze_component(maze_cell_t* cell, char component){
+int weighted_maze_solver(int use_heuristic){
+  size_t cell_count = (size_t) maze.width * maze.height;
+  uint32_t* cost;
+  bucket_queue_t queue;
+  int goal_found = 0;
+  int k;
+
+  if(cell_count > UINT32_MAX){
+    fprintf(stderr,"Maze too large for the weighted solvers\n");
+    return 0;
+  }
+  cost = malloc(cell_count * sizeof(uint32_t));
+  if(cost == NULL){
+    perror("Out of memory");
+    return -1;
+  }
+  memset(cost, 0xff, cell_count * sizeof(uint32_t));
+  memset(&queue, 0, sizeof(queue));
+
+  uint32_t start = (uint32_t) maze.startY * maze.width + maze.startX;
+  cost[start] = 0;
+  queue_clear(&queue, use_heuristic ? goal_distance(maze.startX, maze.startY) : 0);
+  queue_push(&queue, queue.key, start);
+
+  while(queue.size > 0 && stop_reason == STOP_NONE){
+    uint32_t at = queue_pop(&queue);
+    int x = at % maze.width;
+    int y = at / maze.width;
+    maze_cell_t* cell = maze_at(&maze, x, y);
+
+    // Stale entries are left behind when a cheaper route is found
+    if(cell->state == PROCESSED) continue;
+    cell->state = PROCESSED;
+    if(cell->type == GOAL){
+      goal_found = 1;
+      break;
+    }
+    count_visit();
+    TRACE_CELL(x, y, VISIT);
+
+    static const int step[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+    for(k = 0; k < 4; k++){
+      int next_x = x + step[k][0];
+      int next_y = y + step[k][1];
+      // No bounds check, past the edge is the sentinel ring of walls
+      maze_cell_t* next = maze_at(&maze, next_x, next_y);
+      if(next->type == WALL || next->state == PROCESSED)
+        continue;
+
+      uint32_t index = (uint32_t) next_y * maze.width + next_x;
+      uint32_t reached = cost[at] + CELL_COST(next->type);
+      if(reached >= cost[index])
+        continue;
+      cost[index] = reached;
+      next->parent[0] = x;
+      next->parent[1] = y;
+      if(queue_push(&queue, reached + (use_heuristic ? goal_distance(next_x, next_y) : 0),
+                    index) != 0){
+        perror("Out of memory");
+        cancel_solve(STOP_FAILED);
+        break;
+      }
+    }
+  }
+
+  if(goal_found){
+    /// Walk back from the goal marking the path
+    int x = maze.goalX;
+    int y = maze.goalY;
+    path_cost = cost[(size_t) y * maze.width + x];
+    maze_cell_t* cell = maze_at(&maze, x, y);
+    while(cell->parent[0] >= 0){
+      x = cell->parent[0];
+      y = cell->parent[1];
+      cell = maze_at(&maze, x, y);
+      if(cell->type == START) break;
+      cell->type = PATH;
+      TRACE_CELL(x, y, PATH);
+    }
+  }
 
-  // Initialize BFS components of cell
-  cell->parent[0] = -1;
-  cell->parent[1] = -1;
-  cell->state = UNDISCOVERED;
+  queue_free(&queue);
+  free(cost);
+  return stop_reason == STOP_FAILED ? -1 : goal_found;
+}
 
-  // Set cell component type
-  switch(component){
-    case WALL:
-      cell->type = WALL;
-      return;
-    case BLANK:
-      cell->type = BLANK;
-      return;
-    case START:
-      cell->type = START;
-      return;
-    case GOAL:
-      cell->type = GOAL;
-      return;
+/*
+ * Multi-source nearest goal search, solve --nearest
+ *
+ * One breadth-first search seeded from every goal at once labels each open
+ * cell with the neighbour one step closer to its nearest goal (its parent
+ * field). Following those links from every start gives each start a
+ * shortest path to its nearest goal, so a maze with many agents and many
+ * exits is solved in a single pass instead of one solve per pair. Terrain
+ * costs are ignored, as in the other BFS.
+ *
+ * The search runs level by level on all cores: the frontier is split
+ * between threads, a thread claims a cell by moving its state from
+ * UNDISCOVERED to DISCOVERED with a compare and swap, and the cells each
+ * thread claims are gathered into the next frontier between two barriers.
+ */
+
+#define NEAREST_THREADS 64
+
+/// Cells a search thread claimed for the next level
+typedef struct claimed {
+  uint32_t* cells;
+  size_t count;
+  size_t capacity;
+  int failed;
+} claimed_t;
+
+static uint32_t* nearest_frontier;
+static size_t nearest_size;
+static int nearest_threads;
+static int nearest_done;
+static claimed_t nearest_claimed[NEAREST_THREADS];
+static pthread_barrier_t nearest_barrier;
+
+/**
+ * @brief     Expands one thread's share of every frontier until the search ends
+ */
+void* nearest_worker(void* arg){
+  static const int step[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+  int id = (int) (intptr_t) arg;
+  claimed_t* mine = &nearest_claimed[id];
+  size_t i;
+  int k;
+
+  for(;;){
+    size_t begin = nearest_size * id / nearest_threads;
+    size_t end = nearest_size * (id + 1) / nearest_threads;
+
+    mine->count = 0;
+    for(i = begin; i < end && !mine->failed; i++){
+      uint32_t at = nearest_frontier[i];
+      int x = at % maze.width;
+      int y = at / maze.width;
+      for(k = 0; k < 4; k++){
+        int next_x = x + step[k][0];
+        int next_y = y + step[k][1];
+        maze_cell_t* next = maze_at(&maze, next_x, next_y);
+        if(next->type == WALL || next->state != UNDISCOVERED
+           || !__sync_bool_compare_and_swap(&next->state, UNDISCOVERED, DISCOVERED))
+          continue;
+        next->parent[0] = x;
+        next->parent[1] = y;
+        TRACE_CELL(next_x, next_y, VISIT);
+        if(mine->count == mine->capacity){
+          size_t capacity = mine->capacity ? mine->capacity * 2 : 1024;
+          uint32_t* grown = realloc(mine->cells, capacity * sizeof(uint32_t));
+          if(grown == NULL){
+            mine->failed = 1;
+            break;
+          }
+          mine->cells = grown;
+          mine->capacity = capacity;
+        }
+        mine->cells[mine->count++] = (uint32_t) next_y * maze.width + next_x;
+      }
+    }
+    count_visits(end - begin);
+
+    /// Thread 0 gathers the next frontier while the others wait
+    pthread_barrier_wait(&nearest_barrier);
+    if(id == 0){
+      size_t size = 0;
+      for(k = 0; k < nearest_threads; k++){
+        if(nearest_claimed[k].failed){
+          perror("Out of memory");
+          cancel_solve(STOP_FAILED);
+        }
+        memcpy(nearest_frontier + size, nearest_claimed[k].cells,
+               nearest_claimed[k].count * sizeof(uint32_t));
+        size += nearest_claimed[k].count;
+      }
+      nearest_size = size;
+      nearest_done = size == 0 || stop_reason != STOP_NONE;
+    }
+    pthread_barrier_wait(&nearest_barrier);
+    if(nearest_done) break;
+  }
+  return NULL;
+}
+
+/**
+ * @brief     Paths every start to its nearest goal, see above
+ * Prints where each start ends up to info unless it is NULL. Returns
+ * non-zero if any start reaches a goal, or -1 if out of memory.
+ */
+int nearest_maze_solver(FILE* info){
+  size_t cell_count = (size_t) maze.width * maze.height;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  pthread_t threads[NEAREST_THREADS];
+  int started[NEAREST_THREADS];
+  int reached = 0;
+  int x, y, k;
+
+  if(cell_count > UINT32_MAX){
+    fprintf(stderr,"Maze too large for the nearest goal search\n");
+    return 0;
+  }
+  // A frontier never holds a cell twice, so it is at most the whole maze
+  nearest_frontier = malloc(cell_count * sizeof(uint32_t));
+  if(nearest_frontier == NULL){
+    perror("Out of memory");
+    return -1;
+  }
+
+  /// Seed the search with every goal
+  nearest_size = 0;
+  for(y = 0; y < maze.height; y++){
+    for(x = 0; x < maze.width; x++){
+      maze_cell_t* cell = maze_at(&maze, x, y);
+      if(cell->type == GOAL){
+        cell->state = DISCOVERED;
+        nearest_frontier[nearest_size++] = (uint32_t) y * maze.width + x;
+      }
+    }
+  }
+
+  nearest_threads = cores < 1 ? 1 : cores > NEAREST_THREADS ? NEAREST_THREADS : (int) cores;
+  nearest_done = nearest_size == 0;
+  memset(nearest_claimed, 0, sizeof(nearest_claimed));
+  if(!nearest_done){
+    pthread_barrier_init(&nearest_barrier, NULL, nearest_threads);
+    for(k = 1; k < nearest_threads; k++)
+      started[k] = pthread_create(&threads[k], NULL, nearest_worker, (void*) (intptr_t) k) == 0;
+    // The barrier waits for every thread, so all of them must be running
+    for(k = 1; k < nearest_threads; k++){
+      if(!started[k]){
+        perror("Error: failed to start search threads");
+        exit(0);
+      }
+    }
+    nearest_worker((void*) 0);
+    for(k = 1; k < nearest_threads; k++)
+      pthread_join(threads[k], NULL);
+    pthread_barrier_destroy(&nearest_barrier);
+  }
+  for(k = 0; k < nearest_threads; k++)
+    free(nearest_claimed[k].cells);
+  free(nearest_frontier);
+  if(stop_reason == STOP_FAILED)
+    return -1;
+
+  /// Follow the links from every start to its goal, marking the paths
+  for(y = 0; y < maze.height; y++){
+    for(x = 0; x < maze.width; x++){
+      maze_cell_t* cell = maze_at(&maze, x, y);
+      if(cell->type != START) continue;
+      if(cell->state == UNDISCOVERED){
+        // A stopped search may simply not have got there yet
+        if(info) fprintf(info,"Start (%d,%d): %s\n", x, y,
+                         stop_reason != STOP_NONE ? "not reached before stop" : "no goal reachable");
+        continue;
+      }
+      int at_x = x, at_y = y;
+      unsigned long steps = 0;
+      while(cell->type != GOAL){
+        at_x = cell->parent[0];
+        at_y = cell->parent[1];
+        cell = maze_at(&maze, at_x, at_y);
+        steps++;
+        if(cell->type != GOAL && cell->type != START){
+          cell->type = PATH;
+          TRACE_CELL(at_x, at_y, PATH);
+        }
+      }
+      if(info) fprintf(info,"Start (%d,%d) -> goal (%d,%d): %lu steps\n", x, y, at_x, at_y, steps);
+      reached++;
+    }
+  }
+  return reached > 0;
+}
+
+/**
+ * @brief     Runs the selected solver on the global maze under the monitor
+ * Resets the cancellation state first, so it can be called repeatedly.
+ * Returns non-zero if the goal was found.
+ */
+int run_solver(solver_t solver, FILE* info){
+  pthread_t monitor;
+  pthread_condattr_t monitor_attr;
+  int monitored;
+  int found;
+
+  stop_reason = STOP_NONE;
+  visits = 0;
+  solve_done = 0;
+
+  /// Watch the solve for progress output and the time limit
+  pthread_condattr_init(&monitor_attr);
+  pthread_condattr_setclock(&monitor_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&monitor_cond, &monitor_attr);
+  pthread_condattr_destroy(&monitor_attr);
+  // Without the monitor (no memory for its thread) there is no progress or time limit
+  monitored = pthread_create(&monitor, NULL, monitor_solve, NULL) == 0;
+
+  path_cost = 0;
+  switch(solver){
+    case SOLVER_BFS:
+      found = bfs_maze_solver();
+      break;
+    case SOLVER_DIJKSTRA:
+    case SOLVER_ASTAR:
+      found = weighted_maze_solver(solver == SOLVER_ASTAR);
+      break;
+    case SOLVER_NEAREST:
+      found = nearest_maze_solver(info);
+      break;
+    case SOLVER_BITBFS:
+    case SOLVER_HPA:
+      if(solver == SOLVER_BITBFS)
+        found = bitbfs_solve(&maze, 1, &stop_reason, &path_cost, count_visits);
+      else
+        found = hpa_solve(&maze, &hpa_index, &stop_reason, &path_cost, count_visits);
+      // Out of memory, already reported, fails the solve like the others
+      if(found < 0)
+        cancel_solve(STOP_FAILED);
+      break;
     default:
-      perror("Invalid maze component");
-      exit(0);
+      found = right_hand_maze_solver();
+      break;
   }
-  
+
+  pthread_mutex_lock(&monitor_lock);
+  solve_done = 1;
+  pthread_cond_signal(&monitor_cond);
+  pthread_mutex_unlock(&monitor_lock);
+  if(monitored)
+    pthread_join(monitor, NULL);
+  pthread_cond_destroy(&monitor_cond);
+
+  return found;
+}
+
+/*
+ * Solver daemon, started with: solve --serve <socket> [--cache-mb N]
+ *
+ * Listens on a Unix socket for one line requests of space separated
+ * key=value words:
+ *   maze=<file> or hash=<16 hex digits>  the maze to solve (required)
+ *   start=x,y goal=x,y                   move the maze's S and G to a
+ *                                        blank or terrain cell; every
+ *                                        other S (or G) is cleared
+ *   solver=<name>                        right, bfs, dijkstra, astar,
+ *                                        nearest, bitbfs or hpa; right-hand
+ *                                        by default
+ *   cluster=N                            cluster side of the HPA* index
+ *   out=<file>                           write the solution to a file
+ *                                        instead of sending it back
+ * or the single words "stats" and "shutdown". Each reply is one line,
+ * "OK key=value ..." or "ERR message", and an OK for a solve without out=
+ * is followed by the solution text. Parsed mazes stay in a maze_cache_t, so
+ * repeat requests skip reading and parsing; the solvers work on a copy.
+ * solver=hpa builds the maze's HPA* index on first use and keeps it in the
+ * cache with the maze.
+ */
+
+#define SERVE_CACHE_MB 1024
+
+maze_cache_t serve_cache;
+
+// Working copy of a cached maze for the solvers to mark, reused between
+// requests while the dimensions stay the same
+maze_t work;
+
+/**
+ * @brief     Copies a cached maze into the working maze
+ */
+int copy_to_work(const maze_t* from){
+  if(work.grid != NULL && (work.width != from->width || work.height != from->height))
+    maze_free(&work);
+  if(work.grid == NULL && maze_alloc(&work, from->width, from->height) != 0)
+    return -1;
+  // Same size means the same grid layout, so one copy takes every cell
+  memcpy(work.grid, from->grid, work.grid_cells * sizeof(maze_cell_t));
+  work.startX = from->startX;
+  work.startY = from->startY;
+  work.goalX = from->goalX;
+  work.goalY = from->goalY;
+  work.startCount = from->startCount;
+  work.goalCount = from->goalCount;
+  return 0;
+}
+
+/**
+ * @brief     Moves the working maze's start or goal to the cell named by "x,y"
+ * Every other marker of that type is cleared, so a maze with several
+ * starts or goals is left with just the one named. The cell may be blank
+ * or terrain, as for every solver. Returns NULL on success or the reason
+ * the cell cannot be used.
+ */
+const char* move_marker(maze_component_t type, const char* position, int* x, int* y,
+                        int* count){
+  int new_x, new_y;
+
+  if(sscanf(position, "%d,%d", &new_x, &new_y) != 2)
+    return "positions are given as x,y";
+  if(new_x < 0 || new_y < 0 || new_x >= work.width || new_y >= work.height)
+    return "position outside the maze";
+  maze_component_t old = maze_at(&work, new_x, new_y)->type;
+  if(old != BLANK && !IS_TERRAIN(old) && old != type)
+    return "start and goal must be on open cells";
+  if(*count > 1){
+    int i, j;
+    for(j = 0; j < work.height; j++)
+      for(i = 0; i < work.width; i++)
+        if(maze_at(&work, i, j)->type == type)
+          maze_at(&work, i, j)->type = BLANK;
+  }else if(maze_at(&work, *x, *y)->type == type){
+    maze_at(&work, *x, *y)->type = BLANK;
+  }
+  maze_at(&work, new_x, new_y)->type = type;
+  *x = new_x;
+  *y = new_y;
+  *count = 1;
+  return NULL;
+}
+
+/**
+ * @brief     Answers one request line; returns non-zero for "shutdown"
+ */
+int serve_request(char* line, FILE* reply){
+  char* maze_name = NULL;
+  char* hash_text = NULL;
+  char* start = NULL;
+  char* goal = NULL;
+  char* out_name = NULL;
+  solver_t solver = SOLVER_RIGHT;
+  int cluster = HPA_CLUSTER;
+  char* save = NULL;
+  char* word;
+  struct timespec began;
+
+  clock_gettime(CLOCK_MONOTONIC, &began);
+  line[strcspn(line, "\r\n")] = '\0';
+  for(word = strtok_r(line, " \t", &save); word != NULL; word = strtok_r(NULL, " \t", &save)){
+    if(strcmp(word, "shutdown") == 0){
+      fprintf(reply, "OK shutdown\n");
+      return 1;
+    }else if(strcmp(word, "stats") == 0){
+      fprintf(reply, "OK entries=%zu bytes=%zu cap=%zu hits=%lu misses=%lu\n",
+              serve_cache.entries, serve_cache.bytes, serve_cache.cap,
+              serve_cache.hits, serve_cache.misses);
+      return 0;
+    }else if(strncmp(word, "maze=", 5) == 0){
+      maze_name = word + 5;
+    }else if(strncmp(word, "hash=", 5) == 0){
+      hash_text = word + 5;
+    }else if(strncmp(word, "start=", 6) == 0){
+      start = word + 6;
+    }else if(strncmp(word, "goal=", 5) == 0){
+      goal = word + 5;
+    }else if(strncmp(word, "out=", 4) == 0){
+      out_name = word + 4;
+    }else if(strncmp(word, "solver=", 7) == 0){
+      for(solver = SOLVER_RIGHT; solver <= SOLVER_HPA; solver++){
+        if(strcmp(word + 7, solver_names[solver]) == 0) break;
+      }
+      if(solver > SOLVER_HPA){
+        fprintf(reply, "ERR unknown solver '%s'\n", word + 7);
+        return 0;
+      }
+    }else if(strncmp(word, "cluster=", 8) == 0){
+      cluster = atoi(word + 8);
+    }else{
+      fprintf(reply, "ERR unknown request word '%s'\n", word);
+      return 0;
+    }
+  }
+
+  /// Find the maze, from the cache if possible
+  maze_cache_entry_t* entry = NULL;
+  int hit = 0;
+  if(maze_name != NULL){
+    entry = maze_cache_by_path(&serve_cache, maze_name, &hit);
+    if(entry == NULL){
+      fprintf(reply, "ERR cannot load maze '%s'\n", maze_name);
+      return 0;
+    }
+  }else if(hash_text != NULL){
+    entry = maze_cache_by_hash(&serve_cache, strtoull(hash_text, NULL, 16));
+    hit = 1;
+    if(entry == NULL){
+      fprintf(reply, "ERR no cached maze with hash %s\n", hash_text);
+      return 0;
+    }
+  }else{
+    fprintf(reply, "ERR request needs maze= or hash=\n");
+    return 0;
+  }
+
+  if(copy_to_work(&entry->maze) != 0){
+    fprintf(reply, "ERR out of memory\n");
+    return 0;
+  }
+  const char* problem = NULL;
+  if(start != NULL)
+    problem = move_marker(START, start, &work.startX, &work.startY, &work.startCount);
+  if(problem == NULL && goal != NULL)
+    problem = move_marker(GOAL, goal, &work.goalX, &work.goalY, &work.goalCount);
+  if(problem != NULL){
+    fprintf(reply, "ERR %s\n", problem);
+    return 0;
+  }
+
+  // The index lives with the cached maze, start= and goal= do not change it
+  if(solver == SOLVER_HPA){
+    const hpa_index_t* index = maze_cache_index(&serve_cache, entry, cluster);
+    if(index == NULL){
+      fprintf(reply, "ERR cannot build an index with cluster=%d\n", cluster);
+      return 0;
+    }
+    hpa_index = *index;
+  }
+
+  /// Solve on the working copy
+  maze = work;
+  int found = run_solver(solver, NULL);
+  memset(&hpa_index, 0, sizeof(hpa_index_t));
+  if(found < 0){
+    fprintf(reply, "ERR solver ran out of memory\n");
+    return 0;
+  }
+  const char* stopped = stop_reason == STOP_TIMEOUT ? " stopped=timeout"
+                      : stop_reason == STOP_VISITS ? " stopped=visits" : "";
+
+  if(out_name != NULL){
+    FILE* out = maze_open_output(out_name);
+    if(out == NULL || maze_write(out, &maze) != 0 || maze_close_output(out) != 0){
+      fprintf(reply, "ERR cannot write '%s'\n", out_name);
+      return 0;
+    }
+  }
+  fprintf(reply, "OK found=%d visits=%lu cost=%llu width=%d height=%d hash=%016llx cached=%d ms=%.3f%s\n",
+          found, visits, path_cost, maze.width, maze.height, (unsigned long long) entry->hash, hit,
+          seconds_since(&began) * 1000, stopped);
+  if(out_name == NULL)
+    maze_write(reply, &maze);
+  return 0;
+}
+
+/**
+ * @brief     Runs the solver daemon on a Unix socket until "shutdown"
+ */
+int serve(const char* socket_path, size_t cache_mb){
+  struct sockaddr_un addr;
+  int listener, done = 0;
+
+  if(strlen(socket_path) >= sizeof(addr.sun_path)){
+    fprintf(stderr, "Socket path too long\n");
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path);
+
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  // A socket file left behind by an earlier daemon would make bind fail
+  unlink(socket_path);
+  if(listener < 0 || bind(listener, (struct sockaddr*) &addr, sizeof(addr)) != 0
+     || listen(listener, 16) != 0){
+    perror("Error: cannot listen on socket");
+    return -1;
+  }
+  // A client hanging up mid-reply must not kill the daemon
+  signal(SIGPIPE, SIG_IGN);
+  maze_cache_init(&serve_cache, cache_mb << 20);
+  fprintf(stderr, "Serving on %s with a %zu MB maze cache\n", socket_path, cache_mb);
+
+  while(!done){
+    int client = accept(listener, NULL, NULL);
+    if(client < 0) continue;
+
+    // Separate streams for each direction, a socket cannot seek
+    FILE* in = fdopen(client, "r");
+    FILE* reply = fdopen(dup(client), "w");
+    if(in == NULL || reply == NULL){
+      if(in != NULL) fclose(in); else close(client);
+      if(reply != NULL) fclose(reply);
+      continue;
+    }
+    setvbuf(reply, NULL, _IOFBF, MAZE_IO_BUFFER);
+
+    char* line = NULL;
+    size_t capacity = 0;
+    while(!done && getline(&line, &capacity, in) > 0){
+      done = serve_request(line, reply);
+      fflush(reply);
+    }
+    free(line);
+    fclose(in);
+    fclose(reply);
+  }
+
+  close(listener);
+  unlink(socket_path);
+  maze_cache_clear(&serve_cache);
+  maze_free(&work);
+  return 0;
+}
+
+/**
+ * @brief     Sends one request to a solver daemon and prints the reply
+ * Returns 0 if the daemon answered OK.
+ */
+int query(const char* socket_path, int argc, char** argv){
+  struct sockaddr_un addr;
+  char buffer[1 << 16];
+  ssize_t got;
+  int fd, i, ok;
+  FILE* out;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0){
+    perror("Error: cannot connect to solver daemon");
+    return -1;
+  }
+
+  out = fdopen(dup(fd), "w");
+  for(i = 0; i < argc; i++)
+    fprintf(out, "%s%s", argv[i], i + 1 < argc ? " " : "\n");
+  fclose(out);
+  shutdown(fd, SHUT_WR);
+
+  got = read(fd, buffer, sizeof(buffer));
+  ok = got >= 2 && strncmp(buffer, "OK", 2) == 0;
+  while(got > 0){
+    fwrite(buffer, 1, got, stdout);
+    got = read(fd, buffer, sizeof(buffer));
+  }
+  close(fd);
+  return ok ? 0 : -1;
+}
+
+/**
+ * @brief     Returns the malloc'd default output file name for a maze file
+ * The addon goes before a compression extension: maze.gz -> maze_solution.gz
+ */
+char* output_name(const char* maze_file_name, const char* addon){
+  size_t base = strlen(maze_file_name);
+  const char* suffix = "";
+  if(maze_compression(maze_file_name) != MAZE_PLAIN){
+    suffix = strrchr(maze_file_name, '.');
+    base -= strlen(suffix);
+  }
+  size_t size = strlen(maze_file_name) + strlen(addon) + 1;
+  char* name = (char*) malloc(size);
+
+  if(name != NULL)
+    snprintf(name, size, "%.*s%s%s", (int) base, maze_file_name, addon, suffix);
+  return name;
+}
+
+/*
+ * Batch mode, solve --batch [maze files...]
+ *
+ * Solves many mazes in one process, taking the file names from the
+ * arguments or, when there are none, from stdin one per line. Every
+ * solution goes where solve would put it, <maze file>_solution. Mazes at
+ * most BITBFS_BATCH_WIDTH cells wide are read straight from their text
+ * into row masks and solved BITBFS_LANES at a time in lockstep; wider ones
+ * are parsed and solved one at a time. Either way the path is a shortest
+ * one, as with --bitbfs, and the result cache is not used.
+ */
+
+/// A narrow maze waiting for its lane in the batch
+typedef struct batch_maze {
+  char* name;
+  maze_text_t text;
+  int width;
+  /// Row masks of the maze and of its path, height words each
+  uint64_t* rows;
+  size_t capacity;
+} batch_maze_t;
+
+static batch_maze_t batch_mazes[BITBFS_LANES];
+static bitbfs_lane_t batch_lanes[BITBFS_LANES];
+static int batch_count;
+
+/**
+ * @brief     Writes a batch maze's text with its path marked
+ */
+static int batch_write(const batch_maze_t* entry, const bitbfs_lane_t* lane){
+  char* name = output_name(entry->name, "_solution");
+  char row[BITBFS_BATCH_WIDTH + 1];
+  FILE* out = name != NULL ? maze_open_output(name) : NULL;
+  int status = 0;
+  int x, y;
+
+  if(out == NULL){
+    perror("Error: solution file failed to open");
+    free(name);
+    return -1;
+  }
+  row[entry->width] = '\n';
+  for(y = 0; y < lane->height; y++){
+    memcpy(row, MAZE_ROW(&entry->text, entry->width, y), entry->width);
+    for(x = 0; x < entry->width; x++){
+      if(lane->path[y] & ((uint64_t) 1 << x))
+        row[x] = PATH;
+    }
+    if(fwrite(row, 1, entry->width + 1, out) != (size_t) entry->width + 1)
+      status = -1;
+  }
+  if(maze_close_output(out) != 0)
+    status = -1;
+  if(status != 0)
+    perror("Error: failed to write solution");
+  free(name);
+  return status;
+}
+
+/**
+ * @brief     Solves the gathered narrow mazes together and writes them out
+ * Returns the number of mazes solved, or -1 on error.
+ */
+static int batch_flush(){
+  int solved = 0;
+  int l;
+
+  if(batch_count == 0) return 0;
+  if(bitbfs_batch(batch_lanes, batch_count) != 0)
+    return -1;
+  for(l = 0; l < batch_count; l++){
+    if(batch_lanes[l].steps < 0)
+      fprintf(stderr,"%s: no solution\n", batch_mazes[l].name);
+    else
+      solved++;
+    if(batch_write(&batch_mazes[l], &batch_lanes[l]) != 0)
+      solved = -1;
+    maze_text_close(&batch_mazes[l].text);
+    free(batch_mazes[l].name);
+  }
+  batch_count = 0;
+  return solved;
+}
+
+/**
+ * @brief     Solves a maze too wide for the lockstep kernel on its own
+ * Returns 1 if solved, 0 if not, -1 on error.
+ */
+static int batch_wide(const char* name, const maze_text_t* text){
+  maze_t wide;
+  unsigned long long steps;
+  volatile int never = 0;
+  int found;
+
+  if(maze_parse(&wide, text->data, text->length, 0) != 0)
+    return -1;
+  found = bitbfs_solve(&wide, 1, &never, &steps, NULL);
+  if(found == 0)
+    fprintf(stderr,"%s: no solution\n", name);
+
+  char* solution = output_name(name, "_solution");
+  FILE* out = solution != NULL ? maze_open_output(solution) : NULL;
+  if(out == NULL || maze_write(out, &wide) != 0 || maze_close_output(out) != 0){
+    perror("Error: failed to write solution");
+    found = -1;
+  }
+  free(solution);
+  maze_free(&wide);
+  return found;
+}
+
+/**
+ * @brief     Reads one maze of the batch, solving it or queueing it for a lane
+ * Returns the number of mazes solved by this call, or -1 on error.
+ */
+static int batch_add(const char* name){
+  batch_maze_t* entry = &batch_mazes[batch_count];
+  bitbfs_lane_t* lane = &batch_lanes[batch_count];
+  maze_t scan;
+  int x, y;
+
+  if(maze_text_open(&entry->text, name) != 0){
+    fprintf(stderr,"%s: ", name);
+    perror("maze data file failed to open");
+    return -1;
+  }
+  if(maze_scan(&scan, entry->text.data, entry->text.length, 0) != 0){
+    fprintf(stderr,"%s: invalid maze\n", name);
+    maze_text_close(&entry->text);
+    return -1;
+  }
+  if(scan.startCount == 0 || scan.goalCount == 0){
+    fprintf(stderr,"%s: maze needs a start and a goal\n", name);
+    maze_text_close(&entry->text);
+    return -1;
+  }
+  if(scan.startCount > 1 || scan.goalCount > 1)
+    fprintf(stderr,"Warning: %s has %d starts and %d goals, solving from (%d,%d) to (%d,%d)\n",
+            name, scan.startCount, scan.goalCount, scan.startX, scan.startY, scan.goalX, scan.goalY);
+
+  if(scan.width > BITBFS_BATCH_WIDTH){
+    int found = batch_wide(name, &entry->text);
+    maze_text_close(&entry->text);
+    return found;
+  }
+
+  /// Pack the rows into masks, keeping the text to write the solution from
+  if((size_t) scan.height * 2 > entry->capacity){
+    uint64_t* grown = realloc(entry->rows, (size_t) scan.height * 2 * sizeof(uint64_t));
+    if(grown == NULL){
+      perror("Out of memory");
+      maze_text_close(&entry->text);
+      return -1;
+    }
+    entry->rows = grown;
+    entry->capacity = (size_t) scan.height * 2;
+  }
+  for(y = 0; y < scan.height; y++){
+    const char* row = MAZE_ROW(&entry->text, scan.width, y);
+    uint64_t open = 0;
+    for(x = 0; x < scan.width; x++){
+      if(row[x] != WALL)
+        open |= (uint64_t) 1 << x;
+    }
+    entry->rows[y] = open;
+  }
+  entry->name = strdup(name);
+  if(entry->name == NULL){
+    perror("Out of memory");
+    maze_text_close(&entry->text);
+    return -1;
+  }
+  entry->width = scan.width;
+  lane->height = scan.height;
+  lane->startX = scan.startX;
+  lane->startY = scan.startY;
+  lane->goalX = scan.goalX;
+  lane->goalY = scan.goalY;
+  lane->open = entry->rows;
+  lane->path = entry->rows + scan.height;
+
+  if(++batch_count < BITBFS_LANES) return 0;
+  return batch_flush();
+}
+
+/**
+ * @brief     Solves every maze named in names, or on stdin if there are none
+ * Returns 0 if every maze was read and its solution written.
+ */
+int batch_solve(char** names, int count){
+  struct timespec began;
+  unsigned long total = 0, solved = 0;
+  char* line = NULL;
+  size_t line_size = 0;
+  int failed = 0;
+  int result, i;
+
+  clock_gettime(CLOCK_MONOTONIC, &began);
+  for(i = 0; count == 0 || i < count; i++){
+    const char* name;
+    if(count > 0){
+      name = names[i];
+    }else{
+      ssize_t got = getline(&line, &line_size, stdin);
+      if(got < 0) break;
+      if(got > 0 && line[got - 1] == '\n') line[--got] = '\0';
+      if(got == 0) continue;
+      name = line;
+    }
+    total++;
+    result = batch_add(name);
+    if(result < 0) failed = 1;
+    else solved += result;
+  }
+  result = batch_flush();
+  if(result < 0) failed = 1;
+  else solved += result;
+  free(line);
+
+  double seconds = seconds_since(&began);
+  printf("Solved %lu of %lu mazes in %.3f s (%.1f us per maze)\n", solved, total, seconds,
+         total > 0 ? seconds * 1e6 / total : 0.0);
+  for(i = 0; i < BITBFS_LANES; i++)
+    free(batch_mazes[i].rows);
+  return failed ? -1 : 0;
+}
+
+/*
+ * Verify mode, solve --verify [--shortest] [maze files...]
+ *
+ * Checks that each maze's <maze file>_solution solves it, taking the file
+ * names from the arguments or, when there are none, from stdin one per
+ * line. Each pair is streamed in bands over all cores (see verify.h).
+ * Only invalid solutions are reported, one line each, then a count.
+ * --shortest also requires every route to be a shortest one.
+ */
+
+/**
+ * @brief     Verifies the solution of every maze named, or on stdin if none
+ * Returns 0 if every solution is valid, 1 if not.
+ */
+int verify_all(char** names, int count){
+  struct timespec began;
+  unsigned long total = 0, valid = 0;
+  char* line = NULL;
+  size_t line_size = 0;
+  int shortest = 0;
+  int i;
+
+  if(count > 0 && strcmp(names[0],"--shortest") == 0){
+    shortest = 1;
+    names++;
+    count--;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &began);
+  for(i = 0; count == 0 || i < count; i++){
+    verify_result_t result;
+    const char* name;
+    char* solution;
+    if(count > 0){
+      name = names[i];
+    }else{
+      ssize_t got = getline(&line, &line_size, stdin);
+      if(got < 0) break;
+      if(got > 0 && line[got - 1] == '\n') line[--got] = '\0';
+      if(got == 0) continue;
+      name = line;
+    }
+    total++;
+    solution = output_name(name, "_solution");
+    if(verify_solution(name, solution, shortest, &result) != 0)
+      printf("%s: could not be read\n", name);
+    else if(!result.valid)
+      printf("%s: %s\n", name, result.reason);
+    else
+      valid++;
+    free(solution);
+  }
+  free(line);
+
+  double seconds = seconds_since(&began);
+  printf("%lu of %lu solutions valid%s in %.3f s\n", valid, total,
+         shortest ? " and shortest" : "", seconds);
+  return valid == total ? 0 : 1;
+}
+
+/*
+ * Incremental mode, solve <maze file> --edits <file|->
+ *
+ * Solves the maze once, then reads batches of wall edits, one batch per
+ * line of space separated words:
+ *   wall=x,y    put a wall at (x,y)
+ *   open=x,y    clear the wall at (x,y)
+ *   path        send the path after the reply, in the --moves format
+ * After each batch the path is repaired with LPA* (see lpa.h), which keeps
+ * its search state between batches, so a batch costs in proportion to the
+ * cells whose distance it changed. The first solve and every batch are
+ * answered on stdout with one line "OK found=0|1 cost=N expanded=N ms=N"
+ * or "ERR message". A line with a bad word is rejected whole.
+ */
+
+/**
+ * @brief     Brings the search up to date and replies with the result
+ * Returns 0 on success or -1 if out of memory.
+ */
+static int edit_reply(lpa_t* lpa, int send_path, FILE* out){
+  struct timespec began;
+  unsigned long long cost;
+  unsigned long expanded;
+  maze_route_t route;
+  int found;
+
+  clock_gettime(CLOCK_MONOTONIC, &began);
+  found = lpa_solve(lpa, &cost, &expanded);
+  if(found < 0){
+    fprintf(out, "ERR out of memory\n");
+    return -1;
+  }
+  fprintf(out, "OK found=%d cost=%llu expanded=%lu ms=%.3f\n", found, cost, expanded,
+          seconds_since(&began) * 1e3);
+
+  // The path is only walked when asked for, it costs its length
+  if(send_path && found){
+    memset(&route, 0, sizeof(route));
+    if(lpa_route(lpa, &route) < 0){
+      fprintf(out, "ERR out of memory\n");
+      return -1;
+    }
+    route_write(out, &route);
+    route_free(&route);
+  }
+  fflush(out);
+  return 0;
+}
+
+/**
+ * @brief     Parses an edit word, returns 1 for wall=, 0 for open=, -1 otherwise
+ */
+static int edit_word(const char* word, int* x, int* y){
+  int wall = strncmp(word, "wall=", 5) == 0 ? 1 : strncmp(word, "open=", 5) == 0 ? 0 : -1;
+  char end;
+
+  if(wall < 0 || sscanf(word + 5, "%d,%d%c", x, y, &end) != 2) return -1;
+  return wall;
+}
+
+/**
+ * @brief     Runs an edit session on the global maze, see above
+ * Returns 0 once the edits run out, or -1 on error.
+ */
+int edit_session(const char* edits_name){
+  FILE* in = maze_is_stdio(edits_name) ? stdin : fopen(edits_name, "r");
+  char** words = NULL;
+  size_t word_capacity = 0;
+  char* line = NULL;
+  size_t line_size = 0;
+  lpa_t lpa;
+  int status;
+
+  if(in == NULL){
+    perror("Error: edits file failed to open");
+    return -1;
+  }
+  if(lpa_init(&lpa, &maze) != 0){
+    if(in != stdin) fclose(in);
+    return -1;
+  }
+
+  status = edit_reply(&lpa, 0, stdout);
+  while(status == 0 && getline(&line, &line_size, in) >= 0){
+    size_t count = 0, i;
+    int send_path = 0, x, y, bad = 0;
+    char* save;
+    char* word;
+
+    for(word = strtok_r(line, " \t\r\n", &save); word != NULL; word = strtok_r(NULL, " \t\r\n", &save)){
+      if(count == word_capacity){
+        word_capacity = word_capacity ? word_capacity * 2 : 64;
+        char** grown = realloc(words, word_capacity * sizeof(char*));
+        if(grown == NULL){
+          perror("Out of memory");
+          status = -1;
+          break;
+        }
+        words = grown;
+      }
+      words[count++] = word;
+    }
+    if(status != 0 || count == 0) continue;
+
+    /// Check the whole batch before changing anything
+    for(i = 0; i < count && !bad; i++){
+      if(strcmp(words[i], "path") == 0){
+        send_path = 1;
+      }else if(edit_word(words[i], &x, &y) < 0){
+        printf("ERR unknown edit word '%s'\n", words[i]);
+        bad = 1;
+      }else if(x < 0 || y < 0 || x >= maze.width || y >= maze.height
+               || maze_at(&maze, x, y)->type == START || maze_at(&maze, x, y)->type == GOAL){
+        printf("ERR cannot edit (%d,%d)\n", x, y);
+        bad = 1;
+      }
+    }
+    if(bad){
+      fflush(stdout);
+      continue;
+    }
+    for(i = 0; i < count && status == 0; i++){
+      int wall = edit_word(words[i], &x, &y);
+      if(wall >= 0 && lpa_set_wall(&lpa, x, y, wall) != 0){
+        printf("ERR out of memory\n");
+        status = -1;
+      }
+    }
+    if(status == 0)
+      status = edit_reply(&lpa, send_path, stdout);
+  }
+
+  free(line);
+  free(words);
+  lpa_free(&lpa);
+  if(in != stdin) fclose(in);
+  return status;
+}
+
+/**
+ * @brief     Writes a one line JSON summary of the solve ("-" for stdout)
+ * route is NULL if no path was found. cost is given by the solvers that
+ * weigh terrain (elsewhere it is the length) and visited counts what each
+ * solver counts as work: cells, or nodes and cells for HPA*.
+ */
+int write_summary(const char* path, solver_t solver, const maze_route_t* route, double seconds){
+  FILE* out = maze_open_output(path);
+  int goal_x = maze.goalX, goal_y = maze.goalY;
+  size_t i;
+
+  if(out == NULL) return -1;
+  // --nearest may end at any goal, find the one the route reached
+  if(route != NULL){
+    goal_x = route->x;
+    goal_y = route->y;
+    for(i = 0; i < route->length; i++)
+      route_move(route->moves[i], &goal_x, &goal_y);
+  }
+  fprintf(out, "{\"solver\":\"%s\",\"found\":%s,\"width\":%d,\"height\":%d,"
+          "\"start\":[%d,%d],\"goal\":[%d,%d],",
+          solver_names[solver], route != NULL ? "true" : "false", maze.width, maze.height,
+          maze.startX, maze.startY, goal_x, goal_y);
+  if(route == NULL)
+    fprintf(out, "\"length\":null,\"cost\":null,");
+  else if(solver == SOLVER_DIJKSTRA || solver == SOLVER_ASTAR || solver == SOLVER_HPA)
+    fprintf(out, "\"length\":%zu,\"cost\":%llu,", route->length, path_cost);
+  else
+    fprintf(out, "\"length\":%zu,\"cost\":%zu,", route->length, route->length);
+  fprintf(out, "\"visited\":%lu,\"seconds\":%.6f}\n", visits, seconds);
+  return maze_close_output(out);
 }
 
 /**
@@ -513,11 +1769,69 @@ void set_maze_component(maze_cell_t* cell, char component){
  * S - Entry point into the maze (Case Insensitive)
  * G - End point out of the maze (Case Insensitive) 
  *
+ * 1-9 - Open terrain that costs its digit to enter (space costs 1)
+ *
+ * --dijkstra and --astar find the cheapest path over the terrain, marking
+ * only the path so the terrain stays visible in the solution. The other
+ * solvers treat terrain as open space.
+ *
+ * --build-index file [--cluster N] writes an HPA* index of the maze instead
+ * of solving it, and --index file solves with it: only the index's small
+ * abstract graph and the clusters along the route are searched (see hpa.h).
+ *
+ * --bitbfs finds a shortest path with a bit-parallel BFS (see bitbfs.h).
+ * solve --batch [maze files...] solves many mazes in one run, small ones
+ * several at a time in the vector lanes (see batch_solve); with no files
+ * the names are read from stdin.
+ *
+ * --moves writes just the path, as the start cell and run-length encoded
+ * N/E/S/W moves (see maze_route.h), to <maze file>_moves or the -o file;
+ * render --path draws such a file over the maze. If there is no route
+ * nothing is written and solve exits with status 1. --summary file writes a
+ * one line JSON summary of the solve: path length and cost, cells
+ * visited and time.
+ *
+ * solve --verify [--shortest] [maze files...] checks that each maze's
+ * _solution file marks one unbroken route from S to G that crosses no
+ * wall (see verify_all); with no files the names are read from stdin.
+ *
+ * --edits file (or - for stdin) keeps solving the maze as walls are added
+ * and removed, repairing the path incrementally (see edit_session).
+ *
+ * A maze may hold several S and G markers. --nearest paths every start to
+ * its nearest goal in one multi-source search; the other solvers warn and
+ * use the last start and goal. --moves and --summary hold a single route,
+ * so they are refused with --nearest when there is more than one start.
+ *
  * Ideally the maze perimeter will be specified with walls, but the solver will
  * still determine a solution without. All mazes will be rectangular in shape,
  * the program dynamically determines the size of the maze and will exit early
  * if the maze width is not consistent or an invalid character is included.
  * 
+ * --timeout seconds and --max-visits N stop the solver early; whatever it has
+ * marked so far is still written out and solve exits with status 2. Solves
+ * running longer than a second report their progress on stderr.
+ *
+ * --trace file records every cell the solver marks, with a timestamp, for
+ * render to draw as a heat map or as animation frames.
+ *
+ * gzip (.gz) and zstd (.zst) mazes are read directly, and their solution
+ * is compressed the same way unless -o names another file; -o names ending
+ * in .gz or .zst are compressed too.
+ *
+ * --cache dir (or MAZE_CACHE_DIR) keeps solutions in a size capped on-disk
+ * cache keyed by the maze content and solver, so solving an unchanged maze
+ * again just copies the stored solution.
+ *
+ * solve --serve <socket> runs a daemon that keeps parsed mazes cached and
+ * answers solve requests on a Unix socket; solve --query <socket> sends it
+ * one request (see serve_request for the request words).
+ *
+ * A maze file name of "-" reads the maze from stdin, in which case the
+ * solution is written to stdout unless -o names another file. The solution
+ * otherwise goes to <maze file>_solution, or to the file given with -o
+ * ("-" for stdout).
+ *
  * A sample maze is given below along with the solution generated
  * by this program when using the default right hand maze solver.
  * 
@@ -543,143 +1857,282 @@ int main(int argc, char** argv){
   }
 
 	char* maze_file_name = argv[1];
-  int isBFS = 0;
-  char* maze_solver_method;
+  char* solution_file_name = NULL;
+  char* trace_file_name = NULL;
+  char* cache_dir = NULL;
+  char* build_index_name = NULL;
+  char* index_name = NULL;
+  char* summary_file_name = NULL;
+  char* edits_name = NULL;
+  int moves = 0;
+  int cluster = HPA_CLUSTER;
+  solver_t solver = SOLVER_RIGHT;
+  int i;
   pthread_mutex_init(&type_lock, NULL);
   sem_init(&type_sem,0,1);
   sem_init(&thread_sem,0,MAX_THREADS);
 
-  if(argc == 3){
-    maze_solver_method = argv[2];
+  /// Daemon mode, and its client
+  if(strcmp(argv[1],"--serve") == 0){
+    size_t cache_mb = SERVE_CACHE_MB;
+    if(argc < 3){
+      fprintf(stderr,"Usage: %s --serve <socket> [--cache-mb N]\n", argv[0]);
+      return -1;
+    }
+    if(argc > 4 && strcmp(argv[3],"--cache-mb") == 0)
+      cache_mb = strtoul(argv[4], NULL, 10);
+    return serve(argv[2], cache_mb);
+  }
+  if(strcmp(argv[1],"--query") == 0){
+    if(argc < 4){
+      fprintf(stderr,"Usage: %s --query <socket> <request words...>\n", argv[0]);
+      return -1;
+    }
+    return query(argv[2], argc - 3, argv + 3);
+  }
 
-    if(strncmp(maze_solver_method,"-t",1) != 0 && strncmp(maze_solver_method,"-T",1) != 0){
-      perror("Invalid solver option. Valid options: [-t,-T] or none for right-hand rule");
+  /// Batch mode for many small mazes
+  if(strcmp(argv[1],"--batch") == 0)
+    return batch_solve(argv + 2, argc - 2);
+
+  /// Checking solutions already written
+  if(strcmp(argv[1],"--verify") == 0)
+    return verify_all(argv + 2, argc - 2);
+
+  for(i = 2; i < argc; i++){
+    if(strcmp(argv[i],"-t") == 0 || strcmp(argv[i],"-T") == 0){
+      solver = SOLVER_BFS;
+    }else if(strcmp(argv[i],"--dijkstra") == 0){
+      solver = SOLVER_DIJKSTRA;
+    }else if(strcmp(argv[i],"--astar") == 0){
+      solver = SOLVER_ASTAR;
+    }else if(strcmp(argv[i],"--nearest") == 0){
+      solver = SOLVER_NEAREST;
+    }else if(strcmp(argv[i],"--bitbfs") == 0){
+      solver = SOLVER_BITBFS;
+    }else if(strcmp(argv[i],"--index") == 0 && i + 1 < argc){
+      index_name = argv[++i];
+      solver = SOLVER_HPA;
+    }else if(strcmp(argv[i],"--build-index") == 0 && i + 1 < argc){
+      build_index_name = argv[++i];
+    }else if(strcmp(argv[i],"--cluster") == 0 && i + 1 < argc){
+      cluster = atoi(argv[++i]);
+    }else if(strcmp(argv[i],"-o") == 0 && i + 1 < argc){
+      solution_file_name = argv[++i];
+    }else if(strcmp(argv[i],"--trace") == 0 && i + 1 < argc){
+      trace_file_name = argv[++i];
+    }else if(strcmp(argv[i],"--timeout") == 0 && i + 1 < argc){
+      timeout = atof(argv[++i]);
+    }else if(strcmp(argv[i],"--moves") == 0){
+      moves = 1;
+    }else if(strcmp(argv[i],"--edits") == 0 && i + 1 < argc){
+      edits_name = argv[++i];
+    }else if(strcmp(argv[i],"--summary") == 0 && i + 1 < argc){
+      summary_file_name = argv[++i];
+    }else if(strcmp(argv[i],"--max-visits") == 0 && i + 1 < argc){
+      max_visits = strtoul(argv[++i], NULL, 10);
+    }else if(strcmp(argv[i],"--cache") == 0 && i + 1 < argc){
+      cache_dir = argv[++i];
+    }else{
+      perror("Invalid solver option. Valid options: [-t,-T] or none for right-hand rule, [--dijkstra], [--astar], [--nearest], [--bitbfs], [--index file], [--moves], [--summary file], [--edits file], [--build-index file [--cluster N]], [-o file], [--trace file], [--timeout seconds], [--max-visits N], [--cache dir]");
       exit(0);
     }
-
-    isBFS = 1;
   }
 
-  /// Open the maze data file
-	FILE *maze_file = NULL;
-  maze_file = fopen(maze_file_name,"r");
-  if(maze_file == NULL){
+  // Status messages must stay out of a solution streamed to stdout
+  if(solution_file_name == NULL && maze_is_stdio(maze_file_name))
+    solution_file_name = "-";
+  FILE* info = maze_is_stdio(solution_file_name)
+               || (summary_file_name != NULL && maze_is_stdio(summary_file_name)) ? stderr : stdout;
+
+  // Name the solution file
+  char* owned_name = NULL;
+  if(solution_file_name == NULL)
+    solution_file_name = owned_name = output_name(maze_file_name, moves ? "_moves" : "_solution");
+
+  /// Read in maze data
+  maze_text_t maze_text;
+  if(maze_text_open(&maze_text, maze_file_name) != 0){
     perror("Error: maze data file failed to open");
     return -1;
   }
 
+  /// The HPA* index is only mapped here, queries read the pages they need
+  if(index_name != NULL && hpa_load(&hpa_index, index_name) != 0)
+    return -1;
 
-  /// Read in maze data
-  /// Determine maze size and validate data, determine start and goal locations
-  char cell;
-  int i = 0;
-  int j = 0;
-  if(DEBUG) printf("Input Maze:\n");
-  while(fscanf(maze_file,"%c",&cell) != EOF){
-    switch(cell){
-      case START:
-        maze.startX = j;
-        maze.startY = i;
-      case GOAL:
-        if(cell != START){
-          maze.goalX = i;
-          maze.goalY = j;
-        }
-      case WALL: case BLANK:
-        if(DEBUG) printf("%c",cell);
-        j++;
-        break;
-      case '\n': 
-        if(i == 0) maze.width = j;
-        if(maze.width != j){
-          perror("Invalid maze dimensions");
-          return -1;
-        }
-        i++;
-        j = 0;
-        if(DEBUG) printf("%c",cell);
-        break;
-      default:
-        perror("Invalid character in maze");
-        return -1;
+  /// A solution cached for this exact maze is copied out without solving.
+  // Traces, summaries and budget-limited solves always run, their output
+  // depends on more than the maze.
+  result_cache_t cache;
+  int cached = trace_file_name == NULL && summary_file_name == NULL && timeout <= 0
+               && max_visits == 0 && build_index_name == NULL && edits_name == NULL
+               && result_cache_open(&cache, cache_dir) == 0;
+  uint64_t hash = 0;
+  char mode[40];
+  if(cached){
+    const char* compressed = maze_compression(solution_file_name) == MAZE_GZIP ? ".gz"
+                             : maze_compression(solution_file_name) == MAZE_ZSTD ? ".zst" : "";
+    const char* output = moves ? "-moves" : "";
+    hash = maze_hash(maze_text.data, maze_text.length);
+    // HPA* routes depend on the index's cluster size
+    if(solver == SOLVER_HPA)
+      snprintf(mode, sizeof(mode), "solve-hpa-c%u%s%s", hpa_index.header->cluster, output,
+               compressed);
+    else
+      snprintf(mode, sizeof(mode), "solve-%s%s%s", solver_names[solver], output, compressed);
+    if(result_cache_fetch(&cache, hash, mode, solution_file_name) == 0){
+      fprintf(info,"Solution found in cache\n");
+      maze_text_close(&maze_text);
+      result_cache_close(&cache);
+      free(owned_name);
+      return 0;
     }
   }
-  maze.height = i;
-  if(DEBUG) printf("Start: (%d,%d)\nGoal: (%d,%d)\n",maze.startX,maze.startY,maze.goalX,maze.goalY);
 
-  /// Size the maze matrix and read in the maze data
-  rewind(maze_file);
+  /// Determine maze size and validate data, determine start and goal locations
+  if(maze_parse(&maze, maze_text.data, maze_text.length, 0) != 0)
+    return -1;
+  maze_text_close(&maze_text);
+  if(DEBUG) printf("Start: (%d,%d)\nGoal: (%d,%d)\n",maze.startX,maze.startY,maze.goalX,maze.goalY);
 
-  maze.cells = (maze_cell_t**) calloc(maze.height, sizeof(maze_cell_t*));
-  for(i = 0; i < maze.height; i++){
-    maze.cells[i] = (maze_cell_t*) calloc(maze.width, sizeof(maze_cell_t));
+  /// Build an HPA* index instead of solving
+  if(build_index_name != NULL){
+    struct timespec began;
+    hpa_index_t index;
+    clock_gettime(CLOCK_MONOTONIC, &began);
+    if(hpa_build(&index, &maze, cluster) != 0 || hpa_save(&index, build_index_name) != 0)
+      return -1;
+    fprintf(info,"Index: %dx%d clusters of %d, %u nodes, %llu edges, %.2f s\n",
+            (maze.width + cluster - 1) / cluster, (maze.height + cluster - 1) / cluster, cluster,
+            index.header->nodes, (unsigned long long) index.header->edges, seconds_since(&began));
+    hpa_free(&index);
+    free(owned_name);
+    return 0;
+  }
+  if(index_name != NULL && !hpa_matches(&hpa_index, &maze)){
+    fprintf(stderr,"Index '%s' was built for a different maze\n", index_name);
+    return -1;
+  }
+  // A moves file and a summary hold one route, --nearest finds one per start
+  if(solver == SOLVER_NEAREST && maze.startCount > 1
+     && (moves || summary_file_name != NULL)){
+    fprintf(stderr,"--moves and --summary follow a single route, they cannot be used with "
+            "--nearest on a maze with %d starts\n", maze.startCount);
+    return -1;
+  }
 
-    for(j = 0; j < maze.width; j++){
-      fscanf(maze_file, "%c", &cell);
-      set_maze_component(&maze.cells[i][j], cell);
-    }
-    fscanf(maze_file, "%c", &cell);
+  /// Repair the path under a stream of wall edits instead of solving once
+  if(edits_name != NULL){
+    if(maze.startCount > 1 || maze.goalCount > 1)
+      fprintf(stderr,"Warning: maze has %d starts and %d goals, solving from (%d,%d) to (%d,%d)\n",
+              maze.startCount, maze.goalCount, maze.startX, maze.startY, maze.goalX, maze.goalY);
+    int status = edit_session(edits_name);
+    free(owned_name);
+    return status;
   }
 
+  /// Record every cell the solver touches, for render --trace
+  if(trace_file_name != NULL && trace_start(trace_file_name, maze.width, maze.height) != 0)
+    return -1;
+
   /// Solve maze using selected rule
-  if(isBFS){
-    printf("Solving with BFS\n");
-    if(!bfs_maze_solver())
-      printf("No solution.\n");
-  }else{
-    printf("Solving with Right-Hand\n");
-    if(!right_hand_maze_solver())
-      printf("No solution.\n");
+  // The single target solvers use the last S and G, say so when there are more
+  if(solver != SOLVER_NEAREST && (maze.startCount > 1 || maze.goalCount > 1))
+    fprintf(stderr,"Warning: maze has %d starts and %d goals, solving from (%d,%d) to (%d,%d); "
+            "--nearest uses them all\n", maze.startCount, maze.goalCount,
+            maze.startX, maze.startY, maze.goalX, maze.goalY);
+
+  fprintf(info,"Solving with %s\n", solver_titles[solver]);
+  struct timespec solve_began;
+  clock_gettime(CLOCK_MONOTONIC, &solve_began);
+  int found = run_solver(solver, info);
+  double solve_seconds = seconds_since(&solve_began);
+  if(found < 0){
+    fprintf(stderr,"Solver failed, no solution written.\n");
+    if(trace_file_name != NULL)
+      trace_stop();
+    if(cached)
+      result_cache_close(&cache);
+    return -1;
+  }
+  if(found && (solver == SOLVER_DIJKSTRA || solver == SOLVER_ASTAR))
+    fprintf(info,"Path cost: %llu\n", path_cost);
+  if(found && solver == SOLVER_BITBFS)
+    fprintf(info,"Path length: %llu steps\n", path_cost);
+  if(found && solver == SOLVER_HPA)
+    fprintf(info,"Path cost: %llu, %lu nodes and cells searched\n", path_cost, visits);
+
+  // A budget stop still writes out how far the solver got
+  if(!found && stop_reason == STOP_TIMEOUT)
+    fprintf(info,"Time limit reached after %lu cells, writing partial result.\n", visits);
+  else if(!found && stop_reason == STOP_VISITS)
+    fprintf(info,"Visit limit reached after %lu cells, writing partial result.\n", visits);
+  else if(!found)
+    fprintf(info,"No solution.\n");
+  if(trace_file_name != NULL)
+    trace_stop();
+
+  // With --moves just the route through the maze is written, if there is one
+  maze_route_t route;
+  int routed = -1;
+  int status = 0;
+  int written = 0;
+  memset(&route, 0, sizeof(route));
+  if(moves){
+    routed = route_trace(&route, &maze);
+    if(routed < 0)
+      perror("Out of memory");
+    else if(routed == 0)
+      fprintf(stderr,"No route from start to goal, no moves written.\n");
   }
-
-  if(maze_file != NULL)
-    fclose(maze_file);
 
   /// Output maze solution to file
-  // Open file to store maze solution
-  FILE *solution_file = NULL;
-  char* addon = "_solution";
-  char* solution_file_name = (char*) calloc(sizeof(char), (strlen(maze_file_name) + strlen(addon) + 1));
-
-  strncat(solution_file_name, maze_file_name, strlen(maze_file_name));
-  strncat(solution_file_name, addon, strlen(addon));
-
-  solution_file = fopen(solution_file_name,"w+");
-
-  // Print maze
-  if(DEBUG) printf("\nSolution:\n");
-  for(i = 0; i < maze.height; i++){
-    for(j = 0; j < maze.width; j++){
-      if(DEBUG) printf("%c",maze.cells[i][j].type);
-      fprintf(solution_file,"%c",maze.cells[i][j].type);
+  if(!moves || routed == 1){
+    FILE *solution_file = maze_open_output(solution_file_name);
+    if(solution_file == NULL){
+      perror("Error: solution file failed to open");
+      return -1;
     }
-    fprintf(solution_file,"\n");
-    if(DEBUG) printf("\n");
+    written = (moves ? route_write(solution_file, &route) == 0
+               : maze_write(solution_file, &maze) == 0);
+    if(!written)
+      perror("Error: failed to write solution");
+    if(maze_close_output(solution_file) != 0)
+      written = 0;
+    if(!written)
+      status = -1;
+  }
+  // A route file with no moves would read as a valid empty route
+  if(moves && routed != 1)
+    status = 1;
+  // A budget stop wrote a partial result, which callers must tell apart.
+  // --nearest may have left some starts unreached even when others were found.
+  if(status == 0 && (stop_reason == STOP_TIMEOUT || stop_reason == STOP_VISITS)
+     && (!found || solver == SOLVER_NEAREST))
+    status = 2;
+
+  /// Summarise the solve as JSON, the route is read from the written grid
+  if(summary_file_name != NULL){
+    if(!moves)
+      routed = route_trace(&route, &maze);
+    if(routed < 0 || write_summary(summary_file_name, solver, routed == 1 ? &route : NULL,
+                                   solve_seconds) != 0)
+      perror("Error: failed to write summary");
+  }
+  route_free(&route);
+
+  // Keep the solution for the next run over the same maze
+  if(cached){
+    if(written && !maze_is_stdio(solution_file_name))
+      result_cache_store(&cache, hash, mode, solution_file_name);
+    result_cache_close(&cache);
   }
 
   // Cleanup
   sem_destroy(&type_sem);
   sem_destroy(&thread_sem);
   pthread_mutex_destroy(&type_lock);
-  free(solution_file_name);
-
-  if(solution_file != NULL)
-    fclose(solution_file);
+  free(owned_name);
+  return status;
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
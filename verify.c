@@ -0,0 +1,450 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      verify.c
+ * @brief     Streaming checks that a solution file really solves its maze
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "maze_io.h"
+#include "bitbfs.h"
+#include "verify.h"
+
+/// Cells that make up the route
+#define ON_ROUTE(c) ((c) == PATH || (c) == START || (c) == GOAL)
+
+/// Solution marks a solver may leave on an open cell
+#define IS_MARK(c) ((c) == PATH || (c) == VISIT || (c) == WRONG)
+
+/// One band of rows and what was found in it
+typedef struct verify_band {
+  int first_row;
+  int end_row;
+  /// First problem in the band, error_row is INT_MAX if there was none
+  int error_row;
+  char error[96];
+  unsigned long long path;
+  int starts;
+  int goals;
+  int start_x, start_y;
+  int goal_x, goal_y;
+  /// Route pieces inside the band, and the labels handed out for them
+  uint32_t pieces;
+  uint32_t labels;
+  /// Piece of each cell of the band's first and last rows, 0 off the route
+  uint32_t* top;
+  uint32_t* bottom;
+} verify_band_t;
+
+/// A verify in progress, shared by its threads
+typedef struct verify_state {
+  const maze_text_t* maze;
+  const maze_text_t* solution;
+  int width;
+  int height;
+  verify_band_t* bands;
+  int band_count;
+  int next_band;
+  /// Lowest row with a problem so far, bands below it are skipped
+  int error_row;
+} verify_state_t;
+
+/// Labels of one band being checked, kept by its thread
+typedef struct verify_labels {
+  uint32_t* parent;
+  size_t capacity;
+  uint32_t* above;
+  uint32_t* row;
+} verify_labels_t;
+
+/**
+ * @brief     Works out the width and height of maze text with fixed-width rows
+ * The last newline may be missing. Returns -1 if the length does not fit.
+ */
+static int text_shape(const maze_text_t* text, int* width, int* height){
+  const char* newline = memchr(text->data, '\n', text->length);
+  size_t row, rows;
+
+  if(newline == NULL || newline == text->data) return -1;
+  row = (size_t) (newline - text->data) + 1;
+  rows = text->length / row + (text->length % row == row - 1);
+  if(text->length % row != 0 && text->length % row != row - 1) return -1;
+  if(row - 1 > INT_MAX || rows > INT_MAX) return -1;
+  *width = (int) (row - 1);
+  *height = (int) rows;
+  return 0;
+}
+
+static uint32_t label_find(uint32_t* parent, uint32_t label){
+  while(parent[label] != label){
+    parent[label] = parent[parent[label]];
+    label = parent[label];
+  }
+  return label;
+}
+
+/**
+ * @brief     Joins two labels, returns 1 if they were separate pieces
+ */
+static int label_join(uint32_t* parent, uint32_t a, uint32_t b){
+  a = label_find(parent, a);
+  b = label_find(parent, b);
+  if(a == b) return 0;
+  if(a < b) parent[b] = a;
+  else parent[a] = b;
+  return 1;
+}
+
+/**
+ * @brief     Hands out a new label, returns 0 if out of memory
+ */
+static uint32_t label_new(verify_labels_t* labels, verify_band_t* band){
+  uint32_t label = ++band->labels;
+
+  if(label >= labels->capacity){
+    size_t capacity = labels->capacity ? labels->capacity * 2 : 4096;
+    uint32_t* grown = realloc(labels->parent, capacity * sizeof(uint32_t));
+    if(grown == NULL) return 0;
+    labels->parent = grown;
+    labels->capacity = capacity;
+  }
+  labels->parent[label] = label;
+  band->pieces++;
+  return label;
+}
+
+/**
+ * @brief     Records the first problem in a band, always returns -1
+ */
+static int band_error(verify_state_t* state, verify_band_t* band, int x, int y,
+                      const char* what){
+  int seen = __atomic_load_n(&state->error_row, __ATOMIC_RELAXED);
+
+  band->error_row = y;
+  snprintf(band->error, sizeof(band->error), "%s at (%d,%d)", what, x, y);
+  while(y < seen
+        && !__atomic_compare_exchange_n(&state->error_row, &seen, y, 1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+    ;
+  return -1;
+}
+
+/**
+ * @brief     Drops the whole pages of mapped text inside [from, to)
+ * The mapping is read only, so the pages come back from the file if a
+ * neighbouring band still needs them.
+ */
+static void drop_text(const maze_text_t* text, size_t from, size_t to){
+  size_t page = (size_t) sysconf(_SC_PAGESIZE);
+
+  if(!text->mapped) return;
+  from = (from + page - 1) / page * page;
+  to = to / page * page;
+  if(to > text->length) to = text->length / page * page;
+  if(from < to)
+    madvise(text->data + from, to - from, MADV_DONTNEED);
+}
+
+/**
+ * @brief     Checks the rows of one band
+ * Returns -1 at the first problem found, which is then in band->error.
+ */
+static int check_band(verify_state_t* state, verify_band_t* band, verify_labels_t* labels){
+  int width = state->width;
+  int height = state->height;
+  int x, y;
+
+  for(y = band->first_row; y < band->end_row; y++){
+    const char* maze = MAZE_ROW(state->maze, width, y);
+    const char* cells = MAZE_ROW(state->solution, width, y);
+    const char* up = y > 0 ? cells - (width + 1) : NULL;
+    const char* down = y + 1 < height ? cells + (width + 1) : NULL;
+    uint32_t* swap;
+
+    // A missing last newline was allowed for by text_shape
+    if(y + 1 < height && (maze[width] != '\n' || cells[width] != '\n'))
+      return band_error(state, band, width, y, "row does not end at the maze width");
+
+    for(x = 0; x < width; x++){
+      char m = maze[x];
+      char c = cells[x];
+      int degree;
+
+      labels->row[x] = 0;
+      if(m != WALL && m != BLANK && m != START && m != GOAL && !IS_TERRAIN(m))
+        return band_error(state, band, x, y, "invalid maze character");
+      if(c != m){
+        if(m == WALL && IS_MARK(c))
+          return band_error(state, band, x, y, "path crosses a wall");
+        if(!IS_MARK(c) || (m != BLANK && !IS_TERRAIN(m)))
+          return band_error(state, band, x, y, "solution differs from the maze");
+      }
+      if(!ON_ROUTE(c)) continue;
+
+      /// Route neighbours: two for a PATH cell, one for the start or goal
+      degree = (x > 0 && ON_ROUTE(cells[x - 1])) + (x + 1 < width && ON_ROUTE(cells[x + 1]))
+               + (up != NULL && ON_ROUTE(up[x])) + (down != NULL && ON_ROUTE(down[x]));
+      if(c == PATH){
+        band->path++;
+        if(degree < 2) return band_error(state, band, x, y, "route breaks");
+        if(degree > 2) return band_error(state, band, x, y, "route branches");
+      }else{
+        if(c == START){
+          band->starts++;
+          band->start_x = x;
+          band->start_y = y;
+        }else{
+          band->goals++;
+          band->goal_x = x;
+          band->goal_y = y;
+        }
+        if(degree == 0)
+          return band_error(state, band, x, y, c == START ? "route does not leave the start"
+                                                          : "route does not reach the goal");
+        if(degree > 1)
+          return band_error(state, band, x, y, c == START ? "route branches at the start"
+                                                          : "route branches at the goal");
+      }
+
+      /// Label the piece, joining the ones from the left and above
+      uint32_t left = x > 0 ? labels->row[x - 1] : 0;
+      uint32_t above = y > band->first_row ? labels->above[x] : 0;
+      if(left != 0 && above != 0){
+        labels->row[x] = left;
+        band->pieces -= label_join(labels->parent, left, above);
+      }else if(left != 0 || above != 0){
+        labels->row[x] = left | above;
+      }else if((labels->row[x] = label_new(labels, band)) == 0){
+        return band_error(state, band, x, y, "out of memory");
+      }
+    }
+    if(y == band->first_row)
+      memcpy(band->top, labels->row, width * sizeof(uint32_t));
+    swap = labels->above;
+    labels->above = labels->row;
+    labels->row = swap;
+  }
+
+  /// Edge rows by piece, for joining with the bands either side
+  memcpy(band->bottom, labels->above, width * sizeof(uint32_t));
+  for(x = 0; x < width; x++){
+    if(band->top[x] != 0) band->top[x] = label_find(labels->parent, band->top[x]);
+    if(band->bottom[x] != 0) band->bottom[x] = label_find(labels->parent, band->bottom[x]);
+  }
+  return 0;
+}
+
+/**
+ * @brief     Verify thread: checks the bands it takes, in row order
+ */
+static void* verify_worker(void* arg){
+  verify_state_t* state = arg;
+  size_t row_bytes = (size_t) state->width + 1;
+  verify_labels_t labels;
+  int b;
+
+  memset(&labels, 0, sizeof(verify_labels_t));
+  labels.above = malloc(state->width * sizeof(uint32_t));
+  labels.row = malloc(state->width * sizeof(uint32_t));
+  while((b = __atomic_fetch_add(&state->next_band, 1, __ATOMIC_RELAXED)) < state->band_count){
+    verify_band_t* band = &state->bands[b];
+    // Nothing below a known problem matters
+    if(band->first_row > __atomic_load_n(&state->error_row, __ATOMIC_RELAXED)) continue;
+    if(labels.above == NULL || labels.row == NULL || band->top == NULL || band->bottom == NULL){
+      band_error(state, band, 0, band->first_row, "out of memory");
+      continue;
+    }
+    check_band(state, band, &labels);
+    drop_text(state->maze, band->first_row * row_bytes, band->end_row * row_bytes);
+    drop_text(state->solution, band->first_row * row_bytes, band->end_row * row_bytes);
+  }
+  free(labels.parent);
+  free(labels.above);
+  free(labels.row);
+  return NULL;
+}
+
+/**
+ * @brief     Counts the route pieces of the whole maze
+ * Every band's pieces are numbered after the ones before it, and a piece
+ * touching the band below on the same column is joined to it there.
+ * Returns 0 if out of memory.
+ */
+static uint32_t count_pieces(const verify_state_t* state){
+  uint32_t* parent;
+  uint32_t* offset;
+  size_t labels = 1;
+  uint32_t pieces = 0;
+  size_t i;
+  int b, x;
+
+  offset = malloc(state->band_count * sizeof(uint32_t));
+  for(b = 0; b < state->band_count; b++){
+    labels += state->bands[b].labels;
+    pieces += state->bands[b].pieces;
+  }
+  parent = malloc(labels * sizeof(uint32_t));
+  if(offset == NULL || parent == NULL || labels > UINT32_MAX){
+    free(offset);
+    free(parent);
+    return 0;
+  }
+  for(labels = 0, b = 0; b < state->band_count; b++){
+    offset[b] = (uint32_t) labels;
+    labels += state->bands[b].labels;
+  }
+  for(i = 0; i <= labels; i++)
+    parent[i] = (uint32_t) i;
+
+  for(b = 0; b + 1 < state->band_count; b++){
+    const uint32_t* bottom = state->bands[b].bottom;
+    const uint32_t* top = state->bands[b + 1].top;
+    for(x = 0; x < state->width; x++){
+      if(bottom[x] != 0 && top[x] != 0)
+        pieces -= label_join(parent, offset[b] + bottom[x], offset[b + 1] + top[x]);
+    }
+  }
+  free(offset);
+  free(parent);
+  return pieces;
+}
+
+/**
+ * @brief     Checks a solution file against its maze
+ * Returns 0 with the outcome in result, or -1 after printing the reason
+ * if either file cannot be read.
+ */
+int verify_solution(const char* maze_name, const char* solution_name, int shortest,
+                    verify_result_t* result){
+  maze_text_t maze, solution;
+  verify_state_t state;
+  unsigned long long path = 0;
+  int starts = 0, goals = 0;
+  int start_x = 0, start_y = 0, goal_x = 0, goal_y = 0;
+  int solution_width, solution_height;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  pthread_t threads[VERIFY_THREADS];
+  int started[VERIFY_THREADS];
+  int thread_count, b, k;
+  uint32_t pieces;
+
+  memset(result, 0, sizeof(verify_result_t));
+  if(maze_text_open(&maze, maze_name) != 0){
+    perror("Error: maze file failed to open");
+    return -1;
+  }
+  if(maze_text_open(&solution, solution_name) != 0){
+    perror("Error: solution file failed to open");
+    maze_text_close(&maze);
+    return -1;
+  }
+
+  if(text_shape(&maze, &result->width, &result->height) != 0){
+    snprintf(result->reason, sizeof(result->reason), "maze rows are not all the same width");
+    goto done;
+  }
+  if(text_shape(&solution, &solution_width, &solution_height) != 0
+     || solution_width != result->width || solution_height != result->height){
+    snprintf(result->reason, sizeof(result->reason), "solution is not the size of the maze");
+    goto done;
+  }
+
+  memset(&state, 0, sizeof(verify_state_t));
+  state.maze = &maze;
+  state.solution = &solution;
+  state.width = result->width;
+  state.height = result->height;
+  state.error_row = INT_MAX;
+  state.band_count = (state.height + VERIFY_BAND_ROWS - 1) / VERIFY_BAND_ROWS;
+  state.bands = calloc(state.band_count, sizeof(verify_band_t));
+  if(state.bands == NULL){
+    perror("Out of memory");
+    maze_text_close(&maze);
+    maze_text_close(&solution);
+    return -1;
+  }
+  for(b = 0; b < state.band_count; b++){
+    verify_band_t* band = &state.bands[b];
+    band->first_row = b * VERIFY_BAND_ROWS;
+    band->end_row = b + 1 < state.band_count ? band->first_row + VERIFY_BAND_ROWS : state.height;
+    band->error_row = INT_MAX;
+    band->top = malloc(state.width * sizeof(uint32_t));
+    band->bottom = malloc(state.width * sizeof(uint32_t));
+  }
+
+  /// Bands on all cores
+  thread_count = cores < 1 ? 1 : cores > VERIFY_THREADS ? VERIFY_THREADS : (int) cores;
+  if(thread_count > state.band_count) thread_count = state.band_count;
+  for(k = 1; k < thread_count; k++)
+    started[k] = pthread_create(&threads[k], NULL, verify_worker, &state) == 0;
+  verify_worker(&state);
+  for(k = 1; k < thread_count; k++){
+    if(started[k]) pthread_join(threads[k], NULL);
+  }
+
+  /// The first problem in row order, else the totals
+  for(b = 0; b < state.band_count; b++){
+    const verify_band_t* band = &state.bands[b];
+    if(band->error_row != INT_MAX){
+      snprintf(result->reason, sizeof(result->reason), "%s", band->error);
+      break;
+    }
+    path += band->path;
+    starts += band->starts;
+    goals += band->goals;
+    if(band->starts > 0){
+      start_x = band->start_x;
+      start_y = band->start_y;
+    }
+    if(band->goals > 0){
+      goal_x = band->goal_x;
+      goal_y = band->goal_y;
+    }
+  }
+  if(b == state.band_count){
+    if(starts != 1 || goals != 1){
+      snprintf(result->reason, sizeof(result->reason), "maze has %d starts and %d goals, not one",
+               starts, goals);
+    }else if((pieces = count_pieces(&state)) != 1){
+      if(pieces == 0) snprintf(result->reason, sizeof(result->reason), "out of memory");
+      else snprintf(result->reason, sizeof(result->reason),
+                    "route is in %u pieces, not one from start to goal", pieces);
+    }else{
+      result->length = path + 1;
+      result->valid = 1;
+    }
+  }
+  for(b = 0; b < state.band_count; b++){
+    free(state.bands[b].top);
+    free(state.bands[b].bottom);
+  }
+  free(state.bands);
+
+  /// Against the shortest path, from the maze text itself
+  if(result->valid && shortest){
+    int found = bitbfs_text_distance(maze.data, result->width, result->height, start_x, start_y,
+                                     goal_x, goal_y, &result->shortest);
+    if(found != 1){
+      result->valid = 0;
+      snprintf(result->reason, sizeof(result->reason), "shortest path could not be found");
+    }else if(result->length != result->shortest){
+      result->valid = 0;
+      snprintf(result->reason, sizeof(result->reason), "route is %llu steps, shortest is %llu",
+               result->length, result->shortest);
+    }
+  }
+
+done:
+  maze_text_close(&maze);
+  maze_text_close(&solution);
+  return 0;
+}
+/** @} */
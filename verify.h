@@ -0,0 +1,57 @@
+/**
+ * @addtogroup common Common
+ * @{
+ */
+/**
+ * @file      verify.h
+ * @brief     Streaming checks that a solution file really solves its maze
+ *
+ * The maze and solution texts are walked side by side in bands of
+ * VERIFY_BAND_ROWS rows, the bands shared out over all cores. A solution
+ * is valid when it is the maze with only open cells (blank or terrain)
+ * marked, and its PATH cells form a single simple route from the start to
+ * the goal: the start and goal each have exactly one route neighbour (a
+ * PATH cell or the other end) and every PATH cell exactly two. Those
+ * counts only need the rows next to a cell; that the route is one piece,
+ * and not a path plus loops off to the side, is checked by labelling the
+ * route's connected pieces in each band and joining the labels where
+ * bands meet.
+ *
+ * A band holds two rows of labels and the labels of its edge rows, and
+ * memory mapped text is dropped from memory once its band is done, so
+ * even huge mazes are checked in a few MB (compressed files are still
+ * decompressed whole). Mazes with several starts or goals are not
+ * supported. The shortest check, if asked for, compares the route's step
+ * count to a bit-parallel BFS of the maze (see bitbfs.h); terrain costs
+ * are ignored there, so it does not apply to cheapest-cost solutions.
+ */
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+/// Rows per band of a verify
+#define VERIFY_BAND_ROWS 256
+
+/// Most threads a verify is split over
+#define VERIFY_THREADS 64
+
+/// Outcome of checking one solution
+typedef struct verify_result {
+  int valid;
+  /// Why the solution is not valid
+  char reason[128];
+  int width;
+  int height;
+  /// Route length in steps, and the shortest possible if that was checked
+  unsigned long long length;
+  unsigned long long shortest;
+} verify_result_t;
+
+/// Checks solution_name against maze_name, also against the shortest path
+/// length if shortest is set. Returns 0 with the outcome in result, or -1
+/// after printing the reason if either file cannot be read.
+int verify_solution(const char* maze_name, const char* solution_name, int shortest,
+                    verify_result_t* result);
+
+#endif
+/** @} */